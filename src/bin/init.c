@@ -39,10 +39,12 @@ int main(int argc, char *argv[])
   setenv("PATH", "/bin", 0);
   chdir("/home");
 
-  thread(launcher_thread, NULL);
+  pid_t launcher = thread(launcher_thread, NULL);
 
+  // Wait instead of spinning so that the kernel can idle.
+  int32_t status;
   while (1)
-    ;
+    waitpid(launcher, &status, 0);
 
   return 0;
 }
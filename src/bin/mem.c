@@ -0,0 +1,61 @@
+// mem.c
+//
+// Show memory usage.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include <mako.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static uint32_t kb(uint32_t pages)
+{
+  return pages * 4;
+}
+
+static void show_process(pid_t pid, meminfo_t *info)
+{
+  printf("%5u %8u %8u %8u %8u\n",
+         pid,
+         kb(info->resident),
+         kb(info->heap),
+         kb(info->stack),
+         kb(info->page_tables));
+}
+
+// Print system memory usage followed by the usage of every process,
+// or of the processes that are named. Sizes are in KB.
+// Usage: mem [<pid>...]
+int main(int argc, char *argv[])
+{
+  meminfo_t info;
+  meminfo(getpid(), &info);
+
+  printf("total      %8u KB\n", kb(info.total));
+  printf("used       %8u KB\n", kb(info.total - info.free));
+  printf("free       %8u KB\n", kb(info.free));
+  printf("min free   %8u KB\n", kb(info.min_free));
+  printf("low mark   %8u KB, reached %u times\n", kb(info.low_watermark), info.low_watermark_hits);
+  printf("kheap      %8u KB\n", kb(info.kernel_heap));
+  printf("page cache %8u KB\n", kb(info.page_cache));
+  printf("swap       %8u KB of %u KB\n", kb(info.swap_used), kb(info.swap_total));
+
+  printf("\n  PID      RSS     HEAP    STACK       PT\n");
+  if (argc > 1) {
+    for (int32_t i = 1; i < argc; ++i) {
+      pid_t pid = atoi(argv[i]);
+      if (meminfo(pid, &info) == -1)
+        printf("%5u: no such process\n", pid);
+      else
+        show_process(pid, &info);
+    }
+    return 0;
+  }
+
+  for (pid_t pid = 0; pid < MAX_PROCESS_COUNT; ++pid)
+    if (meminfo(pid, &info) == 0)
+      show_process(pid, &info);
+  return 0;
+}
@@ -0,0 +1,46 @@
+// sched.c
+//
+// Show scheduling statistics.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include <mako.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void show_process(pid_t pid, schedinfo_t *info)
+{
+  printf("%5u %4u %5u %5u %10u %8u %8u\n",
+         pid,
+         info->priority,
+         info->slice_length,
+         info->slice_left,
+         (uint32_t)info->cpu_time,
+         info->slice_count,
+         info->switch_count);
+}
+
+// Print the priority, time slice and CPU time of every process, or of
+// the processes that are named. Times are in milliseconds.
+// Usage: sched [<pid>...]
+int main(int argc, char *argv[])
+{
+  schedinfo_t info;
+  printf("  PID PRIO SLICE  LEFT        CPU   SLICES SWITCHES\n");
+  if (argc > 1) {
+    for (int32_t i = 1; i < argc; ++i) {
+      pid_t pid = atoi(argv[i]);
+      if (schedinfo(pid, &info) == -1)
+        printf("%5u: no such process\n", pid);
+      else
+        show_process(pid, &info);
+    }
+    return 0;
+  }
+
+  for (pid_t pid = 0; pid < MAX_PROCESS_COUNT; ++pid)
+    if (schedinfo(pid, &info) == 0)
+      show_process(pid, &info);
+  return 0;
+}
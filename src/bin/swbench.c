@@ -0,0 +1,43 @@
+// swbench.c
+//
+// Measure the cost of a context switch.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include <mako.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Two processes yield to each other, so that almost every yield
+// switches between address spaces. Usage: swbench [<iterations>]
+int main(int argc, char *argv[])
+{
+  int32_t iterations = 100000;
+  if (argc > 1)
+    iterations = atoi(argv[1]);
+  if (iterations <= 0) {
+    printf("Usage: swbench [<iterations>]\n");
+    return 1;
+  }
+
+  uint32_t start = systime();
+  pid_t child = fork();
+  if (child == (pid_t)-1)
+    return 1;
+  for (int32_t i = 0; i < iterations; ++i)
+    yield();
+  if (child == 0)
+    return 0;
+
+  int32_t status;
+  waitpid(child, &status, 0);
+  uint32_t elapsed = systime() - start;
+
+  uint32_t switches = iterations * 2;
+  printf("%u switches in %u ms\n", switches, elapsed);
+  printf("%u ns per switch\n", (uint32_t)(((uint64_t)elapsed * 1000000) / switches));
+  return 0;
+}
@@ -0,0 +1,14 @@
+// clock.h
+//
+// Clock IDs.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _CLOCK_COMMON_H_
+#define _CLOCK_COMMON_H_
+
+// There is no real-time clock, so both clocks count from boot.
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+#endif /* _CLOCK_COMMON_H_ */
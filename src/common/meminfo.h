@@ -0,0 +1,35 @@
+// meminfo.h
+//
+// Memory statistics.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _MEMINFO_COMMON_H_
+#define _MEMINFO_COMMON_H_
+
+#include <stdint.h>
+
+// Memory statistics of the system and of one process, returned by the
+// meminfo syscall. All sizes are numbers of pages.
+typedef struct meminfo_s
+{
+  // System.
+  uint32_t total;
+  uint32_t free;
+  uint32_t min_free;           // Fewest free pages since boot.
+  uint32_t low_watermark;      // Free memory is low below this.
+  uint32_t low_watermark_hits; // Times free memory became low.
+  uint32_t kernel_heap;
+  uint32_t page_cache; // Executable pages shared between processes.
+  uint32_t swap_total;
+  uint32_t swap_used;
+
+  // Process. Threads share the resident pages and page tables of their
+  // address space.
+  uint32_t resident;
+  uint32_t heap;
+  uint32_t stack;
+  uint32_t page_tables;
+} meminfo_t;
+
+#endif /* _MEMINFO_COMMON_H_ */
@@ -0,0 +1,35 @@
+// mman.h
+//
+// Memory mapping flags.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _MMAN_COMMON_H_
+#define _MMAN_COMMON_H_
+
+#include <stdint.h>
+
+#define PROT_NONE 0
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define PROT_EXEC 4
+
+#define MAP_SHARED 1
+#define MAP_PRIVATE 2
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_ANON MAP_ANONYMOUS
+
+// Arguments of the mmap syscall, which has more arguments than fit
+// in registers.
+typedef struct mmap_args_s
+{
+  uint32_t addr;
+  uint32_t len;
+  uint32_t prot;
+  uint32_t flags;
+  int32_t fd;
+  uint32_t offset;
+} mmap_args_t;
+
+#endif /* _MMAN_COMMON_H_ */
@@ -0,0 +1,13 @@
+// proc.h
+//
+// Process limits.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _PROC_COMMON_H_
+#define _PROC_COMMON_H_
+
+// Every pid is less than this.
+#define MAX_PROCESS_COUNT 64
+
+#endif /* _PROC_COMMON_H_ */
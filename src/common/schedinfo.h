@@ -0,0 +1,24 @@
+// schedinfo.h
+//
+// Scheduling statistics.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _SCHEDINFO_COMMON_H_
+#define _SCHEDINFO_COMMON_H_
+
+#include <stdint.h>
+
+// Scheduling statistics of a process, returned by the schedinfo
+// syscall. Times are in milliseconds.
+typedef struct schedinfo_s
+{
+  uint32_t priority;
+  uint32_t slice_length; // Length of a time slice at this priority.
+  uint32_t slice_left;   // Time left in the current slice.
+  uint64_t cpu_time;     // Time spent running.
+  uint32_t slice_count;  // Time slices used up.
+  uint32_t switch_count; // Times the process was switched to.
+} schedinfo_t;
+
+#endif /* _SCHEDINFO_COMMON_H_ */
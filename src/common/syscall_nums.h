@@ -52,5 +52,18 @@
 #define SYSCALL_UI_SET_WALLPAPER 41
 #define SYSCALL_UI_RESIZE_WINDOW 42
 #define SYSCALL_UI_ENABLE_MOUSE_MOVE_EVENTS 43
+#define SYSCALL_MMAP 44
+#define SYSCALL_MUNMAP 45
+#define SYSCALL_MPROTECT 46
+#define SYSCALL_SHM_MAP 47
+#define SYSCALL_SHM_UNLINK 48
+#define SYSCALL_SBRK 49
+#define SYSCALL_MEMINFO 50
+#define SYSCALL_STACKSIZE 51
+#define SYSCALL_SCHEDINFO 52
+#define SYSCALL_NANOSLEEP 53
+#define SYSCALL_CLOCK_GETTIME 54
+#define SYSCALL_FUTEX_WAIT 55
+#define SYSCALL_FUTEX_WAKE 56
 
 #endif /* _SYSCALL_NUMS_H_ */
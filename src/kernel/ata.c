@@ -258,9 +258,6 @@ static uint32_t ata_write(fs_node_t *node, uint32_t offset, uint32_t size, uint8
   CHECK(tmp_buf == NULL, "No memory.", written_size);
 
   while (current_block <= end_block) {
-    uint32_t res = ata_read_sector(dev, current_block, tmp_buf);
-    CHECK(res, "Error reading ATA device.", written_size);
-
     uint32_t offset = 0;
     uint32_t size = SECTOR_SIZE;
     if (current_block == start_block) {
@@ -270,6 +267,12 @@ static uint32_t ata_write(fs_node_t *node, uint32_t offset, uint32_t size, uint8
     if (current_block == end_block)
       size = end_offset - offset + 1;
 
+    // Sectors that are only partly written are read first.
+    uint32_t res = 0;
+    if (size < SECTOR_SIZE)
+      res = ata_read_sector(dev, current_block, tmp_buf);
+    CHECK(res, "Error reading ATA device.", written_size);
+
     u_memcpy(tmp_buf + offset, bufp, size);
     res = ata_write_sector(dev, current_block, tmp_buf);
     CHECK(res, "Error writing ATA device.", written_size);
@@ -383,6 +386,9 @@ static uint8_t ata_dev_setup(ata_dev_t *dev, fs_node_t *node, uint8_t is_primary
 
   outb(dev->ports.command_status, COMMAND_IDENTIFY);
   CHECK(!inb(dev->ports.command_status), "Drive does not exist.", 1);
+  // ATAPI drives such as CD-ROMs abort IDENTIFY.
+  status = wait_status(dev, 10000);
+  CHECK(status & STATUS_ERR, "Not an ATA drive.", 1);
 
   uint16_t *buf = (uint16_t *)(&dev->identity);
   for (uint32_t i = 0; i < 256; ++i)
@@ -420,7 +426,7 @@ void ata_secondary_interrupt_handler()
   outb(secondary_master.ports.busmaster_command, 0);
 }
 
-uint8_t ata_init(fs_node_t *node)
+uint8_t ata_init(fs_node_t *node, fs_node_t *secondary_node)
 {
   ata_pci_device = pci_find_device(ATA_VENDOR_ID, ATA_DEVICE_ID, -1);
   CHECK(!ata_pci_device.bits, "PCI device not found.", 1);
@@ -437,9 +443,11 @@ uint8_t ata_init(fs_node_t *node)
   /* log_info("ata", "Attempting to set up primary slave.\n"); */
   /* if (ata_dev_setup(&primary_slave, 1)) */
   /*   log_info("ata", "Could not set up primary slave.\n"); */
-  /* log_info("ata", "Attempting to set up secondary master.\n"); */
-  /* if (ata_dev_setup(&secondary_master, 0)) */
-  /*   log_info("ata", "Could not set up secondary master.\n"); */
+  log_info("ata", "Attempting to set up secondary master.\n");
+  if (ata_dev_setup(&secondary_master, secondary_node, 0)) {
+    log_info("ata", "Could not set up secondary master.\n");
+    u_memset(secondary_node, 0, sizeof(fs_node_t));
+  }
   /* log_info("ata", "Attempting to set up secondary slave.\n"); */
   /* if (ata_dev_setup(&secondary_slave, 0)) */
   /*   log_info("ata", "Could not set up secondary slave.\n"); */
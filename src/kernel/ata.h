@@ -73,6 +73,8 @@ typedef struct
   volatile uint32_t lock;
 } ata_dev_t;
 
-uint8_t ata_init(fs_node_t *node);
+// Set up the primary master drive, and the secondary master drive if
+// there is one. `secondary_node` is zeroed if there is not.
+uint8_t ata_init(fs_node_t *node, fs_node_t *secondary_node);
 
 #endif /* _ATA_H_ */
@@ -0,0 +1,95 @@
+// clock.c
+//
+// Monotonic clock.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "clock.h"
+#include "../common/stdint.h"
+#include "log.h"
+#include "pit.h"
+#include "util.h"
+#include <stddef.h>
+
+#define CPUID_TSC (1 << 4)
+
+// TSC ticks are converted to nanoseconds by multiplying by `mult` and
+// shifting right by MULT_SHIFT, which avoids 64-bit division.
+#define MULT_SHIFT 24
+
+// The TSC is counted against the PIT for this long. The PIT counter
+// wraps after about 55ms, and interrupts are disabled meanwhile.
+static const uint32_t CALIBRATION_NS = 50000000;
+
+static uint8_t tsc_enabled = 0;
+static uint32_t mult = 0;
+static uint64_t base_tsc = 0;
+static uint64_t base_ns = 0;
+
+static inline uint32_t cpuid_features()
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  return edx;
+}
+
+static inline uint64_t rdtsc()
+{
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+void clock_init()
+{
+  if ((cpuid_features() & CPUID_TSC) == 0) {
+    log_info("clock", "No TSC, using the PIT.\n");
+    return;
+  }
+
+  // Restart the PIT so that it does not wrap during calibration.
+  pit_set_timer(PIT_NO_TIMER);
+  uint64_t start_ns = pit_get_time_ns();
+  uint64_t start_tsc = rdtsc();
+  uint64_t end_ns;
+  do
+    end_ns = pit_get_time_ns();
+  while (end_ns - start_ns < CALIBRATION_NS);
+  uint64_t tsc_delta = rdtsc() - start_tsc;
+
+  // The product of the low half of a TSC delta and `mult` must fit in
+  // 64 bits, which holds for any TSC faster than about 4MHz.
+  if (tsc_delta == 0 || (tsc_delta >> 32)) {
+    log_info("clock", "Unusable TSC, using the PIT.\n");
+    return;
+  }
+  uint64_t m = u_div64((end_ns - start_ns) << MULT_SHIFT, (uint32_t)tsc_delta, NULL);
+  if ((m >> 32) || m == 0) {
+    log_info("clock", "Unusable TSC, using the PIT.\n");
+    return;
+  }
+
+  mult = m;
+  base_tsc = start_tsc;
+  base_ns = start_ns;
+  tsc_enabled = 1;
+  uint32_t khz = u_div64(tsc_delta * 1000000, (uint32_t)(end_ns - start_ns), NULL);
+  log_info("clock", "TSC runs at %u kHz.\n", khz);
+}
+
+uint64_t clock_get_time_ns()
+{
+  if (tsc_enabled == 0)
+    return pit_get_time_ns();
+
+  uint64_t delta = rdtsc() - base_tsc;
+  uint32_t hi = delta >> 32;
+  uint32_t lo = delta;
+  return base_ns + (((uint64_t)hi * mult) << (32 - MULT_SHIFT)) +
+         (((uint64_t)lo * mult) >> MULT_SHIFT);
+}
+
+uint64_t clock_get_time()
+{
+  return u_div64(clock_get_time_ns(), 1000000, NULL);
+}
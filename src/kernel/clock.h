@@ -0,0 +1,23 @@
+// clock.h
+//
+// Monotonic clock.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include "../common/stdint.h"
+
+// Calibrate the TSC against the PIT. Must be called with interrupts
+// disabled, shortly after pit_init.
+void clock_init();
+
+// Get the time since boot in nanoseconds. Uses the TSC if the CPU has
+// one and the PIT otherwise.
+uint64_t clock_get_time_ns();
+
+// Get the time since boot in milliseconds.
+uint64_t clock_get_time();
+
+#endif /* _CLOCK_H_ */
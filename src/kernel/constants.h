@@ -12,6 +12,8 @@
 #define SEGMENT_SELECTOR_KERNEL_CS 8
 #define SEGMENT_SELECTOR_KERNEL_DS 0x10
 #define KERNEL_START_VADDR 0xC0000000
+#define KERNEL_DIRECT_MAP_SIZE 0x400000
+#define LARGE_PAGE_SIZE 0x400000
 #define PAGE_SIZE_SHIFT 12
 #define PD_VADDR 0xFFFFF000
 #define FIRST_PT_VADDR 0xFFC00000
@@ -9,17 +9,21 @@
 #include "../common/stdint.h"
 #include "kheap.h"
 #include "log.h"
+#include "slab.h"
 #include "util.h"
 #include <stddef.h>
 
 // We assume everything has been allocated with kmalloc.
+// List nodes themselves come from their own object cache.
+
+static kmem_cache_t list_node_cache = KMEM_CACHE_INIT("list_node", sizeof(list_node_t));
 
 static void list_destroy_nodes(list_node_t *head)
 {
   while (head) {
     list_node_t *next = head->next;
     kfree(head->value);
-    kfree(head);
+    kmem_cache_free(&list_node_cache, head);
     head = next;
   }
 }
@@ -32,7 +36,7 @@ void list_destroy(list_t *list)
 
 void list_push_back(list_t *list, void *value)
 {
-  list_node_t *new_tail = kmalloc(sizeof(list_node_t));
+  list_node_t *new_tail = kmem_cache_alloc(&list_node_cache);
   u_memset(new_tail, 0, sizeof(list_node_t));
   new_tail->value = value;
   new_tail->prev = list->tail;
@@ -60,7 +64,7 @@ void list_pop_back(list_t *list)
 
 void list_push_front(list_t *list, void *value)
 {
-  list_node_t *new_head = kmalloc(sizeof(list_node_t));
+  list_node_t *new_head = kmem_cache_alloc(&list_node_cache);
   u_memset(new_head, 0, sizeof(list_node_t));
   new_head->value = value;
   new_head->next = list->head;
@@ -89,7 +93,7 @@ void list_pop_front(list_t *list)
 
 void list_insert_after(list_t *list, list_node_t *node, void *value)
 {
-  list_node_t *new_node = kmalloc(sizeof(list_node_t));
+  list_node_t *new_node = kmem_cache_alloc(&list_node_cache);
   u_memset(new_node, 0, sizeof(list_node_t));
   new_node->prev = node;
   new_node->next = node->next;
@@ -104,7 +108,7 @@ void list_insert_after(list_t *list, list_node_t *node, void *value)
 
 void list_insert_before(list_t *list, list_node_t *node, void *value)
 {
-  list_node_t *new_node = kmalloc(sizeof(list_node_t));
+  list_node_t *new_node = kmem_cache_alloc(&list_node_cache);
   u_memset(new_node, 0, sizeof(list_node_t));
   new_node->next = node;
   new_node->prev = node->prev;
@@ -134,6 +138,11 @@ void list_remove(list_t *list, list_node_t *node, uint8_t destroy)
   --(list->size);
 }
 
+void list_free_node(list_node_t *node)
+{
+  kmem_cache_free(&list_node_cache, node);
+}
+
 tree_node_t *tree_init(void *value)
 {
   tree_node_t *root = kmalloc(sizeof(tree_node_t));
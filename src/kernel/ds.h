@@ -53,6 +53,7 @@ void list_pop_front(list_t *);
 void list_insert_after(list_t *, list_node_t *, void *);
 void list_insert_before(list_t *, list_node_t *, void *);
 void list_remove(list_t *, list_node_t *, uint8_t);
+void list_free_node(list_node_t *);
 
 tree_node_t *tree_init(void *);
 void tree_insert(tree_node_t *, tree_node_t *);
@@ -8,7 +8,8 @@
 #include "elf.h"
 #include "../common/errno.h"
 #include "../common/stdint.h"
-#include "kheap.h"
+#include "constants.h"
+#include "fs.h"
 #include "log.h"
 #include "process.h"
 #include "util.h"
@@ -24,45 +25,44 @@ uint8_t elf_is_valid(uint8_t *buf)
   return buf[0] == ELFMAG0 && buf[1] == ELFMAG1 && buf[2] == ELFMAG2 && buf[3] == ELFMAG3;
 }
 
-uint8_t elf_load(process_image_t *img, uint8_t *buf)
+uint8_t elf_load(process_image_t *img, fs_node_t *node)
 {
   u_memset(img, 0, sizeof(process_image_t));
-  CHECK(elf_is_valid(buf) == 0, "Not a valid ELF executable.", 1);
 
-  Elf32_Header *ehdr = (Elf32_Header *)buf;
+  Elf32_Header ehdr;
+  int32_t rsize = fs_read(node, 0, sizeof(Elf32_Header), (uint8_t *)&ehdr);
+  CHECK(rsize != sizeof(Elf32_Header) || elf_is_valid(ehdr.e_ident) == 0,
+        "Not a valid ELF executable.",
+        1);
 
   // Not sure what to do with non-executable files.
-  CHECK(ehdr->e_type != ET_EXEC, "Cannot load non-executable file.", 1);
+  CHECK(ehdr.e_type != ET_EXEC, "Cannot load non-executable file.", 1);
 
-  // We are assuming that files only have two segments: text and data.
-  // This is not a safe assumption to make, but ehh...
-  CHECK(ehdr->e_phnum > 2, "Too many segments in executable file.", 1);
-
-  img->entry = ehdr->e_entry;
-  for (uint32_t idx = 0; idx < ehdr->e_phnum; idx++) {
-    Elf32_Phdr *phdr = (Elf32_Phdr *)(buf + ehdr->e_phoff + (idx * ehdr->e_phentsize));
-    if (phdr->p_type != PT_LOAD)
+  img->entry = ehdr.e_entry;
+  u_memcpy(&img->node, node, sizeof(fs_node_t));
+  for (uint32_t idx = 0; idx < ehdr.e_phnum; idx++) {
+    Elf32_Phdr phdr;
+    rsize =
+      fs_read(node, ehdr.e_phoff + (idx * ehdr.e_phentsize), sizeof(Elf32_Phdr), (uint8_t *)&phdr);
+    CHECK(rsize != sizeof(Elf32_Phdr), "Failed to read program header.", 1);
+    if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0)
       continue;
 
-    if (phdr->p_flags & PF_X) { // Text section.
-      img->text_vaddr = phdr->p_vaddr;
-      img->text_len = phdr->p_memsz;
-      img->text = kmalloc(phdr->p_memsz);
-      CHECK(img->text == NULL, "No memory.", ENOMEM);
-      u_memcpy(img->text, buf + phdr->p_offset, phdr->p_filesz);
-      if (phdr->p_memsz > phdr->p_filesz)
-        u_memset(img->text + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
-      continue;
-    }
+    CHECK(img->segment_count == PROCESS_MAX_SEGMENTS, "Too many segments in executable file.", 1);
+    CHECK(phdr.p_filesz > phdr.p_memsz || phdr.p_vaddr >= KERNEL_START_VADDR ||
+            phdr.p_memsz > KERNEL_START_VADDR - phdr.p_vaddr ||
+            phdr.p_offset + phdr.p_filesz < phdr.p_offset ||
+            phdr.p_offset + phdr.p_filesz > node->size,
+          "Invalid segment in executable file.",
+          1);
 
-    // Data section.
-    img->data_vaddr = phdr->p_vaddr;
-    img->data_len = phdr->p_memsz;
-    img->data = kmalloc(phdr->p_memsz);
-    CHECK(img->data == NULL, "No memory.", ENOMEM);
-    u_memcpy(img->data, buf + phdr->p_offset, phdr->p_filesz);
-    if (phdr->p_memsz > phdr->p_filesz)
-      u_memset(img->data + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
+    process_segment_t *segment = img->segments + img->segment_count;
+    segment->vaddr = phdr.p_vaddr;
+    segment->mem_len = phdr.p_memsz;
+    segment->file_offset = phdr.p_offset;
+    segment->file_len = phdr.p_filesz;
+    segment->writable = (phdr.p_flags & PF_W) != 0;
+    ++img->segment_count;
   }
 
   return 0;
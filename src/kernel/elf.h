@@ -9,6 +9,7 @@
 #define _ELF_H_
 
 #include "../common/stdint.h"
+#include "fs.h"
 #include "process.h"
 
 // ELF magic numbers.
@@ -83,6 +84,9 @@ typedef struct
 #define PF_R 4
 
 uint8_t elf_is_valid(uint8_t *);
-uint8_t elf_load(process_image_t *, uint8_t *);
+
+// Read the headers of an executable file and describe its segments.
+// Segment contents are not read until they are accessed.
+uint8_t elf_load(process_image_t *, fs_node_t *);
 
 #endif /* _ELF_H_ */
@@ -1,4 +1,3 @@
-
 // fpu.c
 //
 // FPU context handling.
@@ -7,19 +6,93 @@
 
 #include "fpu.h"
 #include "../common/stdint.h"
+#include "log.h"
 #include "process.h"
+#include "smp.h"
 #include "util.h"
+#include <stddef.h>
+
+// FPU state is loaded lazily. The TS flag in cr0 is set whenever a CPU
+// switches away from a process that has used the FPU, so the next FPU
+// instruction raises a device-not-available exception, and its handler
+// loads the state of the current process. Processes that never use the
+// FPU never pay for saving and restoring it.
+//
+// A process that has used the FPU is saved when it is switched out, so
+// that it can run on any CPU next. Its state also stays in the FPU of
+// that CPU, and is not loaded again if the process uses the FPU there
+// before any other process does.
+
+// Process whose state is in the FPU of each CPU. It is only valid if
+// the `fpu_cpu` of the process is that CPU.
+static process_t *owners[MAX_CPU_COUNT];
+
+// Has the current process of each CPU used the FPU since it was
+// switched to? TS is clear if and only if it has.
+static uint8_t used[MAX_CPU_COUNT];
+
+// fxsave and fxrstor need aligned memory.
+static uint8_t buffers[MAX_CPU_COUNT][512] __attribute__((aligned(16)));
+
+static inline void set_ts()
+{
+  uint32_t cr0;
+  asm volatile("movl %%cr0, %0" : "=r"(cr0));
+  asm volatile("movl %0, %%cr0" ::"r"(cr0 | 8));
+}
 
-static uint8_t saved_fp_regs[512] __attribute__((aligned(16)));
+static void save(process_t *p, uint32_t cpu)
+{
+  asm volatile("fxsave (%0)" ::"r"(buffers[cpu]) : "memory");
+  u_memcpy(p->fpregs, buffers[cpu], 512);
+}
+
+void fpu_switch()
+{
+  uint32_t cpu = smp_cpu_id();
+  if (!used[cpu])
+    return;
+  save(owners[cpu], cpu);
+  used[cpu] = 0;
+  set_ts();
+}
 
-void fpu_save(process_t *p)
+void fpu_flush(process_t *p)
 {
-  asm volatile("fxsave (%0)" ::"r"(saved_fp_regs));
-  u_memcpy(p->fpregs, saved_fp_regs, 512);
+  uint32_t cpu = smp_cpu_id();
+  if (used[cpu] && owners[cpu] == p)
+    save(p, cpu);
 }
 
-void fpu_restore(process_t *p)
+void fpu_forget(process_t *p)
 {
-  u_memcpy(saved_fp_regs, p->fpregs, 512);
-  asm volatile("fxrstor (%0)" ::"r"(saved_fp_regs));
+  uint32_t cpu = smp_cpu_id();
+  if (used[cpu] && owners[cpu] == p) {
+    used[cpu] = 0;
+    set_ts();
+  }
+  // Another CPU does not hold the state of a process that it is not
+  // running, so it only has to forget its owner.
+  for (uint32_t i = 0; i < MAX_CPU_COUNT; ++i)
+    if (owners[i] == p)
+      owners[i] = NULL;
+}
+
+void fpu_trap_handler(cpu_state_t cs, idt_info_t info, stack_state_t ss)
+{
+  uint32_t cpu = smp_cpu_id();
+  process_t *current = process_current();
+  asm volatile("clts");
+  if (current == NULL) {
+    log_error("fpu", "eip %x: FPU used without a process\n", ss.eip);
+    return;
+  }
+
+  if (owners[cpu] != current || current->fpu_cpu != cpu) {
+    u_memcpy(buffers[cpu], current->fpregs, 512);
+    asm volatile("fxrstor (%0)" ::"r"(buffers[cpu]) : "memory");
+    owners[cpu] = current;
+    current->fpu_cpu = cpu;
+  }
+  used[cpu] = 1;
 }
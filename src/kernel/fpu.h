@@ -1,4 +1,3 @@
-
 // fpu.h
 //
 // FPU context handling.
@@ -8,10 +7,28 @@
 #ifndef _FPU_H_
 #define _FPU_H_
 
+#include "interrupt.h"
 #include "process.h"
 
+// Value of `fpu_cpu` for a process whose state is in no FPU.
+#define FPU_NO_CPU 0xff
+
+// Initialize the FPU of this CPU. Implemented in fpu.s.
 void fpu_init();
-void fpu_save(process_t *);
-void fpu_restore(process_t *);
+
+// Save the FPU state of the current process of this CPU if it has used
+// the FPU since it was switched to. Called when switching away from it.
+void fpu_switch();
+
+// Save the FPU state of a process that is running on this CPU, e.g
+// before it is copied.
+void fpu_flush(process_t *);
+
+// Forget a process that is being killed.
+void fpu_forget(process_t *);
+
+// Device-not-available exception handler, which loads the FPU state of
+// the current process.
+void fpu_trap_handler(cpu_state_t, idt_info_t, stack_state_t);
 
 #endif /* _FPU_H_ */
@@ -21,4 +21,10 @@ fpu_init:
     mov cr4, eax
 
     fninit
+
+    ; Set TS, so that the FPU state of each process is loaded when it
+    ; first uses the FPU. See fpu.c.
+    mov eax, cr0
+    or eax, 8
+    mov cr0, eax
     ret
@@ -13,6 +13,8 @@
 #include "klock.h"
 #include "log.h"
 #include "process.h"
+#include "slab.h"
+#include "text.h"
 #include "util.h"
 #include <stddef.h>
 
@@ -32,6 +34,27 @@
 static tree_node_t *fs_tree = NULL;
 static volatile uint32_t fs_tree_lock = 0;
 
+// Object caches for nodes and directory entries.
+static kmem_cache_t fs_node_cache = KMEM_CACHE_INIT("fs_node", sizeof(fs_node_t));
+static kmem_cache_t dirent_cache = KMEM_CACHE_INIT("dirent", sizeof(struct dirent));
+
+fs_node_t *fs_node_alloc()
+{
+  return kmem_cache_alloc(&fs_node_cache);
+}
+void fs_node_free(fs_node_t *node)
+{
+  kmem_cache_free(&fs_node_cache, node);
+}
+struct dirent *fs_dirent_alloc()
+{
+  return kmem_cache_alloc(&dirent_cache);
+}
+void fs_dirent_free(struct dirent *ent)
+{
+  kmem_cache_free(&dirent_cache, ent);
+}
+
 void fs_open(fs_node_t *node, uint32_t flags)
 {
   if (node && node->open)
@@ -50,6 +73,10 @@ int32_t fs_read(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer
 }
 int32_t fs_write(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer)
 {
+  // Running copies of an executable keep the pages they have, but
+  // new ones must not share stale pages.
+  if (node && node->type == FS_FILE)
+    text_invalidate(node);
   if (node && node->write)
     return node->write(node, offset, size, buffer);
   return -ENODEV;
@@ -63,7 +90,7 @@ struct dirent *fs_readdir(fs_node_t *node, uint32_t index)
     tree_node_t *tnode = node->tree_node;
     if (tnode != fs_tree) {
       if (index < 2) {
-        struct dirent *ent = kmalloc(sizeof(struct dirent));
+        struct dirent *ent = fs_dirent_alloc();
         if (ent == NULL)
           return NULL;
         char *name = index == 0 ? FS_DIR_SELF : FS_DIR_UP;
@@ -84,7 +111,7 @@ struct dirent *fs_readdir(fs_node_t *node, uint32_t index)
           break;
         --index;
       }
-      struct dirent *ent = kmalloc(sizeof(struct dirent));
+      struct dirent *ent = fs_dirent_alloc();
       if (ent == NULL)
         return NULL;
       u_memcpy(ent->d_name, child->name, u_strlen(child->name) + 1);
@@ -346,7 +373,7 @@ int32_t fs_rename(char *old, char *new)
 
 static fs_node_t *vfs_node_create()
 {
-  fs_node_t *node = kmalloc(sizeof(fs_node_t));
+  fs_node_t *node = fs_node_alloc();
   CHECK(node == NULL, "No memory.", NULL);
   u_memset(node, 0, sizeof(fs_node_t));
   node->mask = 0555;
@@ -485,14 +512,14 @@ uint32_t fs_open_node(fs_node_t *out_node, const char *path, uint32_t flags)
 
       fs_close(node);
       if (node->tree_node == NULL)
-        kfree(node);
+        fs_node_free(node);
       return fs_open_node(out_node, link_target, flags);
     }
 
     fs_node_t *next_node = fs_finddir(node, path_segments + path_idx);
     fs_close(node);
     if (node->tree_node == NULL)
-      kfree(node);
+      fs_node_free(node);
 
     if (next_node == NULL) {
       kfree(path_segments);
@@ -507,7 +534,7 @@ uint32_t fs_open_node(fs_node_t *out_node, const char *path, uint32_t flags)
   fs_open(node, flags);
   u_memcpy(out_node, node, sizeof(fs_node_t));
   if (node->tree_node == NULL)
-    kfree(node);
+    fs_node_free(node);
 
   return 0;
 }
@@ -110,6 +110,12 @@ int32_t fs_unlink(char *);
 int32_t fs_rename(char *, char *);
 // }
 
+// Allocate and free nodes and directory entries.
+fs_node_t *fs_node_alloc();
+void fs_node_free(fs_node_t *);
+struct dirent *fs_dirent_alloc();
+void fs_dirent_free(struct dirent *);
+
 // Initialize the filesystem interface and VFS.
 uint32_t fs_init();
 
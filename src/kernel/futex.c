@@ -0,0 +1,135 @@
+// futex.c
+//
+// Wait queues keyed on user memory.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "futex.h"
+#include "../common/errno.h"
+#include "../common/stdint.h"
+#include "constants.h"
+#include "ds.h"
+#include "interrupt.h"
+#include "paging.h"
+#include "process.h"
+#include <stddef.h>
+
+// Waiting processes are kept in a hash table of lists, keyed on the
+// physical address of the word they wait on. Processes that map the
+// same memory at different addresses, e.g shared memory segments, wake
+// each other.
+//
+// Waiting and waking both write the word with a locked instruction
+// before its physical address is looked up. A copy-on-write page is
+// copied by that write, so all threads of an address space agree on
+// the page. Pages that have waiters are not swapped out, so the address
+// does not change while processes wait on it.
+
+#define FUTEX_BUCKETS 64
+
+static list_t buckets[FUTEX_BUCKETS];
+
+// All words of a page are in the same list.
+static inline list_t *bucket_of(uint32_t paddr)
+{
+  return &buckets[(paddr >> PAGE_SIZE_SHIFT) % FUTEX_BUCKETS];
+}
+
+static inline uint8_t is_valid(uint32_t uaddr)
+{
+  return uaddr && (uaddr & 3) == 0 && uaddr < KERNEL_START_VADDR;
+}
+
+// Get the physical address of a user word, or 0 if the current process
+// cannot write to it. The word is written first, which may fault, so
+// this must be called with interrupts enabled. It returns with
+// interrupts disabled so that the page stays put.
+static uint32_t resolve(uint32_t uaddr)
+{
+  process_t *process = process_current();
+  while (1) {
+    if (!process_user_writable(process, uaddr)) {
+      disable_interrupts();
+      return 0;
+    }
+    __sync_fetch_and_or((volatile uint32_t *)uaddr, 0);
+    disable_interrupts();
+    uint32_t paddr = paging_get_paddr(uaddr);
+    if (paddr)
+      return paddr;
+    // The page has been swapped out in the meantime.
+    enable_interrupts();
+  }
+}
+
+uint32_t futex_wait(process_t *process, uint32_t uaddr, uint32_t val)
+{
+  if (!is_valid(uaddr)) {
+    disable_interrupts();
+    return EINVAL;
+  }
+  uint32_t paddr = resolve(uaddr);
+  if (paddr == 0)
+    return EFAULT;
+  if (*(volatile uint32_t *)uaddr != val)
+    return EAGAIN;
+
+  list_t *bucket = bucket_of(paddr);
+  list_push_back(bucket, process);
+  process->futex_node = bucket->tail;
+  process->futex_paddr = paddr;
+  return 0;
+}
+
+uint32_t futex_wake(uint32_t uaddr, uint32_t count, uint32_t *woken_out)
+{
+  *woken_out = 0;
+  if (!is_valid(uaddr))
+    return EINVAL;
+  uint32_t paddr = resolve(uaddr);
+  if (paddr == 0) {
+    enable_interrupts();
+    return EFAULT;
+  }
+
+  // Waiters are woken in the order in which they started waiting.
+  uint32_t woken = 0;
+  list_t *bucket = bucket_of(paddr);
+  list_node_t *node = bucket->head;
+  while (node && woken < count) {
+    list_node_t *next = node->next;
+    process_t *process = node->value;
+    if (process->futex_paddr == paddr) {
+      futex_cancel(process);
+      process_schedule(process);
+      ++woken;
+    }
+    node = next;
+  }
+  enable_interrupts();
+  *woken_out = woken;
+  return 0;
+}
+
+void futex_cancel(process_t *process)
+{
+  uint32_t eflags = interrupt_save_disable();
+  if (process->futex_node) {
+    list_remove(bucket_of(process->futex_paddr), process->futex_node, 0);
+    list_free_node(process->futex_node);
+    process->futex_node = NULL;
+  }
+  interrupt_restore(eflags);
+}
+
+uint8_t futex_page_has_waiters(uint32_t paddr)
+{
+  paddr &= ~(PAGE_SIZE - 1);
+  list_t *bucket = bucket_of(paddr);
+  for (list_node_t *node = bucket->head; node; node = node->next) {
+    process_t *process = node->value;
+    if ((process->futex_paddr & ~(PAGE_SIZE - 1)) == paddr)
+      return 1;
+  }
+  return 0;
+}
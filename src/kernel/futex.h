@@ -0,0 +1,32 @@
+// futex.h
+//
+// Wait queues keyed on user memory.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include "../common/stdint.h"
+#include "process.h"
+
+// Make a process wait on the word at a user address if it still holds
+// `val`. Must be called with interrupts enabled, and returns with
+// interrupts disabled so that the caller can switch away before it is
+// woken. Returns EAGAIN if the word has changed, and EFAULT if the
+// process cannot write to it.
+uint32_t futex_wait(process_t *, uint32_t uaddr, uint32_t val);
+
+// Wake up to `count` processes that wait on the word at a user address
+// and store the number of processes woken. Must be called with
+// interrupts enabled. Returns EFAULT if the current process cannot write
+// to the word.
+uint32_t futex_wake(uint32_t uaddr, uint32_t count, uint32_t *woken);
+
+// Stop a process from waiting, e.g when it is killed.
+void futex_cancel(process_t *);
+
+// Check whether a process waits on a word in a physical page.
+uint8_t futex_page_has_waiters(uint32_t paddr);
+
+#endif /* _FUTEX_H_ */
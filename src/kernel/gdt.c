@@ -7,6 +7,7 @@
 
 #include "gdt.h"
 #include "../common/stdint.h"
+#include "smp.h"
 #include "tss.h"
 
 // x86 processors divide memory into lots of small regions a.k.a 'segments'.
@@ -46,8 +47,10 @@ static const uint32_t SEGMENT_LIMIT = 0xFFFFF;
 static const uint8_t CODE_RX_TYPE = 0xA;
 static const uint8_t DATA_RW_TYPE = 0x2;
 
-// The actual global descriptor table. 6 entries.
-#define GDT_NUM_ENTRIES 6
+// The actual global descriptor table. 5 segments and a TSS for each
+// CPU, at TSS_SEGSEL + 8 * cpu. Each CPU loads its own TSS, so the task
+// register tells which CPU code is running on.
+#define GDT_NUM_ENTRIES (5 + MAX_CPU_COUNT)
 static gdt_entry_t gdt_entries[GDT_NUM_ENTRIES];
 
 // Load the global descriptor table. Implemented in gdt.s.
@@ -81,13 +84,21 @@ static void gdt_create_tss_entry(uint32_t index, uint32_t tss_vaddr)
   gdt_entries[index].limit_2 = 0;
 }
 
-// Initialize the GDT.
-void gdt_init(uint32_t tss_vaddr)
+// Load the GDT and the TSS of a CPU.
+static void gdt_load_cpu(uint32_t cpu)
 {
   gdt_ptr_t table_ptr;
   table_ptr.limit = sizeof(gdt_entry_t) * GDT_NUM_ENTRIES;
   table_ptr.base = (uint32_t)&gdt_entries;
 
+  // Execute LGDT and LTR instructions.
+  gdt_load((uint32_t)&table_ptr);
+  tss_load_set(TSS_SEGSEL + (cpu << 3));
+}
+
+// Initialize the GDT.
+void gdt_init()
+{
   // Null entry. This is necessary.
   gdt_create_entry(0, 0, 0);
 
@@ -103,10 +114,15 @@ void gdt_init(uint32_t tss_vaddr)
   // User mode data segment.
   gdt_create_entry(4, PL3, DATA_RW_TYPE);
 
-  // TSS.
-  gdt_create_tss_entry(5, tss_vaddr);
+  // TSS of each CPU.
+  for (uint32_t cpu = 0; cpu < MAX_CPU_COUNT; ++cpu)
+    gdt_create_tss_entry(5 + cpu, tss_get_vaddr(cpu));
 
-  // Execute LGDT and LTR instructions.
-  gdt_load((uint32_t)&table_ptr);
-  tss_load_set(TSS_SEGSEL);
+  gdt_load_cpu(0);
+}
+
+// Load the GDT on an application processor.
+void gdt_init_ap(uint32_t cpu)
+{
+  gdt_load_cpu(cpu);
 }
@@ -15,7 +15,10 @@
 #define PL3 0x3
 #define TSS_SEGSEL 0x28
 
-// Initialize the GDT.
-void gdt_init(uint32_t);
+// Initialize the GDT and load it on the boot CPU. Call after tss_init.
+void gdt_init();
+
+// Load the GDT on an application processor.
+void gdt_init_ap(uint32_t cpu);
 
 #endif /* _GDT_H_ */
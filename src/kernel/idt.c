@@ -83,6 +83,12 @@ void interrupt_handler_45();
 void interrupt_handler_46();
 void interrupt_handler_47();
 
+// Interrupt handlers defined in interrupt.s -- local APIC interrupts.
+void interrupt_handler_48();
+void interrupt_handler_49();
+void interrupt_handler_50();
+void interrupt_handler_255();
+
 // Syscall interrupt handler defined in syscall.s.
 void interrupt_handler_syscall();
 
@@ -150,8 +156,24 @@ void idt_init()
   IDT_CREATE_GATE(46);
   IDT_CREATE_GATE(47);
 
+  // Local APIC interrupts: LAPIC_TIMER_VECTOR, SMP_RESCHEDULE_VECTOR,
+  // SMP_TLB_VECTOR and LAPIC_SPURIOUS_VECTOR.
+  IDT_CREATE_GATE(48);
+  IDT_CREATE_GATE(49);
+  IDT_CREATE_GATE(50);
+  IDT_CREATE_GATE(255);
+
   // Syscall.
   idt_create_gate(SYSCALL_INT_IDX, (uint32_t)interrupt_handler_syscall, IDT_TRAP_GATE_TYPE, PL3);
 
   idt_load((uint32_t)&table_ptr);
 }
+
+// Load the IDT on an application processor.
+void idt_init_ap()
+{
+  idt_ptr_t table_ptr;
+  table_ptr.limit = sizeof(idt_gate_t) * IDT_NUM_ENTRIES;
+  table_ptr.base = (uint32_t)&idt_entries;
+  idt_load((uint32_t)&table_ptr);
+}
@@ -14,4 +14,7 @@
 // Initialize the IDT.
 void idt_init();
 
+// Load the IDT on an application processor.
+void idt_init_ap();
+
 #endif /* _IDT_H_ */
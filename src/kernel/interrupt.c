@@ -7,8 +7,10 @@
 
 #include "interrupt.h"
 #include "../common/stdint.h"
+#include "lapic.h"
 #include "log.h"
 #include "pic.h"
+#include "smp.h"
 
 // All registered interrupt handlers.
 static interrupt_handler_t registered_handlers[IDT_NUM_ENTRIES];
@@ -42,15 +44,32 @@ uint8_t unregister_interrupt_handler(uint32_t index)
 // Forward interrupts to registered handler.
 void forward_interrupt(cpu_state_t c_state, idt_info_t info, stack_state_t s_state)
 {
-  // Send acknowledgement to PIC for IRQs.
-  if (info.idt_index >= 32)
-    pic_acknowledge(info.idt_index);
-
-  if (registered_handlers[info.idt_index] == 0) {
-    log_error("interrupt", "unhandled interrupt %u, eip %x\n", info.idt_index, s_state.eip);
+  // TLB shootdowns are handled without the kernel lock, since the CPU
+  // that sends them holds it while it waits for them.
+  if (info.idt_index == SMP_TLB_VECTOR) {
+    smp_flush_tlb();
+    lapic_eoi();
     return;
   }
+  if (info.idt_index == LAPIC_SPURIOUS_VECTOR)
+    return;
+
+  // Interrupts from kernel code run on the CPU that holds the lock.
+  uint8_t locked = smp_lock_kernel();
 
-  registered_handlers[info.idt_index](c_state, info, s_state);
+  // Send acknowledgement to the PIC for IRQs and to the local APIC
+  // for its own interrupts.
+  if (info.idt_index >= LAPIC_TIMER_VECTOR)
+    lapic_eoi();
+  else if (info.idt_index >= 32)
+    pic_acknowledge(info.idt_index);
+
+  if (registered_handlers[info.idt_index] == 0)
+    log_error("interrupt", "unhandled interrupt %u, eip %x\n", info.idt_index, s_state.eip);
+  else
+    registered_handlers[info.idt_index](c_state, info, s_state);
   disable_interrupts();
+
+  if (locked)
+    smp_unlock_kernel();
 }
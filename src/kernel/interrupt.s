@@ -75,6 +75,12 @@ section .text
     no_error_code_handler 46
     no_error_code_handler 47
 
+    ; Local APIC interrupts, see lapic.h and smp.h
+    no_error_code_handler 48    ; Local APIC timer
+    no_error_code_handler 49    ; Reschedule
+    no_error_code_handler 50    ; TLB shootdown
+    no_error_code_handler 255   ; Spurious interrupt
+
     ; Common parts of the interrupt handlers.
     ; Pushes register state to the stack, forwards the interrupt
     ; to an interrupt_handler_t and restores register state.
@@ -1,4 +1,3 @@
-
 // kheap.c
 //
 // Kernel heap.
@@ -12,224 +11,413 @@
 #include "log.h"
 #include "paging.h"
 #include "pmm.h"
+#include "slab.h"
 #include "util.h"
 #include <stddef.h>
 
-// This is a simple first-fit allocator with block splitting / coalescing.
-
-static const size_t MIN_BLOCK_SIZE = 8;
-static const uint32_t PAGE_FREE_THRESHOLD = PAGE_SIZE;
-
-struct block_s
-{
-  // The size of each block is always an even number and the last bit
-  // is a flag that indicates whether an adjacent next block exists.
-  uint32_t size_next;
-  struct block_s *prev;
-  struct block_s *prev_free;
-  struct block_s *next_free;
-} __attribute__((packed));
-typedef struct block_s block_t;
-
-static block_t *head = NULL;
-
-// Simple block properties.
-static inline uint32_t size(block_t *block)
+// Small allocations are rounded up to a power-of-two size class and
+// served from that class's object cache, so allocating and freeing them
+// takes constant time. Allocations larger than the largest size class
+// get their own pages, preceded by a header that records their size.
+//
+// Pages that are freed by the object caches or by large allocations are
+// kept in a pool instead of being unmapped immediately, so that repeated
+// alloc/free cycles do not map and unmap the same pages over and over.
+//
+// The heap keeps running counters and a histogram of requested sizes.
+// When built with KHEAP_PROFILE, every kmalloc allocation is also
+// prefixed with a header that records its call site, so that live
+// allocations can be attributed to the code that made them.
+
+#define NUM_SIZE_CLASSES 8
+static const size_t MIN_CLASS_SIZE_SHIFT = 3; // Smallest size class is 8 bytes.
+static const size_t MAX_CLASS_SIZE = 1024;
+static const uint32_t MAX_POOLED_PAGES = 64;
+static const uint32_t LARGE_MAGIC = 0x6b686c67;
+#define NUM_HISTOGRAM_BUCKETS 32
+#define STATS_BUFFER_SIZE 0x4000
+
+// Header of a large allocation. Padded to 16 bytes so that large
+// allocations are as aligned as the biggest size class.
+typedef struct large_header_s
 {
-  return block->size_next & ~1;
-}
-static inline block_t *next(block_t *block)
+  uint32_t magic;
+  uint32_t npages;
+  uint32_t unused[2];
+} large_header_t;
+
+static kmem_cache_t size_classes[NUM_SIZE_CLASSES] = {
+  KMEM_CACHE_INIT("kmalloc-8", 8),     KMEM_CACHE_INIT("kmalloc-16", 16),
+  KMEM_CACHE_INIT("kmalloc-32", 32),   KMEM_CACHE_INIT("kmalloc-64", 64),
+  KMEM_CACHE_INIT("kmalloc-128", 128), KMEM_CACHE_INIT("kmalloc-256", 256),
+  KMEM_CACHE_INIT("kmalloc-512", 512), KMEM_CACHE_INIT("kmalloc-1024", 1024),
+};
+
+// Pool of free, mapped pages. The first word of each page points to
+// the next page in the pool.
+static void *page_pool = NULL;
+static uint32_t page_pool_size = 0;
+
+// Counters.
+static kheap_stats_t stats;
+static uint32_t size_histogram[NUM_HISTOGRAM_BUCKETS];
+static char stats_buffer[STATS_BUFFER_SIZE];
+
+#ifdef KHEAP_PROFILE
+#define MAX_CALL_SITES 128
+
+// Allocation statistics for a single caller of kmalloc.
+typedef struct call_site_s
 {
-  return (block_t *)((uint32_t)(block + 1) + size(block));
-}
-static inline uint8_t is_free(block_t *block)
+  uint32_t caller;
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t live_bytes;
+} call_site_t;
+
+// Prefix of each allocation in profiling builds. Padded to 16 bytes
+// to preserve the alignment of the underlying allocation.
+typedef struct profile_header_s
 {
-  return block->next_free || block->prev_free || head == block;
-}
+  uint32_t site;
+  uint32_t size;
+  uint32_t unused[2];
+} profile_header_t;
 
-// push_front and remove are the standard operations on the free list.
-static void push_front(block_t *block)
-{
-  block->prev_free = NULL;
-  block->next_free = head;
-  if (head)
-    head->prev_free = block;
-  head = block;
-}
-static void remove(block_t *block)
-{
-  if (block->next_free)
-    block->next_free->prev_free = block->prev_free;
-  if (block->prev_free)
-    block->prev_free->next_free = block->next_free;
-  else
-    head = block->next_free;
+// The last entry collects callers that do not fit in the table.
+static call_site_t call_sites[MAX_CALL_SITES + 1];
 
-  block->next_free = NULL;
-  block->prev_free = NULL;
+// Find or insert the entry for a caller.
+static uint32_t call_site_index(uint32_t caller)
+{
+  uint32_t start = (caller >> 2) % MAX_CALL_SITES;
+  for (uint32_t i = 0; i < MAX_CALL_SITES; ++i) {
+    uint32_t idx = (start + i) % MAX_CALL_SITES;
+    if (call_sites[idx].caller == caller)
+      return idx;
+    if (call_sites[idx].caller == 0) {
+      call_sites[idx].caller = caller;
+      return idx;
+    }
+  }
+  return MAX_CALL_SITES;
 }
+#endif
 
-// Split a block into two adjacent blocks.
-// The new block header is placed at `(uint32_t)(block + 1) + split_offset`
-// and is pushed onto the front of the free list.
-static void split(block_t *block, size_t split_offset)
+// Get the index of the smallest size class that fits `sz`.
+static inline uint32_t size_class(size_t sz)
 {
-  block_t *new_block = (block_t *)((uint32_t)(block + 1) + split_offset);
-  new_block->size_next = (size(block) - (split_offset + sizeof(block_t))) | (block->size_next & 1);
-  new_block->prev = block;
-  push_front(new_block);
-  if (block->size_next & 1)
-    next(block)->prev = new_block;
-  block->size_next = split_offset | 1;
+  uint32_t idx = 0;
+  while (((size_t)1 << (idx + MIN_CLASS_SIZE_SHIFT)) < sz)
+    ++idx;
+  return idx;
 }
 
-// Merge a block with the next block.
-// This function does not check the `next` flag and assumes that the blocks
-// are adjacent. The next block is removed from the free list.
-static block_t *merge(block_t *block)
+// Get the index of the histogram bucket for a request of `sz` bytes.
+// Bucket `i` holds requests of (2^(i-1), 2^i] bytes.
+static inline uint32_t histogram_bucket(size_t sz)
 {
-  block_t *next_block = next(block);
-  remove(next_block);
-  if (next_block->size_next & 1)
-    next(next_block)->prev = block;
-  block->size_next =
-    (size(block) + size(next_block) + sizeof(block_t)) | (next_block->size_next & 1);
-  return block;
+  uint32_t idx = 0;
+  while (idx < NUM_HISTOGRAM_BUCKETS - 1 && ((size_t)1 << idx) < sz)
+    ++idx;
+  return idx;
 }
 
-// Allocate enough pages to make a block with the given size.
-// The `size` parameter does not include the size of the block header.
-// The new block is pushed onto the front of the free list.
-static void alloc_pages(size_t size)
+// Map `npages` contiguous kernel pages. Returns the virtual address
+// of the first page or 0 if there is not enough memory.
+static uint32_t map_pages(uint32_t npages)
 {
-  size = u_page_align_up(size + sizeof(block_t));
-
-  uint32_t npages = size >> PAGE_SIZE_SHIFT;
   uint32_t vaddr = paging_next_vaddr(npages, KERNEL_START_VADDR);
   if (vaddr == 0)
-    return;
+    return 0;
 
   page_table_entry_t flags;
   u_memset(&flags, 0, sizeof(flags));
   flags.rw = 1;
-  uint32_t acquired_size = 0;
   for (uint32_t i = 0; i < npages; ++i) {
     uint32_t paddr = pmm_alloc(1);
-    if (paddr == 0)
-      break;
-    paging_result_t res = paging_map(vaddr + acquired_size, paddr, flags);
-    if (res != PAGING_OK)
-      break;
-    acquired_size += PAGE_SIZE;
+    paging_result_t res = PAGING_NO_MEMORY;
+    if (paddr)
+      res = paging_map(vaddr + (i << PAGE_SIZE_SHIFT), paddr, flags);
+    if (res == PAGING_OK)
+      continue;
+
+    if (paddr)
+      pmm_free(paddr, 1);
+    for (uint32_t k = 0; k < i; ++k) {
+      pmm_free(paging_get_paddr(vaddr + (k << PAGE_SIZE_SHIFT)), 1);
+      paging_unmap(vaddr + (k << PAGE_SIZE_SHIFT));
+    }
+    return 0;
   }
 
-  if (acquired_size == 0)
-    return;
+  stats.pages_mapped += npages;
+  return vaddr;
+}
 
-  block_t *new_block = (block_t *)vaddr;
-  new_block->size_next = acquired_size - sizeof(block_t);
-  new_block->prev = NULL;
-  push_front(new_block);
+// Unmap and free `npages` kernel pages starting at `vaddr`.
+static void unmap_pages(uint32_t vaddr, uint32_t npages)
+{
+  for (uint32_t i = 0; i < npages; ++i, vaddr += PAGE_SIZE) {
+    pmm_free(paging_get_paddr(vaddr), 1);
+    paging_unmap(vaddr);
+  }
+  stats.pages_mapped -= npages;
 }
 
-// Unmap and free any pages that are within `block`.
-static void free_pages(block_t *block)
+// Check whether `ptr` was returned by heap_alloc.
+static uint32_t is_heap_allocation(void *ptr)
 {
-  uint32_t block_start = (uint32_t)block;
-  uint32_t block_end = (uint32_t)next(block);
-  uint32_t page_start = u_page_align_up(block_start);
-  uint32_t page_end = u_page_align_down(block_end);
+  large_header_t *header = (large_header_t *)u_page_align_down((uint32_t)ptr);
+  if (header->magic == LARGE_MAGIC && (void *)(header + 1) == ptr)
+    return 1;
 
-  if (page_start > block_start && page_start - block_start < sizeof(block_t) + MIN_BLOCK_SIZE)
-    page_start += PAGE_SIZE;
-  if (block_end > page_end && block_end - page_end < sizeof(block_t) + MIN_BLOCK_SIZE)
-    page_end -= PAGE_SIZE;
+  kmem_cache_t *cache = kmem_cache_of(ptr);
+  return cache >= size_classes && cache < size_classes + NUM_SIZE_CLASSES;
+}
 
-  if (page_start >= page_end || page_end - page_start < PAGE_FREE_THRESHOLD)
-    return;
+// Get the number of bytes that a heap allocation actually occupies.
+static uint32_t allocation_size(void *ptr)
+{
+  large_header_t *header = (large_header_t *)u_page_align_down((uint32_t)ptr);
+  if (header->magic == LARGE_MAGIC && (void *)(header + 1) == ptr)
+    return header->npages << PAGE_SIZE_SHIFT;
+  return kmem_cache_of(ptr)->object_size;
+}
 
-  block_t *removed_block = block;
-  if (page_start > block_start) {
-    split(removed_block, page_start - (uint32_t)(removed_block + 1));
-    removed_block = head;
+static void *heap_alloc(size_t sz)
+{
+  void *ptr = NULL;
+  if (sz <= MAX_CLASS_SIZE)
+    ptr = kmem_cache_alloc(&size_classes[size_class(sz)]);
+  else {
+    uint32_t npages = u_page_align_up(sz + sizeof(large_header_t)) >> PAGE_SIZE_SHIFT;
+    large_header_t *header = kheap_alloc_pages(npages);
+    if (header) {
+      header->magic = LARGE_MAGIC;
+      header->npages = npages;
+      ptr = header + 1;
+    }
   }
-  if (block_end > page_end)
-    split(removed_block, page_end - (uint32_t)(removed_block + 1));
 
-  if (removed_block->size_next & 1)
-    next(removed_block)->prev = NULL;
-  if (removed_block->prev)
-    removed_block->prev->size_next &= ~1;
-  remove(removed_block);
+  uint32_t eflags = interrupt_save_disable();
+  if (ptr) {
+    ++stats.alloc_count;
+    stats.bytes_in_use += allocation_size(ptr);
+    if (stats.bytes_in_use > stats.peak_bytes_in_use)
+      stats.peak_bytes_in_use = stats.bytes_in_use;
+  } else
+    ++stats.failed_count;
+  interrupt_restore(eflags);
 
-  for (uint32_t vaddr = page_start; vaddr < page_end; vaddr += PAGE_SIZE) {
-    pmm_free(paging_get_paddr(vaddr), 1);
-    paging_unmap(vaddr);
+  return ptr;
+}
+
+static void heap_free(void *ptr)
+{
+  uint32_t eflags = interrupt_save_disable();
+  ++stats.free_count;
+  stats.bytes_in_use -= allocation_size(ptr);
+  interrupt_restore(eflags);
+
+  large_header_t *header = (large_header_t *)u_page_align_down((uint32_t)ptr);
+  if (header->magic == LARGE_MAGIC && (void *)(header + 1) == ptr) {
+    header->magic = 0;
+    kheap_free_pages(header, header->npages);
+    return;
   }
+
+  kmem_cache_free(kmem_cache_of(ptr), ptr);
 }
 
 void *kmalloc(size_t sz)
 {
   if (sz == 0)
     return NULL;
-  if (sz < MIN_BLOCK_SIZE)
-    sz = MIN_BLOCK_SIZE;
-  if (sz & 1)
-    ++sz;
-
-  // TODO: maybe use a klock instead of disabling interrupts?
-  // The overhead of getting pre-empted while mallocing and blocking
-  // other tasks from accessing the heap may outweigh the cost of disabling
-  // scheduler interrupts.
+
   uint32_t eflags = interrupt_save_disable();
+  ++size_histogram[histogram_bucket(sz)];
+  interrupt_restore(eflags);
 
-  block_t *current = head;
-  while (current && size(current) < sz)
-    current = current->next_free;
+#ifdef KHEAP_PROFILE
+  profile_header_t *header = heap_alloc(sz + sizeof(profile_header_t));
+  if (header == NULL)
+    return NULL;
 
-  if (current == NULL) {
-    alloc_pages(sz);
-    current = head;
-  }
-  if (current == NULL || size(current) < sz) {
+  eflags = interrupt_save_disable();
+  header->site = call_site_index((uint32_t)__builtin_return_address(0));
+  header->size = sz;
+  ++call_sites[header->site].allocs;
+  call_sites[header->site].live_bytes += sz;
+  interrupt_restore(eflags);
+
+  return header + 1;
+#else
+  return heap_alloc(sz);
+#endif
+}
+
+void kfree(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  void *allocation = ptr;
+#ifdef KHEAP_PROFILE
+  allocation = (profile_header_t *)ptr - 1;
+#endif
+  if (is_heap_allocation(allocation)) {
+#ifdef KHEAP_PROFILE
+    profile_header_t *header = allocation;
+    uint32_t eflags = interrupt_save_disable();
+    ++call_sites[header->site].frees;
+    call_sites[header->site].live_bytes -= header->size;
     interrupt_restore(eflags);
-    return NULL;
+#endif
+    heap_free(allocation);
+    return;
   }
 
-  if (size(current) - sz >= sizeof(block_t) + MIN_BLOCK_SIZE)
-    split(current, sz);
+  // Objects that were allocated directly from an object cache.
+  kmem_cache_t *cache = kmem_cache_of(ptr);
+  if (cache == NULL) {
+    log_error("kheap", "Attempt to free invalid pointer %x.\n", ptr);
+    return;
+  }
+  kmem_cache_free(cache, ptr);
+}
 
-  remove(current);
+void *kheap_alloc_pages(uint32_t npages)
+{
+  if (npages == 0)
+    return NULL;
 
-  interrupt_restore(eflags);
+  uint32_t eflags = interrupt_save_disable();
 
-  return (void *)(current + 1);
+  void *page = NULL;
+  if (npages == 1 && page_pool) {
+    page = page_pool;
+    page_pool = *(void **)page;
+    --page_pool_size;
+  } else
+    page = (void *)map_pages(npages);
+
+  interrupt_restore(eflags);
+  return page;
 }
 
-void kfree(void *ptr)
+void kheap_free_pages(void *ptr, uint32_t npages)
 {
   if (ptr == NULL)
     return;
 
   uint32_t eflags = interrupt_save_disable();
 
-  block_t *block = (block_t *)ptr - 1;
-  if (is_free(block)) {
-    interrupt_restore(eflags);
-    return;
+  uint32_t vaddr = (uint32_t)ptr;
+  for (; npages && page_pool_size < MAX_POOLED_PAGES; --npages, vaddr += PAGE_SIZE) {
+    *(void **)vaddr = page_pool;
+    page_pool = (void *)vaddr;
+    ++page_pool_size;
   }
+  unmap_pages(vaddr, npages);
 
-  push_front(block);
+  interrupt_restore(eflags);
+}
+
+void kheap_get_stats(kheap_stats_t *out)
+{
+  uint32_t eflags = interrupt_save_disable();
+
+  *out = stats;
+  out->pooled_pages = page_pool_size;
+  out->free_objects = 0;
+  out->fragmentation = 0;
+  uint32_t slab_bytes = 0;
+  uint32_t object_bytes = 0;
+  for (kmem_cache_t *cache = kmem_cache_list(); cache; cache = cache->next) {
+    out->free_objects += (cache->slab_count * cache->objects_per_slab) - cache->objects_inuse;
+    slab_bytes += cache->slab_count << PAGE_SIZE_SHIFT;
+    object_bytes += cache->objects_inuse * cache->object_size;
+  }
+  if (slab_bytes >= 100)
+    out->fragmentation = (slab_bytes - object_bytes) / (slab_bytes / 100);
+
+  interrupt_restore(eflags);
+}
+
+// Append formatted text to the stats buffer.
+#define STATS_PRINTF(len, ...)                                                                     \
+  (len) += log_sprintf(                                                                            \
+    stats_buffer + (len), (len) < STATS_BUFFER_SIZE ? STATS_BUFFER_SIZE - (len) : 0, __VA_ARGS__)
 
-  if (block->prev && is_free(block->prev)) {
-    block = block->prev;
-    merge(block);
+// Write a report of the heap's state into the stats buffer and return
+// its length. Must be called with interrupts disabled.
+static uint32_t format_stats()
+{
+  kheap_stats_t st;
+  kheap_get_stats(&st);
+
+  uint32_t len = 0;
+  STATS_PRINTF(len, "in use: %u bytes, peak %u bytes\n", st.bytes_in_use, st.peak_bytes_in_use);
+  STATS_PRINTF(
+    len, "calls: %u allocs, %u frees, %u failed\n", st.alloc_count, st.free_count, st.failed_count);
+  STATS_PRINTF(len, "pages: %u mapped, %u pooled\n", st.pages_mapped, st.pooled_pages);
+  STATS_PRINTF(len,
+               "slabs: %u free objects, %u%% fragmentation\n",
+               st.free_objects,
+               st.fragmentation);
+
+  STATS_PRINTF(len, "caches:\n");
+  for (kmem_cache_t *cache = kmem_cache_list(); cache; cache = cache->next)
+    STATS_PRINTF(len,
+                 "  %s: size %u, %u slabs, %u in use\n",
+                 cache->name,
+                 cache->object_size,
+                 cache->slab_count,
+                 cache->objects_inuse);
+
+  STATS_PRINTF(len, "request sizes:\n");
+  for (uint32_t i = 0; i < NUM_HISTOGRAM_BUCKETS; ++i)
+    if (size_histogram[i])
+      STATS_PRINTF(len, "  <= %u: %u\n", 1 << i, size_histogram[i]);
+
+#ifdef KHEAP_PROFILE
+  STATS_PRINTF(len, "call sites:\n");
+  for (uint32_t i = 0; i <= MAX_CALL_SITES; ++i) {
+    call_site_t *site = call_sites + i;
+    if (site->allocs == 0)
+      continue;
+    STATS_PRINTF(len,
+                 "  %x: %u allocs, %u frees, %u live bytes\n",
+                 site->caller,
+                 site->allocs,
+                 site->frees,
+                 site->live_bytes);
   }
-  if ((block->size_next & 1) && is_free(next(block)))
-    merge(block);
+#endif
+
+  return len < STATS_BUFFER_SIZE ? len : STATS_BUFFER_SIZE - 1;
+}
+
+uint32_t kheap_read_stats(uint32_t offset, uint32_t size, uint8_t *buf)
+{
+  uint32_t eflags = interrupt_save_disable();
 
-  if (size(block) + sizeof(block_t) >= PAGE_FREE_THRESHOLD)
-    free_pages(block);
+  uint32_t len = format_stats();
+  if (offset >= len)
+    size = 0;
+  else if (size > len - offset)
+    size = len - offset;
+  u_memcpy(buf, stats_buffer + offset, size);
 
   interrupt_restore(eflags);
+  return size;
+}
+
+void kheap_dump()
+{
+  uint32_t eflags = interrupt_save_disable();
+  format_stats();
+  log_info("kheap", "\n%s", stats_buffer);
+  interrupt_restore(eflags);
 }
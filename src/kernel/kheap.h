@@ -8,12 +8,43 @@
 #ifndef _KHEAP_H_
 #define _KHEAP_H_
 
+#include "../common/stdint.h"
 #include <stddef.h>
 
-// Allocate memory.
+// Kernel heap counters.
+typedef struct kheap_stats_s
+{
+  uint32_t bytes_in_use; // Bytes held by kmalloc allocations, including rounding.
+  uint32_t peak_bytes_in_use;
+  uint32_t alloc_count;
+  uint32_t free_count;
+  uint32_t failed_count;
+  uint32_t pages_mapped; // Pages mapped by the heap, including pooled pages.
+  uint32_t pooled_pages;
+  uint32_t free_objects;  // Length of the free lists of all object caches.
+  uint32_t fragmentation; // Percentage of slab memory not used by objects.
+} kheap_stats_t;
+
+// Allocate memory. Allocations of up to 1KB are served from
+// power-of-two size classes, larger ones from whole pages.
 void *kmalloc(size_t);
 
-// Free memory.
+// Free memory allocated with kmalloc or any object cache.
 void kfree(void *);
 
+// Allocate and free whole pages of kernel memory. Pages returned by
+// kheap_alloc_pages are page-aligned, contiguous and writable.
+void *kheap_alloc_pages(uint32_t);
+void kheap_free_pages(void *, uint32_t);
+
+// Get a snapshot of the heap's counters.
+void kheap_get_stats(kheap_stats_t *);
+
+// Read part of a text report of the heap's state. Returns the
+// number of bytes read.
+uint32_t kheap_read_stats(uint32_t offset, uint32_t size, uint8_t *buf);
+
+// Write a report of the heap's state to the log.
+void kheap_dump();
+
 #endif /* _KHEAP_H_ */
@@ -1,4 +1,3 @@
-
 // klock.c
 //
 // Kernel locks.
@@ -7,22 +6,44 @@
 
 #include "klock.h"
 #include "../common/stdint.h"
-#include "constants.h"
 #include "interrupt.h"
-#include "log.h"
 #include "process.h"
-#include "util.h"
+#include "wait.h"
+#include <stddef.h>
+
+// Processes that wait for a lock sleep in one of a few wait queues,
+// picked by the address of the lock. Since a queue may hold waiters of
+// several locks, unlocking wakes all of them and each one checks its
+// lock again.
+#define KLOCK_QUEUES 32
+
+static wait_queue_t queues[KLOCK_QUEUES];
+
+static inline wait_queue_t *queue_of(klock_t lock)
+{
+  return &queues[((uint32_t)lock >> 2) % KLOCK_QUEUES];
+}
 
-void klock_wait(process_registers_t regs)
+void klock(klock_t lock)
 {
-  if (process_current()) {
-    regs.esp += 16;
-    u_memcpy(&(process_current()->kregs), &regs, sizeof(process_registers_t));
-    process_switch_next();
+  uint32_t eflags = interrupt_save_disable();
+  // There is nothing to suspend before the first process runs, when
+  // locks are not contended.
+  process_t *current = process_current();
+  while (*lock && current) {
+    wait_prepare(queue_of(lock), current);
+    wait_sleep(current);
   }
+  *lock = 1;
+  interrupt_restore(eflags);
 }
 
 void kunlock(klock_t lock)
 {
+  uint32_t eflags = interrupt_save_disable();
   *lock = 0;
+  wait_queue_t *queue = queue_of(lock);
+  if (queue->processes.size)
+    wait_wake_all(queue);
+  interrupt_restore(eflags);
 }
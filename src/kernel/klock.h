@@ -12,6 +12,8 @@
 
 typedef volatile uint32_t *klock_t;
 
+// Take and release a lock. A process that waits for a lock sleeps
+// until it is released.
 void klock(klock_t);
 void kunlock(klock_t);
 
@@ -6,6 +6,7 @@
 // Author: Ajay Tatachar <ajaymt2@illinois.edu>
 
 #include "ata.h"
+#include "clock.h"
 #include "constants.h"
 #include "elf.h"
 #include "fpu.h"
@@ -15,6 +16,7 @@
 #include "interrupt.h"
 #include "kheap.h"
 #include "klock.h"
+#include "kmutex.h"
 #include "log.h"
 #include "multiboot.h"
 #include "paging.h"
@@ -24,6 +26,8 @@
 #include "process.h"
 #include "ps2.h"
 #include "serial.h"
+#include "smp.h"
+#include "swap.h"
 #include "syscall.h"
 #include "tss.h"
 #include "ui.h"
@@ -53,6 +57,27 @@ uint32_t debug_write(fs_node_t *n, uint32_t offset, uint32_t size, uint8_t *buf)
   return size;
 }
 
+uint32_t kheap_node_read(fs_node_t *n, uint32_t offset, uint32_t size, uint8_t *buf)
+{
+  return kheap_read_stats(offset, size, buf);
+}
+
+uint32_t swap_node_read(fs_node_t *n, uint32_t offset, uint32_t size, uint8_t *buf)
+{
+  return swap_read_stats(offset, size, buf);
+}
+
+uint32_t locks_node_read(fs_node_t *n, uint32_t offset, uint32_t size, uint8_t *buf)
+{
+  return kmutex_read_stats(offset, size, buf);
+}
+
+uint32_t kheap_node_write(fs_node_t *n, uint32_t offset, uint32_t size, uint8_t *buf)
+{
+  kheap_dump();
+  return size;
+}
+
 #define CHECK(err, name)                                                                           \
   if ((err)) {                                                                                     \
     log_error("kmain", "Failed to initialize " name "\n");                                         \
@@ -86,11 +111,14 @@ void kmain(uint32_t mb_info_addr,
   serial_init(SERIAL_COM1_BASE);
   fpu_init();
   tss_init();
-  uint32_t tss_vaddr = tss_get_vaddr();
-  gdt_init(tss_vaddr);
+  gdt_init();
+  // The boot CPU holds the kernel lock until it first switches to a
+  // process, so that other CPUs wait for it to finish booting.
+  smp_lock_kernel();
   idt_init();
   pic_init();
   pit_init();
+  clock_init();
 
   register_interrupt_handler(14, page_fault_handler);
 
@@ -106,10 +134,15 @@ void kmain(uint32_t mb_info_addr,
   CHECK(err, "fs");
 
   static fs_node_t hda_node;
-  err = ata_init(&hda_node);
+  static fs_node_t hdc_node;
+  err = ata_init(&hda_node, &hdc_node);
   CHECK(err, "ata");
   err = ustar_init(&hda_node);
   CHECK(err, "ustar");
+  if (hdc_node.device) {
+    err = swap_init(&hdc_node);
+    CHECK(err, "swap");
+  }
   err = ps2_init();
   CHECK(err, "ps2");
 
@@ -119,15 +152,11 @@ void kmain(uint32_t mb_info_addr,
   log_info("kmain", "video frame buffer addr = %x\n", video_frame_buffer_addr);
 
   const uint32_t num_video_pages = (SCREENWIDTH * SCREENHEIGHT * sizeof(uint32_t)) >> 12;
-  uint32_t video_vaddr = paging_next_vaddr(num_video_pages, KERNEL_START_VADDR);
   page_table_entry_t flags;
   u_memset(&flags, 0, sizeof(flags));
   flags.rw = 1;
-  paging_result_t r;
-  for (uint32_t i = 0; i < num_video_pages; ++i) {
-    r = paging_map(video_vaddr + (i << 12), video_frame_buffer_addr + (i << 12), flags);
-    CHECK(r != PAGING_OK, "ui");
-  }
+  uint32_t video_vaddr = paging_map_kernel_region(video_frame_buffer_addr, num_video_pages, flags);
+  CHECK(video_vaddr == 0, "ui");
   err = ui_init(video_vaddr);
   CHECK(err, "ui");
 
@@ -137,6 +166,25 @@ void kmain(uint32_t mb_info_addr,
   err = fs_mount(&debug_node, "/dev/debug");
   CHECK(err, "debug_node");
 
+  static fs_node_t kheap_node;
+  u_memset(&kheap_node, 0, sizeof(fs_node_t));
+  kheap_node.read = kheap_node_read;
+  kheap_node.write = kheap_node_write;
+  err = fs_mount(&kheap_node, "/dev/kheap");
+  CHECK(err, "kheap_node");
+
+  static fs_node_t swap_node;
+  u_memset(&swap_node, 0, sizeof(fs_node_t));
+  swap_node.read = swap_node_read;
+  err = fs_mount(&swap_node, "/dev/swap");
+  CHECK(err, "swap_node");
+
+  static fs_node_t locks_node;
+  u_memset(&locks_node, 0, sizeof(fs_node_t));
+  locks_node.read = locks_node_read;
+  err = fs_mount(&locks_node, "/dev/locks");
+  CHECK(err, "locks_node");
+
   static fs_node_t null_node;
   u_memset(&null_node, 0, sizeof(fs_node_t));
   err = fs_mount(&null_node, "/dev/null");
@@ -145,22 +193,19 @@ void kmain(uint32_t mb_info_addr,
   fs_node_t init_node;
   err = fs_open_node(&init_node, "/bin/init", 0);
   CHECK(err, "init");
-  uint8_t *init_text = kmalloc(init_node.size);
-  fs_read(&init_node, 0, init_node.size, init_text);
+
+  // Low memory is no longer needed, so the trampoline can use it.
+  smp_init();
 
   unregister_interrupt_handler(14);
   err = process_init();
   CHECK(err, "process");
 
-  process_image_t p;
-  err = elf_load(&p, init_text);
+  static process_image_t p;
+  err = elf_load(&p, &init_node);
   CHECK(err, "init ELF");
 
-  process_create_schedule_init(p);
-
-  kfree(init_text);
-  kfree(p.text);
-  kfree(p.data);
+  process_create_schedule_init(&p);
 
   log_info("kmain", "kernel init complete\n");
 
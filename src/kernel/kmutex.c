@@ -0,0 +1,156 @@
+// kmutex.c
+//
+// Sleeping kernel mutexes.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "kmutex.h"
+#include "../common/stdint.h"
+#include "clock.h"
+#include "ds.h"
+#include "interrupt.h"
+#include "log.h"
+#include "process.h"
+#include "util.h"
+#include "wait.h"
+#include <stddef.h>
+
+// An unlocked mutex is handed directly to the process that has waited
+// longest, which keeps waiters in FIFO order and prevents processes
+// that have not waited from taking it first.
+//
+// Priority inheritance does not nest: when a process holds several
+// mutexes that boost it, it returns to its own priority as soon as it
+// releases one of them.
+
+static kmutex_t *mutexes = NULL;
+
+#define STATS_BUFFER_SIZE 2048
+static char stats_buffer[STATS_BUFFER_SIZE];
+
+void kmutex_init(kmutex_t *mutex, const char *name, uint8_t inherit)
+{
+  uint32_t eflags = interrupt_save_disable();
+  u_memset(mutex, 0, sizeof(kmutex_t));
+  mutex->name = name;
+  mutex->inherit = inherit;
+  mutex->next = mutexes;
+  mutexes = mutex;
+  interrupt_restore(eflags);
+}
+
+// Raise the priority of the owner of a mutex to that of its highest
+// priority waiter.
+static void inherit(kmutex_t *mutex)
+{
+  process_t *owner = mutex->owner;
+  if (mutex->inherit == 0 || owner == NULL)
+    return;
+
+  uint8_t priority = mutex->boosted ? mutex->owner_priority : owner->priority;
+  list_foreach(node, &mutex->waiters.processes)
+  {
+    process_t *waiter = node->value;
+    if (waiter->priority > priority)
+      priority = waiter->priority;
+  }
+  if (priority == owner->priority)
+    return;
+
+  if (!mutex->boosted) {
+    mutex->owner_priority = owner->priority;
+    mutex->boosted = 1;
+  }
+  process_set_priority(owner, priority);
+}
+
+void kmutex_lock(kmutex_t *mutex)
+{
+  uint32_t eflags = interrupt_save_disable();
+  process_t *current = process_current();
+  ++mutex->acquisitions;
+
+  // There is nothing to suspend before the first process runs, when
+  // mutexes are not contended.
+  if (!mutex->locked || current == NULL) {
+    mutex->locked = 1;
+    mutex->owner = current;
+    interrupt_restore(eflags);
+    return;
+  }
+  if (mutex->owner == current)
+    log_error("kmutex", "%s: locked twice by %u\n", mutex->name, current->pid);
+
+  ++mutex->contended;
+  uint64_t start = clock_get_time_ns();
+  while (mutex->owner != current) {
+    wait_prepare(&mutex->waiters, current);
+    inherit(mutex);
+    wait_sleep(current);
+  }
+  mutex->wait_time += clock_get_time_ns() - start;
+  interrupt_restore(eflags);
+}
+
+void kmutex_unlock(kmutex_t *mutex)
+{
+  uint32_t eflags = interrupt_save_disable();
+  if (mutex->boosted) {
+    process_set_priority(mutex->owner, mutex->owner_priority);
+    mutex->boosted = 0;
+  }
+
+  if (mutex->waiters.processes.head) {
+    mutex->owner = mutex->waiters.processes.head->value;
+    wait_wake_one(&mutex->waiters);
+    inherit(mutex);
+  } else {
+    mutex->locked = 0;
+    mutex->owner = NULL;
+  }
+  interrupt_restore(eflags);
+}
+
+void kmutex_release_all(process_t *process)
+{
+  uint32_t eflags = interrupt_save_disable();
+  for (kmutex_t *mutex = mutexes; mutex; mutex = mutex->next)
+    if (mutex->locked && mutex->owner == process)
+      kmutex_unlock(mutex);
+  interrupt_restore(eflags);
+}
+
+// Append formatted text to the stats buffer.
+#define STATS_PRINTF(len, ...)                                                                     \
+  (len) += log_sprintf(                                                                            \
+    stats_buffer + (len), (len) < STATS_BUFFER_SIZE ? STATS_BUFFER_SIZE - (len) : 0, __VA_ARGS__)
+
+uint32_t kmutex_read_stats(uint32_t offset, uint32_t size, uint8_t *buf)
+{
+  uint32_t eflags = interrupt_save_disable();
+
+  uint32_t len = 0;
+  for (kmutex_t *mutex = mutexes; mutex; mutex = mutex->next) {
+    uint32_t wait_us = u_div64(mutex->wait_time, 1000, NULL);
+    STATS_PRINTF(len,
+                 "%s: %u acquisitions, %u contended, %u us waited",
+                 mutex->name,
+                 mutex->acquisitions,
+                 mutex->contended,
+                 wait_us);
+    if (mutex->owner)
+      STATS_PRINTF(len, ", held by %u", mutex->owner->pid);
+    STATS_PRINTF(len, "\n");
+  }
+  if (len >= STATS_BUFFER_SIZE)
+    len = STATS_BUFFER_SIZE - 1;
+
+  if (offset >= len)
+    size = 0;
+  else if (size > len - offset)
+    size = len - offset;
+  u_memcpy(buf, stats_buffer + offset, size);
+
+  interrupt_restore(eflags);
+  return size;
+}
@@ -0,0 +1,53 @@
+// kmutex.h
+//
+// Sleeping kernel mutexes.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _KMUTEX_H_
+#define _KMUTEX_H_
+
+#include "../common/stdint.h"
+#include "wait.h"
+
+struct process_s;
+
+// A mutex that records the process that holds it. Processes that wait
+// for it sleep and get it in the order in which they asked for it. With
+// priority inheritance, the owner runs at the priority of its highest
+// priority waiter until it releases the mutex.
+typedef struct kmutex_s
+{
+  const char *name;
+  uint8_t inherit; // Use priority inheritance?
+
+  uint8_t locked;
+  struct process_s *owner; // NULL if locked before the first process ran.
+  wait_queue_t waiters;
+  uint8_t boosted;        // Has the owner inherited a priority?
+  uint8_t owner_priority; // Priority of the owner before it inherited one.
+
+  // Contention counters.
+  uint32_t acquisitions;
+  uint32_t contended; // Acquisitions that had to wait.
+  uint64_t wait_time; // Nanoseconds spent waiting.
+
+  struct kmutex_s *next; // Next mutex in the list of all mutexes.
+} kmutex_t;
+
+// Initialize a mutex and add it to the list of all mutexes. `name` must
+// outlive the mutex.
+void kmutex_init(kmutex_t *, const char *name, uint8_t inherit);
+
+void kmutex_lock(kmutex_t *);
+void kmutex_unlock(kmutex_t *);
+
+// Release the mutexes that a process holds, including those handed to
+// it that it has not run since. Called when the process is killed.
+void kmutex_release_all(struct process_s *);
+
+// Read part of a text report of the contention counters of every
+// mutex. Returns the number of bytes read.
+uint32_t kmutex_read_stats(uint32_t offset, uint32_t size, uint8_t *buf);
+
+#endif /* _KMUTEX_H_ */
@@ -0,0 +1,153 @@
+// lapic.c
+//
+// Local APIC interface for Mako.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "lapic.h"
+#include "../common/errno.h"
+#include "../common/stdint.h"
+#include "clock.h"
+#include "log.h"
+#include "paging.h"
+#include "util.h"
+#include <stddef.h>
+
+#define CHECK(err, msg, code)                                                                      \
+  if ((err)) {                                                                                     \
+    log_error("lapic", msg "\n");                                                                  \
+    return (code);                                                                                 \
+  }
+
+// Register offsets.
+static const uint32_t LAPIC_ID = 0x20;
+static const uint32_t LAPIC_TPR = 0x80;
+static const uint32_t LAPIC_EOI = 0xB0;
+static const uint32_t LAPIC_SVR = 0xF0;
+static const uint32_t LAPIC_ESR = 0x280;
+static const uint32_t LAPIC_ICR_LOW = 0x300;
+static const uint32_t LAPIC_ICR_HIGH = 0x310;
+static const uint32_t LAPIC_LVT_TIMER = 0x320;
+static const uint32_t LAPIC_LVT_LINT0 = 0x350;
+static const uint32_t LAPIC_LVT_LINT1 = 0x360;
+static const uint32_t LAPIC_TIMER_INITIAL = 0x380;
+static const uint32_t LAPIC_TIMER_CURRENT = 0x390;
+static const uint32_t LAPIC_TIMER_DIVIDE = 0x3E0;
+
+static const uint32_t LAPIC_SVR_ENABLE = 1 << 8;
+static const uint32_t LAPIC_ICR_PENDING = 1 << 12;
+static const uint32_t LAPIC_LVT_MASKED = 1 << 16;
+static const uint32_t LAPIC_LVT_EXTINT = 7 << 8;
+static const uint32_t LAPIC_LVT_NMI = 4 << 8;
+static const uint32_t LAPIC_DIVIDE_16 = 3;
+
+static const uint32_t NS_PER_MS = 1000000;
+static const uint64_t LAPIC_MAX_DELAY = 1000000000;
+
+// The timer counts down for this long while it is calibrated.
+static const uint32_t CALIBRATION_NS = 10000000;
+
+static volatile uint32_t *lapic = NULL;
+static uint32_t ticks_per_ms = 0;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+  return lapic[reg >> 2];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+  lapic[reg >> 2] = value;
+  // Wait for the write to finish.
+  lapic_read(LAPIC_ID);
+}
+
+// Count timer ticks against the clock.
+static void calibrate()
+{
+  lapic_write(LAPIC_TIMER_INITIAL, 0xffffffff);
+  uint64_t start = clock_get_time_ns();
+  while (clock_get_time_ns() - start < CALIBRATION_NS)
+    ;
+  uint32_t ticks = 0xffffffff - lapic_read(LAPIC_TIMER_CURRENT);
+  lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+  ticks_per_ms = ticks / (CALIBRATION_NS / NS_PER_MS);
+  if (ticks_per_ms == 0)
+    ticks_per_ms = 1;
+  log_info("lapic", "Timer runs at %u kHz.\n", ticks_per_ms);
+}
+
+uint32_t lapic_init(uint32_t paddr)
+{
+  page_table_entry_t flags;
+  u_memset(&flags, 0, sizeof(flags));
+  flags.rw = 1;
+  flags.pwt = 1;
+  flags.pcd = 1;
+  uint32_t vaddr = paging_map_kernel_region(paddr, 1, flags);
+  CHECK(vaddr == 0, "Failed to map local APIC.", ENOMEM);
+  lapic = (volatile uint32_t *)vaddr;
+  return 0;
+}
+
+void lapic_init_cpu(uint8_t boot)
+{
+  lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+
+  // PIC interrupts arrive through LINT0 of the boot CPU (the "virtual
+  // wire" mode set up by the BIOS), so other CPUs mask it.
+  if (boot) {
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_EXTINT);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+  } else {
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+  }
+
+  // The error status register is cleared by two writes.
+  lapic_write(LAPIC_ESR, 0);
+  lapic_write(LAPIC_ESR, 0);
+  lapic_write(LAPIC_EOI, 0);
+
+  if (boot)
+    calibrate();
+}
+
+uint8_t lapic_id()
+{
+  return lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi()
+{
+  if (lapic)
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr)
+{
+  lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, icr);
+  while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+    asm volatile("pause");
+}
+
+void lapic_set_timer(uint64_t delay)
+{
+  if (delay > LAPIC_MAX_DELAY)
+    delay = LAPIC_MAX_DELAY;
+  // Round up so that the interrupt never comes early.
+  uint64_t ticks = u_div64(delay * ticks_per_ms + NS_PER_MS - 1, NS_PER_MS, NULL);
+  if (ticks == 0)
+    ticks = 1;
+  if (ticks > 0xffffffff)
+    ticks = 0xffffffff;
+
+  // One-shot mode, which is the default.
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INITIAL, ticks);
+}
@@ -0,0 +1,45 @@
+// lapic.h
+//
+// Local APIC interface for Mako.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _LAPIC_H_
+#define _LAPIC_H_
+
+#include "../common/stdint.h"
+
+// Interrupt vectors of the local APIC. Vectors from LAPIC_TIMER_VECTOR
+// up are sent by local APICs and are acknowledged with lapic_eoi.
+#define LAPIC_TIMER_VECTOR 48
+#define LAPIC_SPURIOUS_VECTOR 255
+
+// Low words of the interrupt command register for lapic_send_ipi.
+#define LAPIC_ICR_INIT 0x4500
+#define LAPIC_ICR_STARTUP 0x4600
+
+// Map the registers of the local APICs, which are at the same physical
+// address on every CPU.
+uint32_t lapic_init(uint32_t paddr);
+
+// Enable the local APIC of this CPU. The boot CPU keeps receiving PIC
+// interrupts through its APIC and calibrates the APIC timer, which runs
+// at the same rate on every CPU.
+void lapic_init_cpu(uint8_t boot);
+
+// Get the ID of the local APIC of this CPU.
+uint8_t lapic_id();
+
+// Acknowledge an interrupt from the local APIC.
+void lapic_eoi();
+
+// Send an interprocessor interrupt. `icr` is the low word of the
+// interrupt command register, which is a vector for a fixed interrupt.
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr);
+
+// Interrupt this CPU with LAPIC_TIMER_VECTOR after a number of
+// nanoseconds. Delays longer than a second interrupt early and the
+// handler sets the timer again.
+void lapic_set_timer(uint64_t);
+
+#endif /* _LAPIC_H_ */
@@ -9,10 +9,33 @@
 #include "../common/stdint.h"
 #include "serial.h"
 #include <stdarg.h>
+#include <stddef.h>
 
 #define LOG_COM SERIAL_COM1_BASE
 
-static void log_ui(uint32_t i)
+// Destination of formatted output: the serial port if `buf` is NULL,
+// otherwise a buffer of `size` bytes.
+typedef struct log_sink_s
+{
+  char *buf;
+  uint32_t size;
+  uint32_t len;
+} log_sink_t;
+
+static log_sink_t serial_sink = { .buf = NULL };
+
+static void log_putc(log_sink_t *sink, char c)
+{
+  if (sink->buf == NULL) {
+    serial_write(LOG_COM, c);
+    return;
+  }
+  if (sink->len + 1 < sink->size)
+    sink->buf[sink->len] = c;
+  ++sink->len;
+}
+
+static void log_ui(log_sink_t *sink, uint32_t i)
 {
   uint32_t n = 1;
   if (i >= 1000000000)
@@ -22,16 +45,16 @@ static void log_ui(uint32_t i)
       n *= 10;
 
   while (n > 0) {
-    serial_write(LOG_COM, '0' + (i / n));
+    log_putc(sink, '0' + (i / n));
     i %= n;
     n /= 10;
   }
 }
 
-static void log_i(int32_t i)
+static void log_i(log_sink_t *sink, int32_t i)
 {
   if (i < 0) {
-    serial_write(LOG_COM, '-');
+    log_putc(sink, '-');
     i = -i;
   }
 
@@ -43,13 +66,13 @@ static void log_i(int32_t i)
       n *= 10;
 
   while (n > 0) {
-    serial_write(LOG_COM, '0' + (i / n));
+    log_putc(sink, '0' + (i / n));
     i %= n;
     n /= 10;
   }
 }
 
-static void log_hex(uint32_t i)
+static void log_hex(log_sink_t *sink, uint32_t i)
 {
   char *digits = "0123456789ABCDEF";
   uint32_t n = 0, min_digits = 8;
@@ -60,21 +83,21 @@ static void log_hex(uint32_t i)
     while ((uint32_t)(1 << (n + 4)) <= i)
       n += 4;
 
-  serial_write(LOG_COM, '0');
-  serial_write(LOG_COM, 'x');
+  log_putc(sink, '0');
+  log_putc(sink, 'x');
 
   if (min_digits > 0)
     min_digits -= 1;
   min_digits <<= 2;
 
   while (min_digits > n) {
-    serial_write(LOG_COM, '0');
+    log_putc(sink, '0');
     min_digits -= 4;
   }
 
   while (1) {
     uint32_t digit = (i >> n) & 0x0000000F;
-    serial_write(LOG_COM, digits[digit]);
+    log_putc(sink, digits[digit]);
 
     if (n == 0)
       break;
@@ -82,7 +105,7 @@ static void log_hex(uint32_t i)
   }
 }
 
-static void log_vprintf(char *fmt, va_list ap)
+static void log_vprintf(log_sink_t *sink, char *fmt, va_list ap)
 {
   char *p;
   uint32_t uival;
@@ -91,7 +114,7 @@ static void log_vprintf(char *fmt, va_list ap)
 
   for (p = fmt; *p != '\0'; ++p) {
     if (*p != '%') {
-      serial_write(LOG_COM, *p);
+      log_putc(sink, *p);
       continue;
     }
 
@@ -99,28 +122,28 @@ static void log_vprintf(char *fmt, va_list ap)
     switch (*p) {
       case 'c':
         uival = va_arg(ap, uint32_t);
-        serial_write(LOG_COM, (uint8_t)uival);
+        log_putc(sink, (uint8_t)uival);
         break;
       case 'u':
         uival = va_arg(ap, uint32_t);
-        log_ui(uival);
+        log_ui(sink, uival);
         break;
       case 'd':
         ival = va_arg(ap, int32_t);
-        log_i(ival);
+        log_i(sink, ival);
         break;
       case 'x':
         uival = va_arg(ap, uint32_t);
-        log_hex(uival);
+        log_hex(sink, uival);
         break;
       case 's':
         sval = va_arg(ap, char *);
         for (; *sval; ++sval) {
-          serial_write(LOG_COM, *sval);
+          log_putc(sink, *sval);
         }
         break;
       case '%':
-        serial_write(LOG_COM, '%');
+        log_putc(sink, '%');
         break;
     }
   }
@@ -130,8 +153,20 @@ static void log_printf(char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
-  log_vprintf(fmt, ap);
+  log_vprintf(&serial_sink, fmt, ap);
+  va_end(ap);
+}
+
+uint32_t log_sprintf(char *buf, uint32_t size, char *fmt, ...)
+{
+  log_sink_t sink = { .buf = buf, .size = size, .len = 0 };
+  va_list ap;
+  va_start(ap, fmt);
+  log_vprintf(&sink, fmt, ap);
   va_end(ap);
+  if (size)
+    buf[sink.len < size ? sink.len : size - 1] = '\0';
+  return sink.len;
 }
 
 void log_debug(char *fname, char *fmt, ...)
@@ -139,7 +174,7 @@ void log_debug(char *fname, char *fmt, ...)
   va_list ap;
   log_printf("DEBUG: %s: ", fname);
   va_start(ap, fmt);
-  log_vprintf(fmt, ap);
+  log_vprintf(&serial_sink, fmt, ap);
   va_end(ap);
 }
 
@@ -148,7 +183,7 @@ void log_info(char *fname, char *fmt, ...)
   va_list ap;
   log_printf("INFO: %s: ", fname);
   va_start(ap, fmt);
-  log_vprintf(fmt, ap);
+  log_vprintf(&serial_sink, fmt, ap);
   va_end(ap);
 }
 
@@ -157,6 +192,6 @@ void log_error(char *fname, char *fmt, ...)
   va_list ap;
   log_printf("ERROR: %s: ", fname);
   va_start(ap, fmt);
-  log_vprintf(fmt, ap);
+  log_vprintf(&serial_sink, fmt, ap);
   va_end(ap);
 }
@@ -8,8 +8,14 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include "../common/stdint.h"
+
 void log_debug(char *fname, char *fmt, ...);
 void log_info(char *fname, char *fmt, ...);
 void log_error(char *fname, char *fmt, ...);
 
+// Format into a buffer of `size` bytes. The output is always
+// null-terminated; returns the length of the untruncated output.
+uint32_t log_sprintf(char *buf, uint32_t size, char *fmt, ...);
+
 #endif /* LOG_H */
@@ -12,7 +12,11 @@
 #include "interrupt.h"
 #include "log.h"
 #include "pmm.h"
+#include "smp.h"
+#include "swap.h"
+#include "text.h"
 #include "util.h"
+#include "vrange.h"
 
 #define CHECK(err, msg, code)                                                                      \
   if ((err)) {                                                                                     \
@@ -23,6 +27,58 @@
 static page_directory_t kernel_pd_vaddr = 0;
 static uint32_t kernel_pd_paddr = 0;
 
+// Free virtual address ranges. Kernel addresses are shared by every
+// address space and have a single set. User addresses have one set per
+// page directory, in a hash table keyed by the page directory's
+// physical address, along with counts of the pages that the user part
+// of the address space uses.
+#define MAX_ADDRESS_SPACES 128
+#define ADDRESS_SPACE_DELETED 1
+typedef struct address_space_s
+{
+  uint32_t cr3;
+  vrange_t user_vrange;
+  uint32_t resident_pages; // Present user pages.
+  uint32_t table_pages;    // User page tables.
+} address_space_t;
+static vrange_t kernel_vrange;
+static address_space_t address_spaces[MAX_ADDRESS_SPACES];
+
+// Temporary mapping slots: fixed pages just below the page tables,
+// whose entries in the kernel's page table are written directly. Each
+// CPU has its own slots, and interrupts stay disabled on a CPU while it
+// has any of them mapped, so no other CPU ever uses them and they are
+// only invalidated in the local TLB.
+#define KMAP_SLOTS_PER_CPU 8
+#define KMAP_SLOTS (KMAP_SLOTS_PER_CPU * MAX_CPU_COUNT)
+#define KMAP_VADDR (FIRST_PT_VADDR - (KMAP_SLOTS * PAGE_SIZE))
+static uint8_t kmap_used_slots[MAX_CPU_COUNT];
+static uint32_t kmap_depth[MAX_CPU_COUNT];
+static uint32_t kmap_eflags[MAX_CPU_COUNT];
+
+// CPU features, detected in paging_init. 4MB pages are needed to map
+// the kernel in boot.s, but are only used for other memory if CPUID
+// reports them.
+#define CPUID_PSE (1 << 3)
+#define CPUID_PGE (1 << 13)
+#define CR4_PGE (1 << 7)
+static uint8_t large_pages_enabled = 0;
+static uint8_t global_pages_enabled = 0;
+
+// Page directory loaded on each CPU, which tells the CPUs that may
+// have TLB entries for a user address.
+static uint32_t loaded_cr3[MAX_CPU_COUNT];
+
+// Implemented in paging.s.
+void paging_load_cr3(uint32_t);
+
+static inline uint32_t cpuid_features()
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  return edx;
+}
+
 static inline uint32_t vaddr_to_pd_idx(uint32_t vaddr)
 {
   return vaddr >> 22;
@@ -44,6 +100,46 @@ static inline uint32_t pd_idx_to_pt_vaddr(uint32_t pd_idx)
   return FIRST_PT_VADDR + (PAGE_SIZE * pd_idx);
 }
 
+// Find the address space of a page directory. Returns a free slot
+// if `create` is set and there is no such address space.
+static address_space_t *address_space_find(uint32_t cr3, uint8_t create)
+{
+  uint32_t start = (cr3 >> PAGE_SIZE_SHIFT) % MAX_ADDRESS_SPACES;
+  address_space_t *free_slot = NULL;
+  for (uint32_t i = 0; i < MAX_ADDRESS_SPACES; ++i) {
+    address_space_t *as = address_spaces + ((start + i) % MAX_ADDRESS_SPACES);
+    if (as->cr3 == cr3)
+      return as;
+    if (as->cr3 == ADDRESS_SPACE_DELETED && free_slot == NULL)
+      free_slot = as;
+    if (as->cr3 == 0) {
+      if (free_slot == NULL)
+        free_slot = as;
+      break;
+    }
+  }
+  if (create && free_slot)
+    free_slot->cr3 = cr3;
+  return create ? free_slot : NULL;
+}
+
+// Get the address space that a user address belongs to, or NULL for
+// kernel addresses.
+static address_space_t *user_address_space_of(uint32_t vaddr)
+{
+  return vaddr < KERNEL_START_VADDR ? address_space_find(paging_get_cr3(), 0) : NULL;
+}
+
+// Get the set of free ranges that contains a virtual address in the
+// current address space.
+static vrange_t *vrange_of(uint32_t vaddr)
+{
+  if (vaddr >= KERNEL_START_VADDR)
+    return &kernel_vrange;
+  address_space_t *as = address_space_find(paging_get_cr3(), 0);
+  return as ? &as->user_vrange : NULL;
+}
+
 // Initialize paging.
 uint32_t paging_init(page_directory_t pd, uint32_t phys_addr)
 {
@@ -67,19 +163,148 @@ uint32_t paging_init(page_directory_t pd, uint32_t phys_addr)
   // Map the kernel (i.e first 4MB of the physical address space)
   // to a 4MB page. The kernel is mapped in every process's address space
   // so the page directory doesn't have to be switched when making a syscall.
+  // Kernel mappings are the same in every address space, so they are
+  // marked global if the CPU supports it and survive changes to cr3.
+  uint32_t features = cpuid_features();
+  large_pages_enabled = (features & CPUID_PSE) != 0;
+  global_pages_enabled = (features & CPUID_PGE) != 0;
+
   page_directory_entry_t kern_pde;
   u_memset(&kern_pde, 0, sizeof(kern_pde));
   kern_pde.present = 1;
   kern_pde.rw = 1;
   kern_pde.page_size = 1;
+  kern_pde.global = global_pages_enabled;
   pd[vaddr_to_pd_idx(KERNEL_START_VADDR)] = kern_pde;
 
   paging_set_cr3(phys_addr);
+  if (global_pages_enabled)
+    paging_set_cr4(paging_get_cr4() | CR4_PGE);
+  log_info("paging",
+           "large pages %s, global pages %s\n",
+           large_pages_enabled ? "on" : "off",
+           global_pages_enabled ? "on" : "off");
+
+  // Allocate every kernel page table up front. Kernel page directory
+  // entries then never change after boot, so every address space can
+  // share them without being updated on each context switch.
+  for (uint32_t pd_idx = vaddr_to_pd_idx(KERNEL_START_VADDR) + 1;
+       pd_idx < vaddr_to_pd_idx(FIRST_PT_VADDR);
+       ++pd_idx) {
+    if (pd[pd_idx].present)
+      continue;
+    uint32_t pt_paddr = pmm_alloc(1);
+    if (pt_paddr == 0) {
+      interrupt_restore(eflags);
+      log_error("paging", "No memory for kernel page tables.\n");
+      return ENOMEM;
+    }
+
+    page_directory_entry_t pde;
+    u_memset(&pde, 0, sizeof(pde));
+    pde.present = 1;
+    pde.rw = 1;
+    pde.table_addr = pt_paddr >> PAGE_SIZE_SHIFT;
+    pd[pd_idx] = pde;
+    paging_invalidate_pte(pd_idx_to_pt_vaddr(pd_idx));
+    u_memset((void *)pd_idx_to_pt_vaddr(pd_idx), 0, PAGE_SIZE);
+  }
+
+  // Everything except the first 4MB of kernel memory, the kmap slots
+  // and the page tables is available. Address 0 is never allocated so
+  // NULL is invalid.
+  uint32_t err =
+    vrange_init(&kernel_vrange, KERNEL_START_VADDR + KERNEL_DIRECT_MAP_SIZE, KMAP_VADDR);
+  address_space_t *as = address_space_find(phys_addr, 1);
+  err = err || vrange_init(&as->user_vrange, PAGE_SIZE, KERNEL_START_VADDR);
+  if (err) {
+    interrupt_restore(eflags);
+    log_error("paging", "Failed to initialize virtual address ranges.\n");
+    return ENOMEM;
+  }
 
   interrupt_restore(eflags);
   return 0;
 }
 
+#define CHECK_UNLOCK(err, msg, code)                                                               \
+  if ((err)) {                                                                                     \
+    log_error("paging", msg "\n");                                                                 \
+    interrupt_restore(eflags);                                                                     \
+    return (code);                                                                                 \
+  }
+
+// Map physically contiguous memory into kernel space.
+uint32_t paging_map_kernel_region(uint32_t paddr, uint32_t npages, page_table_entry_t flags)
+{
+  if (large_pages_enabled == 0 || (paddr & (LARGE_PAGE_SIZE - 1))) {
+    uint32_t vaddr = paging_next_vaddr(npages, KERNEL_START_VADDR);
+    CHECK(vaddr == 0, "No memory.", 0);
+    for (uint32_t i = 0; i < npages; ++i) {
+      paging_result_t res =
+        paging_map(vaddr + (i << PAGE_SIZE_SHIFT), paddr + (i << PAGE_SIZE_SHIFT), flags);
+      CHECK(res != PAGING_OK, "paging_map failed.", 0);
+    }
+    return vaddr;
+  }
+
+  // Find a range that is aligned to 4MB by reserving enough extra
+  // space to align it and releasing the rest.
+  uint32_t size = ((npages << PAGE_SIZE_SHIFT) + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+  uint32_t padded_size = size + LARGE_PAGE_SIZE - PAGE_SIZE;
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t start = vrange_alloc(&kernel_vrange, padded_size, KERNEL_START_VADDR);
+  CHECK_UNLOCK(start == 0, "No memory.", 0);
+  uint32_t vaddr = (start + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+  vrange_release(&kernel_vrange, start, vaddr - start);
+  vrange_release(&kernel_vrange, vaddr + size, (start + padded_size) - (vaddr + size));
+
+  // Replace the preallocated page tables, which are empty since the
+  // range was free, with 4MB pages.
+  page_directory_t pd = (page_directory_t)PD_VADDR;
+  for (uint32_t offset = 0; offset < size; offset += LARGE_PAGE_SIZE) {
+    uint32_t pd_idx = vaddr_to_pd_idx(vaddr + offset);
+    uint32_t pt_paddr = pd[pd_idx].table_addr << PAGE_SIZE_SHIFT;
+
+    page_directory_entry_t pde;
+    u_memset(&pde, 0, sizeof(pde));
+    pde.present = 1;
+    pde.rw = flags.rw;
+    pde.pwt = flags.pwt;
+    pde.pcd = flags.pcd;
+    pde.page_size = 1;
+    pde.global = global_pages_enabled;
+    pde.table_addr = (paddr + offset) >> PAGE_SIZE_SHIFT;
+    pd[pd_idx] = pde;
+    paging_invalidate_pte(pd_idx_to_pt_vaddr(pd_idx));
+    pmm_free(pt_paddr, 1);
+  }
+
+  interrupt_restore(eflags);
+  return vaddr;
+}
+
+// Allocate and map physically contiguous kernel memory.
+void *paging_alloc_kernel_region(uint32_t npages)
+{
+  if (large_pages_enabled) {
+    uint32_t large_page_pages = LARGE_PAGE_SIZE >> PAGE_SIZE_SHIFT;
+    npages = ((npages + large_page_pages - 1) / large_page_pages) * large_page_pages;
+  }
+
+  // Blocks from the physical memory manager are aligned to their size,
+  // so a block of 4MB or more is aligned to 4MB.
+  uint32_t paddr = pmm_alloc(npages);
+  CHECK(paddr == 0, "No memory.", NULL);
+  page_table_entry_t flags;
+  u_memset(&flags, 0, sizeof(flags));
+  flags.rw = 1;
+  uint32_t vaddr = paging_map_kernel_region(paddr, npages, flags);
+  if (vaddr == 0)
+    pmm_free(paddr, npages);
+  return (void *)vaddr;
+}
+
 // Set/get kernel page directory address.
 void paging_set_kernel_pd(page_directory_t vaddr, uint32_t paddr)
 {
@@ -92,28 +317,52 @@ void paging_get_kernel_pd(page_directory_t *vaddr, uint32_t *paddr)
   *paddr = kernel_pd_paddr;
 }
 
-#define CHECK_UNLOCK(err, msg, code)                                                               \
-  if ((err)) {                                                                                     \
-    log_error("paging", msg "\n");                                                                 \
-    interrupt_restore(eflags);                                                                     \
-    return (code);                                                                                 \
-  }
+void paging_set_cr3(uint32_t cr3)
+{
+  loaded_cr3[smp_cpu_id()] = cr3;
+  paging_load_cr3(cr3);
+}
+
+// Other CPUs only use kernel pages while they hold the kernel lock,
+// which this CPU holds, so they invalidate them when they next take it.
+// User pages may be in use by other threads of the process, so CPUs
+// that have the same page directory loaded are waited for.
+void paging_invalidate_pte(uint32_t vaddr)
+{
+  paging_invlpg(vaddr);
+  if (smp_cpu_count() == 1 || (vaddr >= KMAP_VADDR && vaddr < FIRST_PT_VADDR))
+    return;
+
+  uint32_t self = smp_cpu_id();
+  uint32_t cr3 = paging_get_cr3();
+  uint32_t cpus = 0;
+  for (uint32_t i = 0; i < smp_cpu_count(); ++i)
+    if (i != self && (vaddr >= KERNEL_START_VADDR || loaded_cr3[i] == cr3))
+      cpus |= 1 << i;
+  if (cpus)
+    smp_tlb_shootdown(vaddr, cpus, vaddr < KERNEL_START_VADDR);
+}
+
+void paging_flush_tlb()
+{
+  // Toggling PGE flushes global pages too.
+  if (global_pages_enabled) {
+    uint32_t cr4 = paging_get_cr4();
+    paging_set_cr4(cr4 & ~CR4_PGE);
+    paging_set_cr4(cr4);
+  } else
+    paging_load_cr3(paging_get_cr3());
+}
 
-// Shallow copy the kernel's address space.
+// Shallow copy the kernel's address space. This only needs to be done
+// once for each new page directory since kernel page tables are
+// allocated in paging_init and shared by all address spaces.
 uint32_t paging_copy_kernel_space(uint32_t cr3)
 {
   uint32_t eflags = interrupt_save_disable();
 
-  // Map the page directory to an address in user space so it
-  // doesn't get copied.
-  uint32_t pd_vaddr = paging_next_vaddr(1, 0);
-  CHECK_UNLOCK(pd_vaddr == 0, "No memory.", ENOMEM);
-  page_directory_t pd = (page_directory_t)pd_vaddr;
-  page_table_entry_t flags;
-  u_memset(&flags, 0, sizeof(flags));
-  flags.rw = 1;
-  paging_result_t res = paging_map(pd_vaddr, cr3, flags);
-  CHECK_UNLOCK(res != PAGING_OK, "paging_map failed.", res);
+  page_directory_t pd = paging_kmap(cr3);
+  CHECK_UNLOCK(pd == NULL, "No kmap slots.", ENOMEM);
 
   uint32_t start_idx = vaddr_to_pd_idx(KERNEL_START_VADDR);
   page_directory_t current_pd = (page_directory_t)PD_VADDR;
@@ -127,8 +376,7 @@ uint32_t paging_copy_kernel_space(uint32_t cr3)
   self_pde.table_addr = cr3 >> PAGE_SIZE_SHIFT;
   pd[vaddr_to_pd_idx(PD_VADDR)] = self_pde;
 
-  res = paging_unmap(pd_vaddr);
-  CHECK_UNLOCK(res != PAGING_OK, "paging_unmap failed.", res);
+  paging_kunmap(pd);
 
   interrupt_restore(eflags);
   return 0;
@@ -155,14 +403,8 @@ uint32_t paging_clone_process_directory(uint32_t *out_cr3, uint32_t process_cr3)
   CHECK_RESTORE(cr3 == 0, "No memory.", ENOMEM);
   CHECK_RESTORE(paging_copy_kernel_space(cr3), "Could not copy kernel address space.", 1);
 
-  uint32_t pd_vaddr = paging_next_vaddr(1, KERNEL_START_VADDR);
-  CHECK_RESTORE(pd_vaddr == 0, "No memory.", ENOMEM);
-  page_directory_t pd = (page_directory_t)pd_vaddr;
-  page_table_entry_t flags;
-  u_memset(&flags, 0, sizeof(flags));
-  flags.rw = 1;
-  paging_result_t res = paging_map(pd_vaddr, cr3, flags);
-  CHECK_RESTORE(res != PAGING_OK, "paging_map failed.", 1);
+  page_directory_t pd = paging_kmap(cr3);
+  CHECK_RESTORE(pd == NULL, "No kmap slots.", ENOMEM);
 
   uint32_t kernel_idx = vaddr_to_pd_idx(KERNEL_START_VADDR);
   for (uint32_t pd_idx = 0; pd_idx < kernel_idx; ++pd_idx) {
@@ -172,39 +414,66 @@ uint32_t paging_clone_process_directory(uint32_t *out_cr3, uint32_t process_cr3)
 
     page_table_t process_pt = (page_table_t)pd_idx_to_pt_vaddr(pd_idx);
     uint32_t pt_paddr = pmm_alloc(1);
+    if (pt_paddr == 0)
+      paging_kunmap(pd);
     CHECK_RESTORE(pt_paddr == 0, "No memory.", ENOMEM);
-    uint32_t pt_vaddr = paging_next_vaddr(1, KERNEL_START_VADDR);
-    CHECK_RESTORE(pt_vaddr == 0, "No memory.", ENOMEM);
-    page_table_t pt = (page_table_t)pt_vaddr;
-    res = paging_map(pt_vaddr, pt_paddr, flags);
-    CHECK_RESTORE(res != PAGING_OK, "paging_map failed.", 1);
+    page_table_t pt = paging_kmap(pt_paddr);
+    if (pt == NULL) {
+      pmm_free(pt_paddr, 1);
+      paging_kunmap(pd);
+    }
+    CHECK_RESTORE(pt == NULL, "No kmap slots.", ENOMEM);
     pd[pd_idx].table_addr = pt_paddr >> PAGE_SIZE_SHIFT;
 
+    // Share every page with the new process. Writable pages that are
+    // not marked shared become read-only copy-on-write pages in both
+    // address spaces, and are copied by paging_copy_on_write when either
+    // process writes to them.
     for (uint32_t pt_idx = 0; pt_idx < PAGE_SIZE_DWORDS; ++pt_idx) {
-      pt[pt_idx] = process_pt[pt_idx];
-      if (pt[pt_idx].present == 0)
+      if (process_pt[pt_idx].present == 0) {
+        // Each address space gets its own copy of a page that is
+        // swapped in, so the page does not have to be copied on write.
+        if (process_pt[pt_idx].swapped)
+          swap_ref(process_pt[pt_idx].frame_addr);
+        pt[pt_idx] = process_pt[pt_idx];
         continue;
+      }
 
-      uint32_t frame_paddr = pmm_alloc(1);
-      CHECK_RESTORE(frame_paddr == 0, "No memory.", ENOMEM);
-      uint32_t frame_vaddr = paging_next_vaddr(1, KERNEL_START_VADDR);
-      CHECK_RESTORE(frame_vaddr == 0, "No memory.", ENOMEM);
-      res = paging_map(frame_vaddr, frame_paddr, flags);
-      CHECK_RESTORE(res != PAGING_OK, "paging_map failed.", 1);
-      pt[pt_idx].frame_addr = frame_paddr >> PAGE_SIZE_SHIFT;
-      u_memcpy((uint8_t *)frame_vaddr,
-               (uint8_t *)(pd_idx_to_vaddr(pd_idx) | pt_idx_to_vaddr(pt_idx)),
-               PAGE_SIZE);
-      res = paging_unmap(frame_vaddr);
-      CHECK_RESTORE(res != PAGING_OK, "paging_unmap failed.", 1);
+      if (process_pt[pt_idx].rw && process_pt[pt_idx].shared == 0) {
+        process_pt[pt_idx].rw = 0;
+        process_pt[pt_idx].cow = 1;
+      }
+      pt[pt_idx] = process_pt[pt_idx];
+      pmm_ref(process_pt[pt_idx].frame_addr << PAGE_SIZE_SHIFT);
     }
 
-    res = paging_unmap(pt_vaddr);
-    CHECK_RESTORE(res != PAGING_OK, "paging_unmap failed.", 1);
+    paging_kunmap(pt);
   }
 
-  res = paging_unmap(pd_vaddr);
-  CHECK_RESTORE(res != PAGING_OK, "paging_unmap failed.", 1);
+  paging_kunmap(pd);
+
+  address_space_t *process_as = address_space_find(process_cr3, 0);
+  CHECK_RESTORE(process_as == NULL, "No address space for page directory.", 1);
+  address_space_t *as = address_space_find(cr3, 1);
+  CHECK_RESTORE(as == NULL, "Too many address spaces.", ENOMEM);
+  if (vrange_clone(&as->user_vrange, &process_as->user_vrange)) {
+    as->cr3 = ADDRESS_SPACE_DELETED;
+    CHECK_RESTORE(1, "No memory.", ENOMEM);
+  }
+  as->resident_pages = process_as->resident_pages;
+  as->table_pages = process_as->table_pages;
+
+  // Reloading cr3 flushes the stale writable TLB entries of the pages
+  // that we just made copy-on-write on this CPU. Other threads of the
+  // process may be writing to them on other CPUs, which have to flush
+  // their TLBs before the child can use the pages.
+  uint32_t self = smp_cpu_id();
+  uint32_t cpus = 0;
+  for (uint32_t i = 0; i < smp_cpu_count(); ++i)
+    if (i != self && loaded_cr3[i] == process_cr3)
+      cpus |= 1 << i;
+  if (cpus)
+    smp_tlb_shootdown(SMP_TLB_FLUSH_ALL, cpus, 1);
   paging_set_cr3(current_cr3);
   *out_cr3 = cr3;
 
@@ -225,47 +494,86 @@ uint8_t paging_clear_user_space()
     for (uint32_t pt_idx = 0; pt_idx < PAGE_SIZE_DWORDS; ++pt_idx) {
       if (pd[pd_idx].present == 0)
         break;
-      if (pt[pt_idx].present == 0)
+      if (pt[pt_idx].present == 0 && pt[pt_idx].swapped == 0)
         continue;
 
       uint32_t vaddr = pd_idx_to_vaddr(pd_idx) | pt_idx_to_vaddr(pt_idx);
-      pmm_free(paging_get_paddr(vaddr), 1);
+      if (pt[pt_idx].present && pt[pt_idx].text)
+        text_release(paging_get_paddr(vaddr));
+      else if (pt[pt_idx].present)
+        pmm_free(paging_get_paddr(vaddr), 1);
       paging_result_t res = paging_unmap(vaddr);
       CHECK(res != PAGING_OK, "paging_unmap failed.", 1);
     }
   }
 
+  // Also release ranges that were reserved but never mapped.
+  vrange_t *vr = vrange_of(0);
+  CHECK(vr == NULL, "No address space for page directory.", 1);
+  vrange_release(vr, vr->start, vr->end - vr->start);
+
   return 0;
 }
 
+// Free a page directory whose user address space has been cleared.
+void paging_free_process_directory(uint32_t cr3)
+{
+  address_space_t *as = address_space_find(cr3, 0);
+  if (as) {
+    vrange_destroy(&as->user_vrange);
+    as->cr3 = ADDRESS_SPACE_DELETED;
+  }
+  pmm_free(cr3, 1);
+}
+
+// Reserve virtual pages in the current address space without mapping them.
+void paging_reserve_vaddr(uint32_t vaddr, uint32_t size)
+{
+  vrange_t *vr = vrange_of(vaddr);
+  if (vr)
+    vrange_reserve(vr, u_page_align_down(vaddr), size << PAGE_SIZE_SHIFT);
+}
+
+// Release virtual pages in the current address space that are not mapped.
+void paging_release_vaddr(uint32_t vaddr, uint32_t size)
+{
+  vrange_t *vr = vrange_of(vaddr);
+  if (vr)
+    vrange_release(vr, u_page_align_down(vaddr), size << PAGE_SIZE_SHIFT);
+}
+
 // Map a page.
 paging_result_t paging_map(uint32_t virt_addr, uint32_t phys_addr, page_table_entry_t flags)
 {
   page_directory_t pd = (page_directory_t)PD_VADDR;
   uint32_t pd_idx = vaddr_to_pd_idx(virt_addr);
   page_directory_entry_t pde = pd[pd_idx];
+  address_space_t *as = user_address_space_of(virt_addr);
 
   if (pde.present == 0) { // We have to make a new page table.
     uint32_t pt_vaddr = pd_idx_to_pt_vaddr(pd_idx);
     uint32_t pt_paddr = pmm_alloc(1);
     CHECK(pt_paddr == 0, "No memory.", PAGING_NO_MEMORY);
+    if (as)
+      ++as->table_pages;
 
     u_memset(&pde, 0, sizeof(pde));
+    // Protection is left to the PTEs, since the table is shared by
+    // every page in the same 4MB region.
     pde.present = 1;
     pde.rw = 1;
-    pde.user = flags.user;
+    pde.user = flags.user || virt_addr < KERNEL_START_VADDR;
     pde.pwt = flags.pwt;
     pde.pcd = flags.pcd;
     pde.table_addr = pt_paddr >> PAGE_SIZE_SHIFT;
     pd[pd_idx] = pde;
     u_memset((void *)pt_vaddr, 0b10, PAGE_SIZE); // Clear the new page table.
-    pd[pd_idx].rw = flags.rw;
   }
 
   page_table_t pt = (page_table_t)pd_idx_to_pt_vaddr(pd_idx);
   uint32_t pt_idx = vaddr_to_pt_idx(virt_addr);
   page_table_entry_t pte = pt[pt_idx];
-  CHECK(pte.present, "Map already exists.", PAGING_MAP_EXISTS);
+  CHECK(pte.present || pte.swapped, "Map already exists.", PAGING_MAP_EXISTS);
 
   u_memset(&pte, 0, sizeof(pte));
   pte.present = 1;
@@ -273,8 +581,18 @@ paging_result_t paging_map(uint32_t virt_addr, uint32_t phys_addr, page_table_en
   pte.user = flags.user;
   pte.pwt = flags.pwt;
   pte.pcd = flags.pcd;
+  pte.cow = flags.cow;
+  pte.shared = flags.shared;
+  pte.text = flags.text;
+  pte.global = global_pages_enabled && virt_addr >= KERNEL_START_VADDR;
   pte.frame_addr = phys_addr >> PAGE_SIZE_SHIFT;
   pt[pt_idx] = pte;
+  if (as)
+    ++as->resident_pages;
+
+  vrange_t *vr = vrange_of(virt_addr);
+  if (vr)
+    vrange_reserve(vr, u_page_align_down(virt_addr), PAGE_SIZE);
 
   return PAGING_OK;
 }
@@ -289,6 +607,10 @@ paging_result_t paging_unmap(uint32_t virt_addr)
         "Attempt to unmap kernel memory or page directory.",
         PAGING_NO_ACCESS);
 
+  vrange_t *vr = vrange_of(virt_addr);
+  if (vr)
+    vrange_release(vr, u_page_align_down(virt_addr), PAGE_SIZE);
+
   page_directory_t pd = (page_directory_t)PD_VADDR;
   page_directory_entry_t pde = pd[pd_idx];
   if (pde.present == 0)
@@ -296,15 +618,28 @@ paging_result_t paging_unmap(uint32_t virt_addr)
 
   page_table_t pt = (page_table_t)pd_idx_to_pt_vaddr(pd_idx);
   uint32_t pt_idx = vaddr_to_pt_idx(virt_addr);
+  address_space_t *as = user_address_space_of(virt_addr);
+  if (pt[pt_idx].present && as)
+    --as->resident_pages;
+  if (pt[pt_idx].present == 0 && pt[pt_idx].swapped)
+    swap_free(pt[pt_idx].frame_addr);
   pt[pt_idx].present = 0;
+  pt[pt_idx].swapped = 0;
   paging_invalidate_pte(virt_addr);
 
-  // Check if there are any present pages in the page table.
-  for (pt_idx = 0; pt_idx < PAGE_SIZE_DWORDS && pt[pt_idx].present == 0; ++pt_idx)
+  // Kernel page tables are shared by every address space, so they are never freed.
+  if (pd_idx >= vaddr_to_pd_idx(KERNEL_START_VADDR))
+    return PAGING_OK;
+
+  // Check if there are any present or swapped out pages in the page table.
+  for (pt_idx = 0; pt_idx < PAGE_SIZE_DWORDS && pt[pt_idx].present == 0 && pt[pt_idx].swapped == 0;
+       ++pt_idx)
     ;
 
   if (pt_idx == PAGE_SIZE_DWORDS) { // There aren't any.
     pmm_free(pde.table_addr << PAGE_SIZE_SHIFT, 1);
+    if (as)
+      --as->table_pages;
     pde.present = 0;
     pd[pd_idx] = pde;
     paging_invalidate_pte((uint32_t)pt);
@@ -313,78 +648,24 @@ paging_result_t paging_unmap(uint32_t virt_addr)
   return PAGING_OK;
 }
 
-// Get the next free virtual address at the start of multiple
-// contiguous unmapped pages.
+// Reserve the lowest free range of pages at or above `base`.
 uint32_t paging_next_vaddr(uint32_t size, uint32_t base)
 {
-  page_directory_t pd = (page_directory_t)PD_VADDR;
-  uint32_t max_page_number = PAGE_SIZE_DWORDS * PAGE_SIZE_DWORDS;
-  uint32_t current = base >> PAGE_SIZE_SHIFT, step = 0;
-  if (current == 0)
-    ++current; // Skip address 0 so NULL is invalid.
-  for (; current < max_page_number; current += step + 1) {
-    uint32_t found = 0;
-    for (step = 0; step < size; ++step) {
-      uint32_t page_number = current + step;
-      uint32_t pd_idx = page_number >> 10;
-      uint32_t pt_idx = page_number & 0x3FF;
-      page_directory_entry_t pde = pd[pd_idx];
-      if (pde.present == 0) {
-        found += PAGE_SIZE_DWORDS - pt_idx;
-        if (found >= size)
-          return current << PAGE_SIZE_SHIFT;
-        continue;
-      } else if (pde.page_size)
-        break;
-
-      page_table_t pt = (page_table_t)pd_idx_to_pt_vaddr(pd_idx);
-      page_table_entry_t pte = pt[pt_idx];
-      if (pte.present == 0)
-        ++found;
-      if (found >= size)
-        return current << PAGE_SIZE_SHIFT;
-      if (pte.present)
-        break;
-    }
-  }
-
-  return 0;
+  if (base == 0)
+    base = PAGE_SIZE; // Skip address 0 so NULL is invalid.
+  vrange_t *vr = vrange_of(base);
+  if (vr == NULL)
+    return 0;
+  return vrange_alloc(vr, size << PAGE_SIZE_SHIFT, u_page_align_down(base));
 }
 
-// Get the last free virtual address at the start of multiple
-// contiguous unmapped pages.
+// Reserve the highest free range of pages below `top`.
 uint32_t paging_prev_vaddr(uint32_t size, uint32_t top)
 {
-  page_directory_t pd = (page_directory_t)PD_VADDR;
-  uint32_t min_page_number = 1;
-  uint32_t current = (top >> PAGE_SIZE_SHIFT) - 1, step = 0;
-  for (; current >= min_page_number; current -= step + 1) {
-    uint32_t found = 0;
-    for (step = 0; step < size; ++step) {
-      uint32_t page_number = current - step;
-      uint32_t pd_idx = page_number >> 10;
-      uint32_t pt_idx = page_number & 0x3FF;
-      page_directory_entry_t pde = pd[pd_idx];
-      if (pde.present == 0) {
-        found += PAGE_SIZE_DWORDS - pt_idx;
-        if (found >= size)
-          return page_number << PAGE_SIZE_SHIFT;
-        continue;
-      } else if (pde.page_size)
-        break;
-
-      page_table_t pt = (page_table_t)pd_idx_to_pt_vaddr(pd_idx);
-      page_table_entry_t pte = pt[pt_idx];
-      if (pte.present == 0)
-        ++found;
-      if (found >= size)
-        return page_number << PAGE_SIZE_SHIFT;
-      if (pte.present)
-        break;
-    }
-  }
-
-  return 0;
+  vrange_t *vr = vrange_of(top - 1);
+  if (vr == NULL)
+    return 0;
+  return vrange_alloc_top(vr, size << PAGE_SIZE_SHIFT, u_page_align_down(top));
 }
 
 // Get the physical address that a virtual address is mapped to.
@@ -405,3 +686,144 @@ uint32_t paging_get_paddr(uint32_t vaddr)
     return 0;
   return (pt[pt_idx].frame_addr << PAGE_SIZE_SHIFT) + (vaddr & (PAGE_SIZE - 1));
 }
+
+// Adjust the resident page count of the current address space.
+void paging_add_resident_pages(int32_t npages)
+{
+  address_space_t *as = user_address_space_of(0);
+  if (as)
+    as->resident_pages += npages;
+}
+
+// Get the pages used by the user part of an address space.
+void paging_get_usage(uint32_t cr3, paging_usage_t *out)
+{
+  u_memset(out, 0, sizeof(paging_usage_t));
+  uint32_t eflags = interrupt_save_disable();
+  address_space_t *as = address_space_find(cr3, 0);
+  if (as) {
+    out->resident_pages = as->resident_pages;
+    out->table_pages = as->table_pages + 1;
+  }
+  interrupt_restore(eflags);
+}
+
+// Get the page table entry of a virtual address.
+page_table_entry_t *paging_get_pte(uint32_t vaddr)
+{
+  uint32_t pd_idx = vaddr_to_pd_idx(vaddr);
+  page_directory_t pd = (page_directory_t)PD_VADDR;
+  if (pd[pd_idx].present == 0 || pd[pd_idx].page_size)
+    return NULL;
+  page_table_t pt = (page_table_t)pd_idx_to_pt_vaddr(pd_idx);
+  return pt + vaddr_to_pt_idx(vaddr);
+}
+
+// Copy a copy-on-write page.
+paging_result_t paging_copy_on_write(uint32_t vaddr)
+{
+  uint32_t pd_idx = vaddr_to_pd_idx(vaddr);
+  uint32_t pt_idx = vaddr_to_pt_idx(vaddr);
+  page_directory_t pd = (page_directory_t)PD_VADDR;
+  if (pd[pd_idx].present == 0 || pd[pd_idx].page_size)
+    return PAGING_NO_ACCESS;
+  page_table_t pt = (page_table_t)pd_idx_to_pt_vaddr(pd_idx);
+  if (pt[pt_idx].present == 0 || pt[pt_idx].cow == 0)
+    return PAGING_NO_ACCESS;
+
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t page_vaddr = u_page_align_down(vaddr);
+  uint32_t paddr = pt[pt_idx].frame_addr << PAGE_SIZE_SHIFT;
+
+  // If no other address space refers to the page, it can simply
+  // be made writable again.
+  if (pmm_refcount(paddr) > 1) {
+    uint32_t copy_paddr = pmm_alloc(1);
+    CHECK_UNLOCK(copy_paddr == 0, "No memory.", PAGING_NO_MEMORY);
+    uint8_t *copy = paging_kmap(copy_paddr);
+    if (copy == NULL)
+      pmm_free(copy_paddr, 1);
+    CHECK_UNLOCK(copy == NULL, "No kmap slots.", PAGING_NO_MEMORY);
+    u_memcpy(copy, (uint8_t *)page_vaddr, PAGE_SIZE);
+    paging_kunmap(copy);
+
+    pt[pt_idx].frame_addr = copy_paddr >> PAGE_SIZE_SHIFT;
+    pmm_free(paddr, 1);
+  }
+
+  pt[pt_idx].rw = 1;
+  pt[pt_idx].cow = 0;
+  paging_invalidate_pte(page_vaddr);
+
+  interrupt_restore(eflags);
+  return PAGING_OK;
+}
+
+// Map a physical page into a free kmap slot of this CPU. The slot's
+// entry lives in a kernel page table that is allocated in paging_init,
+// so mapping a page is a single store and unmapping it is a single
+// local invlpg.
+void *paging_kmap(uint32_t paddr)
+{
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t cpu = smp_cpu_id();
+  uint8_t free_slots = ~kmap_used_slots[cpu];
+  if (free_slots == 0) {
+    interrupt_restore(eflags);
+    log_error("paging", "No free kmap slots.\n");
+    return NULL;
+  }
+  uint32_t slot = __builtin_ctz(free_slots);
+  kmap_used_slots[cpu] |= 1 << slot;
+  if (kmap_depth[cpu]++ == 0)
+    kmap_eflags[cpu] = eflags;
+
+  slot += cpu * KMAP_SLOTS_PER_CPU;
+  uint32_t vaddr = KMAP_VADDR + (slot << PAGE_SIZE_SHIFT);
+  page_table_t pt = (page_table_t)pd_idx_to_pt_vaddr(vaddr_to_pd_idx(vaddr));
+  page_table_entry_t pte;
+  u_memset(&pte, 0, sizeof(pte));
+  pte.present = 1;
+  pte.rw = 1;
+  pte.global = global_pages_enabled;
+  pte.frame_addr = paddr >> PAGE_SIZE_SHIFT;
+  pt[vaddr_to_pt_idx(vaddr)] = pte;
+  return (void *)vaddr;
+}
+
+// Release a kmap slot, and enable interrupts again if they were
+// enabled before this CPU mapped its first slot.
+void paging_kunmap(void *addr)
+{
+  uint32_t vaddr = u_page_align_down((uint32_t)addr);
+  uint32_t slot = (vaddr - KMAP_VADDR) >> PAGE_SIZE_SHIFT;
+  page_table_t pt = (page_table_t)pd_idx_to_pt_vaddr(vaddr_to_pd_idx(vaddr));
+  u_memset(pt + vaddr_to_pt_idx(vaddr), 0, sizeof(page_table_entry_t));
+  paging_invlpg(vaddr);
+
+  uint32_t cpu = smp_cpu_id();
+  kmap_used_slots[cpu] &= ~(1 << (slot % KMAP_SLOTS_PER_CPU));
+  if (--kmap_depth[cpu] == 0)
+    interrupt_restore(kmap_eflags[cpu]);
+}
+
+// Zero a physical page.
+paging_result_t paging_zero_page(uint32_t paddr)
+{
+  void *page = paging_kmap(paddr);
+  if (page == NULL)
+    return PAGING_NO_MEMORY;
+  u_memset(page, 0, PAGE_SIZE);
+  paging_kunmap(page);
+  return PAGING_OK;
+}
+
+paging_result_t paging_copy_to_page(uint32_t paddr, const void *src)
+{
+  void *page = paging_kmap(paddr);
+  if (page == NULL)
+    return PAGING_NO_MEMORY;
+  u_memcpy(page, src, PAGE_SIZE);
+  paging_kunmap(page);
+  return PAGING_OK;
+}
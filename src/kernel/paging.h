@@ -14,6 +14,9 @@
 // A single page table entry.
 // Bit-fields with descriptions ending in `?` are flags that we set,
 // those ending in '.' are flags that the CPU sets.
+// The CPU ignores every other bit of an entry that is not present. A
+// page that has been swapped out keeps its flags, but has `swapped` set
+// and the swap slot that holds it in `frame_addr`.
 struct page_table_entry_s
 {
   uint32_t present : 1;  // Present in memory?
@@ -23,7 +26,11 @@ struct page_table_entry_s
   uint32_t pcd : 1;      // Disable caching?
   uint32_t accessed : 1; // Page frame was accessed.
   uint32_t dirty : 1;    // Page frame was modified.
-  uint32_t unused : 5;
+  uint32_t swapped : 1;  // In swap? This is the PAT bit of present entries, which we never set.
+  uint32_t global : 1;   // Kept in the TLB when cr3 changes?
+  uint32_t cow : 1;      // Copy on write?
+  uint32_t shared : 1;   // Shared with child processes instead of copied on write?
+  uint32_t text : 1;     // Executable page shared through text.c?
   uint32_t frame_addr : 20; // Only the upper 20 bits.
 } __attribute__((packed));
 typedef struct page_table_entry_s page_table_entry_t;
@@ -42,12 +49,20 @@ struct page_directory_entry_s
   uint32_t accessed : 1;  // Frame/table was accessed.
   uint32_t dirty : 1;     // Frame/table was modified.
   uint32_t page_size : 1; // Is a 4MB page frame?
-  uint32_t unused : 4;
+  uint32_t global : 1;    // Kept in the TLB when cr3 changes? Only for 4MB pages.
+  uint32_t unused : 3;
   uint32_t table_addr : 20; // Only the upper 20 bits.
 } __attribute__((packed));
 typedef struct page_directory_entry_s page_directory_entry_t;
 typedef page_directory_entry_t *page_directory_t;
 
+// Pages used by the user part of an address space.
+typedef struct paging_usage_s
+{
+  uint32_t resident_pages; // Present user pages, including shared ones.
+  uint32_t table_pages;    // Page tables and the page directory.
+} paging_usage_t;
+
 // Result of paging_map and paging_unmap.
 typedef enum
 {
@@ -57,48 +72,124 @@ typedef enum
   PAGING_NO_ACCESS = EPERM
 } paging_result_t;
 
-// Initialize paging.
+// Initialize paging and allocate all kernel page tables.
 uint32_t paging_init(page_directory_t, uint32_t);
 
+// Map physically contiguous memory into kernel space, using 4MB
+// pages if the CPU supports them and the physical address is aligned to
+// 4MB. Takes a physical address, a number of pages and PTE flags, and
+// returns a virtual address or 0. Only valid during boot, before any
+// other page directory is created.
+uint32_t paging_map_kernel_region(uint32_t, uint32_t, page_table_entry_t);
+
+// Allocate and map physically contiguous kernel memory, rounded up to
+// whole 4MB pages if the CPU supports them. Takes a number of pages and
+// returns a virtual address or NULL. The memory is never freed. Same
+// restrictions as paging_map_kernel_region.
+void *paging_alloc_kernel_region(uint32_t);
+
 // Set/get kernel page directory address.
 void paging_set_kernel_pd(page_directory_t, uint32_t);
 void paging_get_kernel_pd(page_directory_t *, uint32_t *);
 
 // Clone a process's page directory. Takes and returns physical
-// addresses.
+// addresses. Writable user pages are shared copy-on-write, except for
+// pages marked shared, which stay writable in both address spaces.
 uint32_t paging_clone_process_directory(uint32_t *, uint32_t);
 
-// Clear the user-mode address space.
+// Clear the user-mode address space. Shared executable pages are
+// released through text_release, and swapped out pages through swap_free.
 uint8_t paging_clear_user_space();
 
-// Shallow copy the kernel's address space. Takes the physical
-// address of the page directory to copy into.
+// Free a page directory whose user address space has been cleared.
+// Takes a physical address.
+void paging_free_process_directory(uint32_t);
+
+// Shallow copy the kernel's address space into a new page directory.
+// Takes the physical address of the page directory to copy into.
 uint32_t paging_copy_kernel_space(uint32_t);
 
-// Implemented in paging.s.
+// Set the page directory of this CPU.
 void paging_set_cr3(uint32_t);
+
+// Implemented in paging.s.
 uint32_t paging_get_cr3();
+void paging_set_cr4(uint32_t);
+uint32_t paging_get_cr4();
 
-// Remove a PTE from the TLB. Implemented in paging.s.
+// Remove a PTE from the TLB of every CPU that may have it.
 void paging_invalidate_pte(uint32_t);
 
+// Remove a PTE from the TLB of this CPU. Implemented in paging.s.
+void paging_invlpg(uint32_t);
+
+// Flush the TLB of this CPU, including global pages.
+void paging_flush_tlb();
+
 // Map a virtual page starting at `virt_addr` to a physical page
 // starting at `phys_addr`. `flags` specifies .rw, .user, .pwt and
 // other PTE flags.
 paging_result_t paging_map(uint32_t virt_addr, uint32_t phys_addr, page_table_entry_t flags);
 
-// Unmap a page starting at virtual address `virt_addr`.
+// Unmap a page starting at virtual address `virt_addr`. Frees the
+// swap slot of the page if it has been swapped out.
 paging_result_t paging_unmap(uint32_t virt_addr);
 
-// Get the next free virtual address at the start of multiple
-// contiguous unmapped pages.
+// Reserve a range of contiguous free virtual pages. Takes the number
+// of pages and the lowest address to consider, and returns the start of
+// the lowest free range or 0. Reserved pages are released by
+// paging_unmap, whether or not they have been mapped.
 uint32_t paging_next_vaddr(uint32_t, uint32_t);
 
-// Get the last free virtual address at the start of multiple
-// contiguous unmapped pages.
+// Reserve the highest range of contiguous free virtual pages that
+// ends at or below an address.
 uint32_t paging_prev_vaddr(uint32_t, uint32_t);
 
+// Reserve specific virtual pages without mapping them. Takes a virtual
+// address and a number of pages.
+void paging_reserve_vaddr(uint32_t, uint32_t);
+
+// Release reserved virtual pages that are not mapped. Takes a virtual
+// address and a number of pages.
+void paging_release_vaddr(uint32_t, uint32_t);
+
 // Get the physical address that a virtual address is mapped to.
 uint32_t paging_get_paddr(uint32_t);
 
+// Adjust the resident page count of the current address space, for
+// code that makes user pages present or not present without
+// paging_map and paging_unmap.
+void paging_add_resident_pages(int32_t);
+
+// Get the pages used by the user part of an address space. Takes the
+// physical address of its page directory.
+void paging_get_usage(uint32_t, paging_usage_t *);
+
+// Get the page table entry of a virtual address in the current address
+// space, or NULL if it has no page table. The TLB entry must be
+// invalidated after changing the PTE.
+page_table_entry_t *paging_get_pte(uint32_t);
+
+// Give the current address space a private, writable copy of the
+// copy-on-write page containing a virtual address. Returns
+// PAGING_NO_ACCESS if the page is not copy-on-write.
+paging_result_t paging_copy_on_write(uint32_t);
+
+// Temporarily map a physical page at a fixed kernel address. Returns
+// NULL if every kmap slot of this CPU is in use. Interrupts are disabled
+// until every mapping of this CPU is released with paging_kunmap, so
+// mappings must be short-lived and must not be held while sleeping.
+void *paging_kmap(uint32_t);
+
+// Release a mapping made by paging_kmap.
+void paging_kunmap(void *);
+
+// Zero a physical page through a kmap slot.
+paging_result_t paging_zero_page(uint32_t);
+
+// Copy a page of memory into a physical page through a kmap slot.
+// Code that may sleep while filling a page, e.g reading a file, fills
+// a buffer first, since there are few kmap slots.
+paging_result_t paging_copy_to_page(uint32_t, const void *);
+
 #endif /* _PAGING_H_ */
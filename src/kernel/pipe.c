@@ -14,6 +14,7 @@
 #include "log.h"
 #include "process.h"
 #include "util.h"
+#include "wait.h"
 
 #define CHECK(err, msg, code)                                                                      \
   if ((err)) {                                                                                     \
@@ -21,15 +22,8 @@
     return (code);                                                                                 \
   }
 
-#define MAX_READERS 4
 static const uint32_t DEFAULT_SIZE = 1024;
 
-typedef struct
-{
-  process_t *process;
-  uint32_t size;
-} pipe_reader_t;
-
 typedef struct
 {
   fs_node_t *read_node;
@@ -39,40 +33,26 @@ typedef struct
   uint32_t count;
   uint32_t size;
   volatile uint32_t reader_lock;
-  pipe_reader_t readers[MAX_READERS];
+  wait_queue_t readers; // Readers waiting for data.
 } pipe_t;
 
-uint32_t pipe_suspend(process_registers_t *regs, uint32_t updated);
-
-static void pipe_wait(pipe_t *self, uint32_t size)
-{
-  disable_interrupts();
-  process_t *current_process = process_current();
-
-  uint8_t updated = 0;
-  for (uint32_t i = 0; i < MAX_READERS; ++i) {
-    if (self->readers[i].process == NULL) {
-      self->readers[i].process = current_process;
-      self->readers[i].size = size;
-      updated = 1;
-      break;
-    }
-  }
-
-  if (updated)
-    process_unschedule(current_process);
-  pipe_suspend(&(current_process->kregs), updated);
-}
-
 static uint32_t pipe_read(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buf)
 {
   (void)offset;
   pipe_t *self = node->device;
+  process_t *current = process_current();
 
+  // Writers do not take the reader lock, so the reader is added to the
+  // queue before checking for data.
   klock(&self->reader_lock);
-  while (self->count == 0 && self->write_node) {
+  while (1) {
+    wait_prepare(&self->readers, current);
+    if (self->count || self->write_node == NULL) {
+      wait_cancel(current);
+      break;
+    }
     kunlock(&self->reader_lock);
-    pipe_wait(self, size);
+    wait_sleep(current);
     klock(&self->reader_lock);
   }
 
@@ -117,18 +97,7 @@ static uint32_t pipe_write(fs_node_t *node, uint32_t offset, uint32_t size, uint
   self->read_node->size = self->count;
   self->write_node->size = self->count;
 
-  uint32_t remaining_size = size;
-  for (uint32_t i = 0; i < MAX_READERS; ++i) {
-    if (self->readers[i].process == NULL)
-      continue;
-
-    process_schedule(self->readers[i].process);
-    self->readers[i].process = NULL;
-    if (self->readers[i].size >= remaining_size)
-      break;
-    else
-      remaining_size -= self->readers[i].size;
-  }
+  wait_wake_all(&self->readers);
   interrupt_restore(eflags);
 
   return size;
@@ -168,13 +137,7 @@ static void pipe_close_write(fs_node_t *node)
     return;
   }
 
-  for (uint32_t i = 0; i < MAX_READERS; ++i) {
-    if (self->readers[i].process == NULL)
-      continue;
-
-    process_schedule(self->readers[i].process);
-    self->readers[i].process = NULL;
-  }
+  wait_wake_all(&self->readers);
   interrupt_restore(eflags);
 }
 
@@ -1,4 +1,3 @@
-
 // pit.c
 //
 // Programmable Interval Timer interface for Mako.
@@ -10,21 +9,75 @@
 #include "interrupt.h"
 #include "io.h"
 #include "log.h"
+#include "util.h"
 #include <stddef.h>
 
 static const uint16_t PIT_CHANNEL_0_DATA = 0x40;
-static const uint16_t PIT_CHANNEL_1_DATA = 0x41;
-static const uint16_t PIT_CHANNEL_2_DATA = 0x42;
 static const uint16_t PIT_COMMAND = 0x43;
 static const uint32_t PIT_FREQUENCY = 0x1234de;
+static const uint32_t NS_PER_SEC = 1000000000;
+
+// Channel 0, low byte then high byte, mode 0 (interrupt on terminal count).
+static const uint8_t PIT_ONE_SHOT = (1 << 5) | (1 << 4);
+static const uint8_t PIT_LATCH_CHANNEL_0 = 0;
+
+// Bounds of the count that is programmed. The counter is 16 bits wide,
+// and a very short count would expire before it is fully written.
+static const uint32_t PIT_MIN_COUNT = 2;
+static const uint32_t PIT_MAX_COUNT = 0xffff;
 
 static interrupt_handler_t handler = NULL;
-static uint32_t interval = 10;
-static uint64_t ticks = 0;
+
+// The counter was last programmed with `count` when `base` PIT ticks had
+// elapsed since boot. Since the counter keeps counting down after it
+// expires, the time is kept correctly as long as it is programmed again
+// within PIT_MAX_COUNT ticks, which every interrupt does.
+static uint64_t base = 0;
+static uint32_t count = PIT_MAX_COUNT;
+static uint64_t last_ticks = 0;
+
+// Read the counter of channel 0.
+static uint16_t read_counter()
+{
+  outb(PIT_COMMAND, PIT_LATCH_CHANNEL_0);
+  uint16_t lo = inb(PIT_CHANNEL_0_DATA);
+  uint16_t hi = inb(PIT_CHANNEL_0_DATA);
+  return lo | (hi << 8);
+}
+
+// Get the number of PIT ticks since boot. Must be called with
+// interrupts disabled.
+static uint64_t elapsed_ticks()
+{
+  uint64_t ticks = base + ((count - read_counter()) & 0xffff);
+  // The counter may be read just before a new count is loaded.
+  if (ticks < last_ticks)
+    ticks = last_ticks;
+  last_ticks = ticks;
+  return ticks;
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks)
+{
+  uint32_t rem;
+  uint64_t sec = u_div64(ticks, PIT_FREQUENCY, &rem);
+  return sec * NS_PER_SEC + u_div64((uint64_t)rem * NS_PER_SEC, PIT_FREQUENCY, NULL);
+}
+
+// Program the counter to interrupt after `ticks` PIT ticks.
+static void program(uint32_t ticks)
+{
+  base = elapsed_ticks();
+  count = ticks;
+  outb(PIT_COMMAND, PIT_ONE_SHOT);
+  outb(PIT_CHANNEL_0_DATA, (uint8_t)ticks);
+  outb(PIT_CHANNEL_0_DATA, (uint8_t)(ticks >> 8));
+}
 
 static void tick(cpu_state_t cs, idt_info_t info, stack_state_t ss)
 {
-  ++ticks;
+  // Keep time until the handler sets the timer again.
+  program(PIT_MAX_COUNT);
   if (handler)
     handler(cs, info, ss);
 }
@@ -33,30 +86,36 @@ static void tick(cpu_state_t cs, idt_info_t info, stack_state_t ss)
 void pit_init()
 {
   uint32_t eflags = interrupt_save_disable();
-  uint8_t data = (1 << 5) | (1 << 4) | (1 << 2) | (1 << 1);
-  outb(PIT_COMMAND, data);
-  pit_set_interval(interval);
+  outb(PIT_COMMAND, PIT_ONE_SHOT);
+  outb(PIT_CHANNEL_0_DATA, (uint8_t)PIT_MAX_COUNT);
+  outb(PIT_CHANNEL_0_DATA, (uint8_t)(PIT_MAX_COUNT >> 8));
   register_interrupt_handler(32, tick);
   interrupt_restore(eflags);
 }
 
-// Get and set interval (in milliseconds).
-uint32_t pit_get_interval()
+// Interrupt after a number of nanoseconds. The PIT cannot wait for
+// longer than about 55ms, so a longer delay interrupts early and the
+// handler sets the timer again.
+void pit_set_timer(uint64_t delay)
 {
-  return interval;
-}
-void pit_set_interval(uint32_t i)
-{
-  interval = i;
-  uint32_t f = 1000 / i;
-  uint16_t divisor = (uint16_t)(PIT_FREQUENCY / f);
-  outb(PIT_CHANNEL_0_DATA, (uint8_t)divisor);
-  outb(PIT_CHANNEL_0_DATA, (uint8_t)(divisor >> 8));
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t ticks = PIT_MAX_COUNT;
+  // Round up so that the interrupt never comes early.
+  if (delay < ticks_to_ns(PIT_MAX_COUNT))
+    ticks = u_div64(delay * PIT_FREQUENCY + NS_PER_SEC - 1, NS_PER_SEC, NULL);
+  if (ticks < PIT_MIN_COUNT)
+    ticks = PIT_MIN_COUNT;
+  program(ticks);
+  interrupt_restore(eflags);
 }
 
-uint64_t pit_get_time()
+// Get the time since boot in nanoseconds.
+uint64_t pit_get_time_ns()
 {
-  return ticks * interval;
+  uint32_t eflags = interrupt_save_disable();
+  uint64_t ticks = elapsed_ticks();
+  interrupt_restore(eflags);
+  return ticks_to_ns(ticks);
 }
 
 // Set interrupt handler.
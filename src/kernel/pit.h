@@ -1,4 +1,3 @@
-
 // pit.h
 //
 // Programmable Interval Timer interface for Mako.
@@ -11,15 +10,18 @@
 #include "../common/stdint.h"
 #include "interrupt.h"
 
-// Initialize the PIT.
+// Delay for pit_set_timer when nothing is waiting for the timer.
+#define PIT_NO_TIMER 0xffffffffffffffffULL
+
+// Initialize the PIT. The PIT runs in one-shot mode and interrupts
+// when the timer that was last set expires, instead of periodically.
 void pit_init();
 
-// Get and set interval (in milliseconds).
-uint32_t pit_get_interval();
-void pit_set_interval(uint32_t);
+// Interrupt after a number of nanoseconds.
+void pit_set_timer(uint64_t);
 
-// Get time.
-uint64_t pit_get_time();
+// Get time since boot in nanoseconds, counted by the PIT.
+uint64_t pit_get_time_ns();
 
 // Set interrupt handler.
 void pit_set_handler(interrupt_handler_t);
@@ -1,4 +1,3 @@
-
 // pmm.c
 //
 // Physical memory manager for Mako.
@@ -12,8 +11,16 @@
 #include "multiboot.h"
 #include "util.h"
 
+// This is a binary buddy allocator. Free memory is kept as blocks of
+// 2^order contiguous pages, each aligned to its own size, on one free
+// list per order. Allocating splits larger blocks in half until a block
+// of the requested order is left over, and freeing merges a block with its
+// 'buddy' (the other half of the block it was split from) for as long
+// as the buddy is also free.
+
 #define MAX_MEMORY_MAP_ENTRIES 100
-#define BITMAP_ARRAY_SIZE 0x8000
+#define MAX_ORDER 10 // Largest block is 2^10 pages (4MB).
+#define NO_PAGE 0xFFFFFFFF
 
 // A single memory map entry.
 // `addr` is the physical start address, `len` is the size
@@ -32,47 +39,166 @@ typedef struct memory_map_s
   uint32_t size;
 } memory_map_t;
 
+// Per-page metadata. `next`, `prev`, `order` and `free` are only
+// meaningful for the first page of a free block; `next` and `prev` are
+// the page numbers of the neighbouring blocks in the free list of the
+// same order. `refs` is the number of references to a page, which is 0
+// for every page of a free block, so it is the state of each page.
+typedef struct frame_s
+{
+  uint32_t next;
+  uint32_t prev;
+  uint8_t order;
+  uint8_t free;
+  uint16_t refs;
+} frame_t;
+
 // Global state.
 static memory_map_t pmm_mmap;
-static uint32_t free_page_bitmap[BITMAP_ARRAY_SIZE];
+static frame_t *frames = NULL;
+static uint32_t frame_count = 0;
+static uint32_t free_lists[MAX_ORDER + 1];
 static uint32_t free_page_count = 0;
+static uint32_t total_page_count = 0;
+static uint32_t min_free_page_count = 0;
+static uint32_t low_watermark_hits = 0;
 
-// Mark a physical page frame as free.
-static void mark_page_free(uint32_t page_number)
+// Add a free block to the front of the free list of its order.
+static void free_list_push(uint32_t page_number, uint32_t order)
 {
-  uint32_t index = page_number >> 5;    // Divide by 32.
-  uint32_t bit = page_number & 0b11111; // Mod 32.
-  if (index >= BITMAP_ARRAY_SIZE)
-    return;
-  if ((free_page_bitmap[index] & (1 << bit)) == 0)
-    ++free_page_count; // Page was not free.
-  free_page_bitmap[index] |= (1 << bit);
+  frame_t *frame = frames + page_number;
+  frame->free = 1;
+  frame->order = order;
+  frame->prev = NO_PAGE;
+  frame->next = free_lists[order];
+  if (frame->next != NO_PAGE)
+    frames[frame->next].prev = page_number;
+  free_lists[order] = page_number;
+  free_page_count += 1 << order;
 }
 
-// Mark a physical page frame as used.
-static void mark_page_used(uint32_t page_number)
+// Remove a free block from the free list of its order.
+static void free_list_remove(uint32_t page_number)
 {
-  uint32_t index = page_number >> 5;    // Divide by 32.
-  uint32_t bit = page_number & 0b11111; // Mod 32.
-  if (index >= BITMAP_ARRAY_SIZE)
+  frame_t *frame = frames + page_number;
+  if (frame->next != NO_PAGE)
+    frames[frame->next].prev = frame->prev;
+  if (frame->prev != NO_PAGE)
+    frames[frame->prev].next = frame->next;
+  else
+    free_lists[frame->order] = frame->next;
+  frame->free = 0;
+  free_page_count -= 1 << frame->order;
+}
+
+// Free a single block, merging it with its buddy as many times as possible.
+static void free_block(uint32_t page_number, uint32_t order)
+{
+  for (; order < MAX_ORDER; ++order) {
+    uint32_t buddy = page_number ^ (1 << order);
+    if (buddy >= frame_count || frames[buddy].free == 0 || frames[buddy].order != order)
+      break;
+    free_list_remove(buddy);
+    page_number &= buddy;
+  }
+  free_list_push(page_number, order);
+}
+
+// Free an arbitrary run of pages by splitting it into the largest
+// naturally aligned blocks that it contains.
+static void free_range(uint32_t page_number, uint32_t count)
+{
+  if (page_number >= frame_count)
     return;
-  if (free_page_bitmap[index] & (1 << bit))
-    --free_page_count; // Page was free.
-  free_page_bitmap[index] &= ~(1 << bit);
+  if (count > frame_count - page_number)
+    count = frame_count - page_number;
+  for (uint32_t i = 0; i < count; ++i)
+    frames[page_number + i].refs = 0;
+
+  while (count) {
+    uint32_t order = 0;
+    while (order < MAX_ORDER && (page_number & (1 << order)) == 0 && (2u << order) <= count)
+      ++order;
+    free_block(page_number, order);
+    page_number += 1 << order;
+    count -= 1 << order;
+  }
 }
 
-// Mark free page frames from a bitmap.
-static void bitmap_init(memory_map_t mmap)
+// Remove [start, end) from the memory map.
+static void mmap_exclude(memory_map_t *mmap, uint32_t start, uint32_t end)
 {
-  for (uint32_t i = 0; i < mmap.size; ++i) {
-    memory_map_entry_t entry = mmap.entries[i];
+  for (uint32_t i = 0; i < mmap->size; ++i) {
+    memory_map_entry_t *entry = mmap->entries + i;
+    uint32_t entry_end = entry->addr + entry->len;
+    if (entry_end <= start || entry->addr >= end)
+      continue;
+
+    if (entry->addr >= start) {
+      entry->len = entry_end > end ? entry_end - end : 0;
+      entry->addr = end;
+      continue;
+    }
+
+    entry->len = start - entry->addr;
+    if (entry_end > end && mmap->size < MAX_MEMORY_MAP_ENTRIES) {
+      mmap->entries[mmap->size].addr = end;
+      mmap->entries[mmap->size].len = entry_end - end;
+      ++mmap->size;
+    }
+  }
+}
+
+// Allocate the page metadata array and mark free page frames.
+// The metadata is placed directly after the kernel so that it is
+// reachable through the kernel's 4MB mapping without any page tables.
+static uint32_t frames_init(memory_map_t *mmap, const uint32_t kphys_end)
+{
+  uint32_t max_page_number = 0;
+  for (uint32_t i = 0; i < mmap->size; ++i) {
+    uint32_t end_number = u_page_align_down(mmap->entries[i].addr + mmap->entries[i].len) >>
+                          PAGE_SIZE_SHIFT;
+    if (end_number > max_page_number)
+      max_page_number = end_number;
+  }
+
+  uint32_t frames_start = u_page_align_up(kphys_end);
+  uint32_t found = 0;
+  for (uint32_t i = 0; i < mmap->size; ++i)
+    if (mmap->entries[i].addr <= frames_start &&
+        mmap->entries[i].addr + mmap->entries[i].len > frames_start)
+      found = 1;
+  if (!found)
+    return 1;
+
+  uint32_t max_frames = (KERNEL_DIRECT_MAP_SIZE - frames_start) / sizeof(frame_t);
+  if (max_page_number > max_frames) {
+    log_error("pmm", "Only managing the first %u pages of memory.\n", max_frames);
+    max_page_number = max_frames;
+  }
+
+  frames = (frame_t *)(frames_start + KERNEL_START_VADDR);
+  frame_count = max_page_number;
+  // Pages that are not available stay allocated.
+  u_memset(frames, 0, frame_count * sizeof(frame_t));
+  for (uint32_t i = 0; i < frame_count; ++i)
+    frames[i].refs = 1;
+  for (uint32_t i = 0; i <= MAX_ORDER; ++i)
+    free_lists[i] = NO_PAGE;
+
+  uint32_t frames_end = u_page_align_up(frames_start + (frame_count * sizeof(frame_t)));
+  mmap_exclude(mmap, frames_start, frames_end);
+
+  for (uint32_t i = 0; i < mmap->size; ++i) {
+    memory_map_entry_t entry = mmap->entries[i];
     uint32_t start_addr = u_page_align_up(entry.addr);
     uint32_t end_addr = u_page_align_down(entry.addr + entry.len);
-    uint32_t page_number = start_addr >> PAGE_SIZE_SHIFT;
-    uint32_t end_number = end_addr >> PAGE_SIZE_SHIFT;
-    for (; page_number < end_number; ++page_number)
-      mark_page_free(page_number);
+    if (end_addr <= start_addr)
+      continue;
+    free_range(start_addr >> PAGE_SIZE_SHIFT, (end_addr - start_addr) >> PAGE_SIZE_SHIFT);
   }
+
+  return 0;
 }
 
 // Retrieve the memory map from GRUB multiboot info.
@@ -121,8 +247,6 @@ static memory_map_t get_mmap(multiboot_info_t *mb_info,
 // Initialize the physical memory manager.
 uint32_t pmm_init(multiboot_info_t *mb_info, const uint32_t kphys_start, const uint32_t kphys_end)
 {
-  u_memset(free_page_bitmap, 0, sizeof(free_page_bitmap));
-
   if ((mb_info->flags & 0x20) == 0) {
     log_error("pmm", "No memory map from GRUB.\n");
     return 1;
@@ -134,8 +258,13 @@ uint32_t pmm_init(multiboot_info_t *mb_info, const uint32_t kphys_start, const u
     return 1;
   }
 
-  bitmap_init(pmm_mmap);
+  if (frames_init(&pmm_mmap, kphys_end)) {
+    log_error("pmm", "Could not allocate page frame metadata.\n");
+    return 1;
+  }
   log_info("pmm", "Found %u free pages.\n", free_page_count);
+  total_page_count = free_page_count;
+  min_free_page_count = free_page_count;
 
   return 0;
 }
@@ -143,41 +272,90 @@ uint32_t pmm_init(multiboot_info_t *mb_info, const uint32_t kphys_start, const u
 // Allocate multiple contiguous physical pages.
 uint32_t pmm_alloc(uint32_t size)
 {
-  if (free_page_count == 0 || size == 0)
+  if (free_page_count < size || size == 0)
     return 0;
 
-  uint32_t max_page_number = sizeof(free_page_bitmap);
-  uint32_t current = 0, step = 0;
-  for (; current < max_page_number; current += step + 1) {
-    uint32_t current_index = current >> 5;
-    if (free_page_bitmap[current_index] == 0)
-      current = (current_index + 1) << 5;
-
-    uint32_t found = 0;
-    for (step = 0; step < size; ++step) {
-      uint32_t page_number = current + step;
-      uint32_t index = page_number >> 5;
-      uint32_t bit = page_number & 0b11111;
-      uint32_t value = free_page_bitmap[index];
-      if (value & (1 << bit))
-        ++found;
-      if (found >= size) {
-        for (uint32_t allocated = 0; allocated < size; ++allocated)
-          mark_page_used(current + allocated);
-        return current << PAGE_SIZE_SHIFT;
-      }
-      if ((value & (1 << bit)) == 0)
-        break;
-    }
+  uint32_t order = 0;
+  while ((1u << order) < size)
+    ++order;
+  if (order > MAX_ORDER)
+    return 0;
+
+  uint32_t current_order = order;
+  while (current_order <= MAX_ORDER && free_lists[current_order] == NO_PAGE)
+    ++current_order;
+  if (current_order > MAX_ORDER)
+    return 0;
+
+  uint32_t page_number = free_lists[current_order];
+  free_list_remove(page_number);
+
+  // Split the block, returning the upper halves to the free lists.
+  while (current_order > order) {
+    --current_order;
+    free_list_push(page_number + (1 << current_order), current_order);
   }
 
-  return 0;
+  // Return any pages past the end of the requested size.
+  if (size < (1u << order))
+    free_range(page_number + size, (1 << order) - size);
+  for (uint32_t i = 0; i < size; ++i)
+    frames[page_number + i].refs = 1;
+
+  if (free_page_count < PMM_LOW_WATERMARK && free_page_count + size >= PMM_LOW_WATERMARK)
+    ++low_watermark_hits;
+  if (free_page_count < min_free_page_count)
+    min_free_page_count = free_page_count;
+
+  return page_number << PAGE_SIZE_SHIFT;
 }
 
 // Free multiple contiguous physical pages.
 void pmm_free(uint32_t addr, uint32_t size)
 {
-  addr = u_page_align_down(addr);
-  for (uint32_t i = 0; i < size; ++i, addr += PAGE_SIZE)
-    mark_page_free(addr >> PAGE_SIZE_SHIFT);
+  uint32_t page_number = u_page_align_down(addr) >> PAGE_SIZE_SHIFT;
+  if (page_number < frame_count && frames[page_number].refs == 0) {
+    log_error("pmm", "Attempt to free free page %x.\n", addr);
+    return;
+  }
+  if (page_number < frame_count && frames[page_number].refs > 1) {
+    --frames[page_number].refs;
+    return;
+  }
+  free_range(page_number, size);
+}
+
+// Add a reference to an allocated page.
+void pmm_ref(uint32_t addr)
+{
+  uint32_t page_number = u_page_align_down(addr) >> PAGE_SIZE_SHIFT;
+  if (page_number >= frame_count || frames[page_number].refs == 0) {
+    log_error("pmm", "Attempt to reference free page %x.\n", addr);
+    return;
+  }
+  ++frames[page_number].refs;
+}
+
+// Get the number of references to an allocated page.
+uint32_t pmm_refcount(uint32_t addr)
+{
+  uint32_t page_number = u_page_align_down(addr) >> PAGE_SIZE_SHIFT;
+  if (page_number >= frame_count)
+    return 0;
+  return frames[page_number].refs;
+}
+
+// Get the number of free pages.
+uint32_t pmm_free_pages()
+{
+  return free_page_count;
+}
+
+// Get a snapshot of the counters.
+void pmm_get_stats(pmm_stats_t *out)
+{
+  out->total_pages = total_page_count;
+  out->free_pages = free_page_count;
+  out->min_free_pages = min_free_page_count;
+  out->low_watermark_hits = low_watermark_hits;
 }
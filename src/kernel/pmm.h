@@ -11,6 +11,18 @@
 #include "../common/stdint.h"
 #include "multiboot.h"
 
+// Free memory is low when fewer pages than this are free.
+#define PMM_LOW_WATERMARK 256
+
+// Physical memory counters, in pages.
+typedef struct pmm_stats_s
+{
+  uint32_t total_pages; // Pages that were free after boot.
+  uint32_t free_pages;
+  uint32_t min_free_pages;     // Fewest free pages since boot.
+  uint32_t low_watermark_hits; // Times free memory dropped below PMM_LOW_WATERMARK.
+} pmm_stats_t;
+
 // Initialize the physical memory manager.
 // Uses the memory map provided by GRUB to determine which
 // regions of memory are available initially.
@@ -21,7 +33,21 @@ uint32_t pmm_init(multiboot_info_t *, const uint32_t, const uint32_t);
 uint32_t pmm_alloc(uint32_t);
 
 // Free multiple contiguous physical pages. Takes a physical start
-// address and number of pages.
+// address and number of pages. If the first page has been referenced
+// with pmm_ref, this only drops one reference.
 void pmm_free(uint32_t, uint32_t);
 
+// Add a reference to a single allocated page, so that it is shared
+// by multiple owners. Each owner releases it with pmm_free.
+void pmm_ref(uint32_t);
+
+// Get the number of references to a single allocated page.
+uint32_t pmm_refcount(uint32_t);
+
+// Get the number of free pages.
+uint32_t pmm_free_pages();
+
+// Get a snapshot of the counters.
+void pmm_get_stats(pmm_stats_t *);
+
 #endif /* _PMM_H_ */
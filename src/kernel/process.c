@@ -7,20 +7,29 @@
 
 #include "process.h"
 #include "../common/errno.h"
+#include "../common/mman.h"
 #include "../common/signal.h"
 #include "../common/stdint.h"
+#include "clock.h"
 #include "constants.h"
 #include "ds.h"
 #include "fpu.h"
 #include "fs.h"
+#include "futex.h"
 #include "interrupt.h"
 #include "kheap.h"
 #include "klock.h"
+#include "kmutex.h"
+#include "lapic.h"
 #include "log.h"
 #include "paging.h"
 #include "pipe.h"
 #include "pit.h"
 #include "pmm.h"
+#include "slab.h"
+#include "smp.h"
+#include "swap.h"
+#include "text.h"
 #include "tss.h"
 #include "ui.h"
 #include "util.h"
@@ -36,33 +45,69 @@ static const uint32_t USER_MODE_CS = 0x18;
 static const uint32_t USER_MODE_DS = 0x20;
 static const uint32_t ENV_VADDR = KERNEL_START_VADDR - PAGE_SIZE;
 
+// Page fault error code bits.
+static const uint32_t PAGE_FAULT_PRESENT = 1; // Protection violation on a present page.
+static const uint32_t PAGE_FAULT_WRITE = 2;
+
 // Process tree and process status state.
 static process_t *init_process = NULL;
-static process_t *current_process = NULL;
 static heap_t sleep_queue;
 static process_status_t pids[MAX_PROCESS_COUNT];
 
-// Scheduler queues.
-static list_t running_lists[MAX_PROCESS_PRIORITY + 1];
+// Scheduler state of each CPU. Each CPU has its own queues, one per
+// priority. Bit i of `running_bitmap` is set when queue i is not empty,
+// so that the highest priority queue with a runnable process is found
+// in constant time. The first process in a queue that no other CPU is
+// running runs next, and the process that is picked moves to the tail.
+// A CPU whose queues are empty takes a process from another CPU.
+typedef struct runqueue_s
+{
+  process_t *current;
+  process_t *prev; // Process whose kernel stack the CPU is leaving.
+  list_t running_lists[MAX_PROCESS_PRIORITY + 1];
+  uint32_t running_bitmap;
+
+  // Stack of the idle loop, which runs when no process is runnable. The
+  // CPU also uses it while switching between processes.
+  uint8_t idle_stack[PAGE_SIZE] __attribute__((aligned(16)));
+} runqueue_t;
+static runqueue_t runqueues[MAX_CPU_COUNT];
+
+// Length of the time slice of each priority, in milliseconds. A process
+// runs until its slice is used up, it blocks or yields, or a process of
+// higher priority becomes runnable.
+static const uint32_t TIME_SLICES[MAX_PROCESS_PRIORITY + 1] = { 10, 20, 40 };
+static const uint32_t NS_PER_MS = 1000000;
 
 // Free list of pages used for process kernel stacks.
 static list_t kernel_stack_pages;
 
+// Object caches for processes and file descriptors.
+static kmem_cache_t process_cache = KMEM_CACHE_INIT("process", sizeof(process_t));
+static kmem_cache_t process_fd_cache = KMEM_CACHE_INIT("process_fd", sizeof(process_fd_t));
+
 // Implemented in process.s.
 void resume_kernel(process_registers_t *);
+void call_on_stack(uint32_t, void (*)(void *), void *);
+
+static inline runqueue_t *this_runqueue()
+{
+  return &runqueues[smp_cpu_id()];
+}
 
 // Save the registers of the current process.
 void update_current_process_registers(cpu_state_t cstate, stack_state_t sstate)
 {
+  process_t *current = process_current();
   process_registers_t *regs;
   if (sstate.cs == (USER_MODE_CS | 3)) {
-    current_process->in_kernel = 0;
-    regs = &(current_process->uregs);
+    current->in_kernel = 0;
+    regs = &(current->uregs);
     regs->ss = sstate.user_ss;
     regs->esp = sstate.user_esp;
   } else {
-    current_process->in_kernel = 1;
-    regs = &(current_process->kregs);
+    current->in_kernel = 1;
+    regs = &(current->kregs);
     regs->ss = SEGMENT_SELECTOR_KERNEL_DS;
     regs->esp = cstate.esp + 20;
   }
@@ -79,54 +124,218 @@ void update_current_process_registers(cpu_state_t cstate, stack_state_t sstate)
   regs->eflags = sstate.eflags | 0x202;
 }
 
+// Let other CPUs run the process that this CPU ran before, now that
+// this CPU no longer uses its kernel stack.
+static void release_prev(runqueue_t *rq)
+{
+  if (rq->prev && rq->prev != rq->current)
+    rq->prev->running = 0;
+  rq->prev = NULL;
+}
+
+// Finish resuming a process on the idle stack. Processes that were
+// interrupted in kernel mode resume with the kernel lock.
+static void finish_resume(void *p)
+{
+  process_t *process = p;
+  release_prev(this_runqueue());
+  if (process->in_kernel)
+    resume_kernel(&(process->kregs));
+  smp_unlock_kernel();
+  resume_user(&(process->uregs));
+}
+
 // Resume a running process.
 static void process_resume(process_t *process)
 {
-  if (current_process)
-    fpu_save(current_process);
-  fpu_restore(process);
-  current_process = process;
+  runqueue_t *rq = this_runqueue();
+  fpu_switch();
+  rq->prev = rq->current;
+  rq->current = process;
+  process->running = 1;
   tss_set_kernel_stack(SEGMENT_SELECTOR_KERNEL_DS, process->mmap.kernel_stack_top);
   paging_set_cr3(process->cr3);
-  if (process->in_kernel)
-    resume_kernel(&(process->kregs));
+
+  // Leave the kernel stack of the previous process, which another CPU
+  // may resume as soon as this one releases the kernel lock.
+  call_on_stack((uint32_t)rq->idle_stack + sizeof(rq->idle_stack), finish_resume, process);
+}
+
+// Charge the time since a process was last charged to it. Returns 1
+// if its time slice has been used up.
+static uint8_t charge(process_t *process, uint64_t now)
+{
+  uint64_t elapsed = now - process->run_start;
+  process->run_start = now;
+  process->cpu_time += elapsed;
+  if (process->time_slice == 0)
+    return 1;
+  if (elapsed < process->time_slice) {
+    process->time_slice -= elapsed;
+    return 0;
+  }
+  process->time_slice = 0;
+  ++process->slice_count;
+  return 1;
+}
+
+// Set the next timer interrupt of this CPU to the first wake time in
+// the sleep queue or the end of the time slice of the running process,
+// whichever comes first. There is no periodic tick, so an idle CPU is
+// only interrupted when a sleeping process has to wake up. The boot CPU
+// uses the PIT and the others use their local APIC timers.
+static void arm_timer(process_t *running, uint64_t now)
+{
+  uint64_t delay = PIT_NO_TIMER;
+  if (sleep_queue.size) {
+    uint64_t wake_time = heap_peek(&sleep_queue)->key;
+    delay = wake_time > now ? wake_time - now : 0;
+  }
+  if (running && running->time_slice < delay)
+    delay = running->time_slice;
+  if (smp_cpu_id() == 0)
+    pit_set_timer(delay);
   else
-    resume_user(&(process->uregs));
+    lapic_set_timer(delay);
+}
+
+// Whether a CPU may run a process. A process that another CPU runs, or
+// whose kernel stack it still uses, is left alone.
+static inline uint8_t can_run(process_t *process, uint32_t cpu)
+{
+  return process->running == 0 || process->cpu == cpu;
+}
+
+// Find the process in a run queue that a CPU would run next.
+static process_t *queue_first(runqueue_t *rq, uint32_t cpu)
+{
+  uint32_t bitmap = rq->running_bitmap;
+  while (bitmap) {
+    uint32_t priority = 31 - __builtin_clz(bitmap);
+    for (list_node_t *node = rq->running_lists[priority].head; node; node = node->next)
+      if (can_run(node->value, cpu))
+        return node->value;
+    bitmap &= ~(1 << priority);
+  }
+  return NULL;
+}
+
+static uint32_t queue_size(runqueue_t *rq)
+{
+  uint32_t size = 0;
+  for (uint32_t i = 0; i <= MAX_PROCESS_PRIORITY; ++i)
+    size += rq->running_lists[i].size;
+  return size;
+}
+
+// Add a process to the queues of a CPU.
+static void enqueue(process_t *process, uint32_t cpu)
+{
+  list_t *running_list = &runqueues[cpu].running_lists[process->priority];
+  process->cpu = cpu;
+  list_push_front(running_list, process);
+  process->list_node = running_list->head;
+  runqueues[cpu].running_bitmap |= 1 << process->priority;
+}
+
+// Move a process that is waiting to run on another CPU to this one,
+// from the CPU with the most processes.
+static process_t *steal(uint32_t cpu)
+{
+  process_t *stolen = NULL;
+  uint32_t most = 0;
+  for (uint32_t i = 0; i < smp_cpu_count(); ++i) {
+    if (i == cpu)
+      continue;
+    uint32_t size = queue_size(&runqueues[i]);
+    process_t *p = size > most ? queue_first(&runqueues[i], cpu) : NULL;
+    if (p) {
+      stolen = p;
+      most = size;
+    }
+  }
+
+  if (stolen) {
+    process_unschedule(stolen);
+    enqueue(stolen, cpu);
+  }
+  return stolen;
+}
+
+// Find the process that a CPU runs next.
+static process_t *next_process(uint32_t cpu)
+{
+  process_t *next = queue_first(&runqueues[cpu], cpu);
+  return next ? next : steal(cpu);
+}
+
+// Halt until an interrupt makes a process runnable. Runs with the
+// kernel lock, which is released while halted.
+static void idle_loop(void *unused)
+{
+  release_prev(this_runqueue());
+  while (1) {
+    if (next_process(smp_cpu_id()))
+      process_switch_next();
+    smp_unlock_kernel();
+    asm volatile("sti; hlt");
+    disable_interrupts();
+    smp_lock_kernel();
+  }
+}
+
+// Run the idle loop on the idle stack. The current process, if any, has
+// either been saved or is no longer runnable.
+static void enter_idle()
+{
+  runqueue_t *rq = this_runqueue();
+  fpu_switch();
+  rq->prev = rq->current;
+  rq->current = NULL;
+  call_on_stack((uint32_t)rq->idle_stack + sizeof(rq->idle_stack), idle_loop, NULL);
 }
 
 // Switch to next scheduled process.
 uint32_t process_switch_next()
 {
   uint32_t eflags = interrupt_save_disable();
-  list_t *running_list;
-  for (int32_t i = MAX_PROCESS_PRIORITY; i >= 0; --i) {
-    running_list = &running_lists[i];
-    if (running_list->size)
-      break;
+  uint32_t cpu = smp_cpu_id();
+  runqueue_t *rq = &runqueues[cpu];
+  uint64_t now = clock_get_time_ns();
+  if (rq->current) {
+    charge(rq->current, now);
+    // Stop running a process that another CPU is waiting to kill.
+    if (rq->current->kill_pending)
+      process_unschedule(rq->current);
   }
-  if (running_list->size == 0) {
-    interrupt_restore(eflags);
-    return 1;
+
+  process_t *next = next_process(cpu);
+  if (next == NULL) {
+    arm_timer(NULL, now);
+    enter_idle();
   }
 
-  process_t *next = running_list->head->value;
-  uint32_t res = paging_copy_kernel_space(next->cr3);
-  if (res) {
-    interrupt_restore(eflags);
-    log_error("process", "Failed to copy kernel address space.");
-    return res;
+  // Move the process to the tail of its queue.
+  list_t *running_list = &rq->running_lists[next->priority];
+  list_node_t *node = next->list_node;
+  if (node != running_list->tail) {
+    if (node->prev)
+      node->prev->next = node->next;
+    else
+      running_list->head = node->next;
+    node->next->prev = node->prev;
+    node->prev = running_list->tail;
+    node->next = NULL;
+    running_list->tail->next = node;
+    running_list->tail = node;
   }
 
-  // Rotate the queue
-  list_remove(running_list, next->list_node, 0);
-  next->list_node->prev = running_list->tail;
-  next->list_node->next = NULL;
-  if (running_list->tail)
-    running_list->tail->next = next->list_node;
-  running_list->tail = next->list_node;
-  if (running_list->head == NULL)
-    running_list->head = next->list_node;
-  running_list->size++;
+  if (next->time_slice == 0)
+    next->time_slice = TIME_SLICES[next->priority] * NS_PER_MS;
+  if (next != rq->current)
+    ++next->switch_count;
+  next->run_start = now;
+  arm_timer(next, now);
 
   if (next->in_kernel) {
     process_resume(next);
@@ -151,91 +360,333 @@ uint32_t process_switch_next()
 static void gp_fault_handler(cpu_state_t cs, idt_info_t info, stack_state_t ss)
 {
   log_error("process", "eip %x: gpf %x cs %x\n", ss.eip, info.error_code, ss.cs);
-  current_process->next_signal = SIGILL;
-  process_kill(current_process);
+  process_t *current = process_current();
+  current->next_signal = SIGILL;
+  process_kill(current);
   process_switch_next();
 }
 
+// Find a process that uses an address space. The kernel sometimes
+// switches to the address space of a process other than the current one.
+static process_t *process_with_cr3(uint32_t cr3)
+{
+  process_t *current = process_current();
+  if (current && current->cr3 == cr3)
+    return current;
+  for (uint32_t i = 0; i < MAX_PROCESS_COUNT; ++i)
+    if (pids[i].process && pids[i].process->cr3 == cr3)
+      return pids[i].process;
+  return NULL;
+}
+
+// Load the page of a process image that contains `vaddr` into the
+// current address space. Returns 1 if the address is not part of the
+// image. The page is read into a buffer and only mapped into user space
+// once it is complete, since reading the file may sleep and let other
+// threads of the process run.
+static uint32_t load_image_page(process_image_t *img, uint32_t vaddr)
+{
+  uint32_t page_vaddr = u_page_align_down(vaddr);
+  uint32_t page_end = page_vaddr + PAGE_SIZE;
+  uint8_t found = 0;
+  page_table_entry_t flags;
+  u_memset(&flags, 0, sizeof(flags));
+  flags.user = 1;
+  for (uint32_t i = 0; i < img->segment_count; ++i) {
+    process_segment_t *segment = img->segments + i;
+    if (page_vaddr >= segment->vaddr + segment->mem_len || page_end <= segment->vaddr)
+      continue;
+    found = 1;
+    flags.rw |= segment->writable;
+  }
+  if (found == 0)
+    return 1;
+
+  // Read-only pages are shared by every process running the executable.
+  if (flags.rw == 0) {
+    flags.text = 1;
+    uint32_t paddr = text_find(&img->node, page_vaddr);
+    if (paddr) {
+      uint32_t eflags = interrupt_save_disable();
+      paging_result_t res = PAGING_OK;
+      if (paging_get_paddr(page_vaddr) == 0)
+        res = paging_map(page_vaddr, paddr, flags);
+      if (res != PAGING_OK || paging_get_paddr(page_vaddr) != paddr)
+        text_release(paddr);
+      interrupt_restore(eflags);
+      CHECK(res != PAGING_OK, "Failed to map shared image page.", res);
+      return 0;
+    }
+  }
+
+  uint32_t paddr = pmm_alloc(1);
+  CHECK(paddr == 0, "No memory.", ENOMEM);
+  uint8_t *page = kheap_alloc_pages(1);
+  if (page == NULL) {
+    pmm_free(paddr, 1);
+    log_error("process", "No memory.\n");
+    return ENOMEM;
+  }
+
+  u_memset(page, 0, PAGE_SIZE);
+  uint32_t err = 0;
+  for (uint32_t i = 0; i < img->segment_count && err == 0; ++i) {
+    process_segment_t *segment = img->segments + i;
+    uint32_t start = page_vaddr > segment->vaddr ? page_vaddr : segment->vaddr;
+    uint32_t file_end = segment->vaddr + segment->file_len;
+    uint32_t end = page_end < file_end ? page_end : file_end;
+    if (start >= end)
+      continue;
+    uint32_t offset = segment->file_offset + (start - segment->vaddr);
+    uint8_t *dst = page + (start - page_vaddr);
+    int32_t rsize = fs_read(&img->node, offset, end - start, dst);
+    if (rsize != (int32_t)(end - start))
+      err = EIO;
+  }
+  if (err == 0 && paging_copy_to_page(paddr, page) != PAGING_OK)
+    err = ENOMEM;
+  kheap_free_pages(page, 1);
+
+  uint32_t eflags = interrupt_save_disable();
+  // Another thread may have loaded the page while we were reading.
+  if (err == 0 && paging_get_paddr(page_vaddr) == 0) {
+    if (flags.text && text_insert(&img->node, page_vaddr, paddr))
+      flags.text = 0;
+    paging_result_t res = paging_map(page_vaddr, paddr, flags);
+    if (res == PAGING_OK)
+      paddr = 0;
+    else
+      err = res;
+    if (res != PAGING_OK && flags.text) {
+      text_release(paddr);
+      paddr = 0;
+    }
+  }
+  interrupt_restore(eflags);
+
+  if (paddr)
+    pmm_free(paddr, 1);
+  CHECK(err, "Failed to load image page.", err);
+  return 0;
+}
+
+// Map a zeroed user stack page.
+static uint32_t map_stack_page(uint32_t vaddr)
+{
+  uint32_t paddr = pmm_alloc(1);
+  CHECK(paddr == 0, "No memory.", ENOMEM);
+  if (paging_zero_page(paddr) != PAGING_OK) {
+    pmm_free(paddr, 1);
+    return ENOMEM;
+  }
+
+  page_table_entry_t flags;
+  u_memset(&flags, 0, sizeof(flags));
+  flags.rw = 1;
+  flags.user = 1;
+  paging_result_t res = paging_map(vaddr, paddr, flags);
+  if (res != PAGING_OK)
+    pmm_free(paddr, 1);
+  return res;
+}
+
+// Grow the stack of a process down to a faulting address. Every page
+// between the address and the current bottom of the stack is mapped so
+// that the stack stays contiguous. Returns 1 if the address is not in
+// the part of the stack region that the stack can grow into.
+static uint32_t grow_stack(process_t *process, uint32_t vaddr)
+{
+  uint32_t limit = process->mmap.stack_guard + PAGE_SIZE;
+  if (vaddr < limit || vaddr >= process->mmap.stack_bottom)
+    return 1;
+
+  uint32_t bottom = u_page_align_down(vaddr);
+  while (process->mmap.stack_bottom > bottom) {
+    uint32_t va = process->mmap.stack_bottom - PAGE_SIZE;
+    uint32_t err = map_stack_page(va);
+    if (err)
+      return err;
+    process->mmap.stack_bottom = va;
+  }
+  return 0;
+}
+
+uint8_t process_user_writable(process_t *process, uint32_t vaddr)
+{
+  uint32_t eflags = interrupt_save_disable();
+  uint8_t writable = 0;
+
+  // This follows page_fault_handler: regions take precedence, then
+  // pages that are present or swapped out, then the image and stack.
+  vma_t *vma = vma_find(process_group_leader(process)->vmas, vaddr);
+  page_table_entry_t *pte = paging_get_pte(vaddr);
+  if (vma)
+    writable = (vma->prot & PROT_WRITE) != 0;
+  else if (pte && (pte->present || pte->swapped))
+    writable = pte->rw || pte->cow;
+  else {
+    uint32_t page_vaddr = u_page_align_down(vaddr);
+    process_image_t *img = &process->image;
+    for (uint32_t i = 0; i < img->segment_count; ++i) {
+      process_segment_t *segment = img->segments + i;
+      if (page_vaddr < segment->vaddr + segment->mem_len &&
+          page_vaddr + PAGE_SIZE > segment->vaddr && segment->writable)
+        writable = 1;
+    }
+    if (vaddr >= process->mmap.stack_guard + PAGE_SIZE && vaddr < process->mmap.stack_bottom)
+      writable = 1;
+  }
+
+  interrupt_restore(eflags);
+  return writable;
+}
+
 // Page fault handler.
 static void page_fault_handler(cpu_state_t cs, idt_info_t info, stack_state_t ss)
 {
   uint32_t vaddr;
   asm("movl %%cr2, %0" : "=r"(vaddr));
+
+  process_t *current = process_current();
+  process_t *process = process_with_cr3(paging_get_cr3());
+
+  // Pages of mapped regions are loaded on the first access. Regions
+  // take precedence over the process image, which they may replace.
+  // Pages that have been swapped out are read back first.
+  if (process && vaddr < KERNEL_START_VADDR) {
+    swap_reclaim();
+    uint32_t res = swap_fault(vaddr);
+    if (res == 0)
+      return;
+    if (res != 1)
+      goto die;
+
+    uint8_t write = (info.error_code & PAGE_FAULT_WRITE) != 0;
+    res = vma_fault(&process_group_leader(process)->vmas, vaddr, write);
+    if (res == 0)
+      return;
+    if (res == EACCES)
+      goto segv;
+    if (res != 1)
+      goto die;
+  }
+
+  // Writes to copy-on-write pages fault in both user and kernel mode
+  // since write protection is enabled in cr0.
+  if ((info.error_code & PAGE_FAULT_PRESENT) && (info.error_code & PAGE_FAULT_WRITE) &&
+      vaddr < KERNEL_START_VADDR) {
+    paging_result_t res = paging_copy_on_write(vaddr);
+    if (res == PAGING_OK)
+      return;
+    if (res == PAGING_NO_MEMORY)
+      goto die;
+  }
+
+  // Pages of the process image are loaded on the first access, which
+  // may also happen in kernel mode, e.g when a syscall writes to a
+  // buffer in the BSS.
+  if ((info.error_code & PAGE_FAULT_PRESENT) == 0 && vaddr < KERNEL_START_VADDR) {
+    uint32_t res = process ? load_image_page(&process->image, vaddr) : 1;
+    if (res == 0)
+      return;
+    if (res != 1)
+      goto die;
+  }
+
+  // Stacks grow on the first access below their bottom, which may
+  // also happen in kernel mode when a syscall writes to a buffer on the
+  // stack. Faults in the guard page below the stack fall through.
+  if (process && (info.error_code & PAGE_FAULT_PRESENT) == 0 && vaddr < KERNEL_START_VADDR &&
+      current->cr3 == process->cr3) {
+    uint32_t res = grow_stack(current, vaddr);
+    if (res == 0)
+      return;
+    if (res != 1)
+      goto die;
+  }
+
+segv:
   log_error("process",
             "eip %x: page fault %x vaddr %x esp %x pid %u\n",
             ss.eip,
             info.error_code,
             vaddr,
             ss.user_esp,
-            current_process->pid);
+            current->pid);
 
   if (ss.cs == (USER_MODE_CS | 3)) {
-    uint32_t stb = current_process->mmap.stack_bottom;
-    if (vaddr < stb && stb - vaddr < PAGE_SIZE) {
-      uint32_t paddr = pmm_alloc(1);
-      if (paddr == 0)
-        goto die;
-      uint32_t vaddr = stb - PAGE_SIZE;
-      page_table_entry_t flags;
-      u_memset(&flags, 0, sizeof(flags));
-      flags.rw = 1;
-      flags.user = 1;
-      paging_result_t res = paging_map(vaddr, paddr, flags);
-      if (res != PAGING_OK)
-        goto die;
-      current_process->mmap.stack_bottom = vaddr;
-      log_info("process", "grew the stack to %x for process %u\n", vaddr, current_process->pid);
-      return;
-    }
-
-    current_process->next_signal = SIGSEGV;
+    current->next_signal = SIGSEGV;
     process_switch_next();
     return;
   }
 
   // Yikes, kernel page fault.
 die:
-  current_process->next_signal = SIGSEGV;
-  process_kill(current_process);
+  current->next_signal = SIGSEGV;
+  process_kill(current);
   process_switch_next();
 }
 
-// Interrupt handler that switches processes.
+// Interrupt handler that switches processes. Runs on timer interrupts
+// and when another CPU has queued a process on this one.
 static void scheduler_interrupt_handler(cpu_state_t cstate, idt_info_t info, stack_state_t sstate)
 {
   uint32_t eflags = interrupt_save_disable();
+  runqueue_t *rq = this_runqueue();
+  process_t *current = rq->current;
 
-  if (current_process)
+  uint64_t now = clock_get_time_ns();
+  uint8_t expired = 1;
+  if (current) {
     update_current_process_registers(cstate, sstate);
+    expired = charge(current, now);
+  }
 
-  uint64_t current_time = pit_get_time();
-  while (sleep_queue.size && current_time >= heap_peek(&sleep_queue)->key) {
+  while (sleep_queue.size && now >= heap_peek(&sleep_queue)->key) {
     uint32_t pid = (uint32_t)heap_pop(&sleep_queue).value;
     if (pids[pid].process)
       process_schedule(pids[pid].process);
   }
 
-  process_switch_next();
+  // Keep running the current process unless its slice is used up, it
+  // is no longer runnable or is being killed, or a process of higher
+  // priority is runnable.
+  if (expired || current->list_node == NULL || current->kill_pending ||
+      (rq->running_bitmap >> (current->priority + 1))) {
+    process_switch_next();
+  }
+  arm_timer(current, now);
   interrupt_restore(eflags);
 }
 
 // Initialize the scheduler and other things.
 uint32_t process_init()
 {
-  for (uint32_t i = 0; i <= MAX_PROCESS_PRIORITY; ++i)
-    u_memset(&running_lists[i], 0, sizeof(list_t));
+  for (uint32_t cpu = 0; cpu < MAX_CPU_COUNT; ++cpu)
+    for (uint32_t i = 0; i <= MAX_PROCESS_PRIORITY; ++i)
+      u_memset(&runqueues[cpu].running_lists[i], 0, sizeof(list_t));
 
   u_memset(&sleep_queue, 0, sizeof(heap_t));
   u_memset(pids, 0, sizeof(pids));
   u_memset(&kernel_stack_pages, 0, sizeof(list_t));
 
   pit_set_handler(scheduler_interrupt_handler);
+  register_interrupt_handler(LAPIC_TIMER_VECTOR, scheduler_interrupt_handler);
+  register_interrupt_handler(SMP_RESCHEDULE_VECTOR, scheduler_interrupt_handler);
+  register_interrupt_handler(7, fpu_trap_handler);
   register_interrupt_handler(13, gp_fault_handler);
   register_interrupt_handler(14, page_fault_handler);
 
   return 0;
 }
 
+// Start scheduling processes on an application processor.
+void process_start_cpu()
+{
+  disable_interrupts();
+  enter_idle();
+}
+
 // Add a process to the sleep queue.
 uint32_t process_sleep(process_t *p, uint64_t wake_time)
 {
@@ -255,8 +706,9 @@ uint8_t process_wait_pid(process_t *p, uint32_t pid)
     kunlock(&pids[pid].lock);
     return 1;
   }
-  list_push_back(&pids[pid].waiters, (void *)p->pid);
+  wait_prepare(&pids[pid].waiters, p);
   kunlock(&pids[pid].lock);
+  wait_sleep(p);
   return 0;
 }
 
@@ -282,7 +734,33 @@ uint8_t process_signal_pid(uint32_t pid, uint32_t signum)
 // Get current process.
 process_t *process_current()
 {
-  return current_process;
+  return runqueues[smp_cpu_id()].current;
+}
+
+// Get the main thread of a process.
+process_t *process_from_pid(uint32_t pid)
+{
+  return pid < MAX_PROCESS_COUNT ? pids[pid].process : NULL;
+}
+
+process_t *process_group_leader(process_t *p)
+{
+  process_t *leader = p->gid < MAX_PROCESS_COUNT ? pids[p->gid].process : NULL;
+  return leader ? leader : p;
+}
+
+// Allocate process and file descriptor structs.
+process_t *process_alloc()
+{
+  return kmem_cache_alloc(&process_cache);
+}
+process_fd_t *process_fd_alloc()
+{
+  return kmem_cache_alloc(&process_fd_cache);
+}
+void process_fd_free(process_fd_t *fd)
+{
+  kmem_cache_free(&process_fd_cache, fd);
 }
 
 #define CHECK_RESTORE_EFLAGS(err, msg, code)                                                       \
@@ -300,7 +778,7 @@ uint32_t kernel_stack_page_alloc()
     list_node_t *head = kernel_stack_pages.head;
     list_remove(&kernel_stack_pages, head, 0);
     uint32_t addr = (uint32_t)head->value;
-    kfree(head);
+    list_free_node(head);
     interrupt_restore(eflags);
     return addr;
   }
@@ -327,15 +805,17 @@ void kernel_stack_page_free(uint32_t addr)
 }
 
 // Create the `init` process.
-uint32_t process_create_schedule_init(process_image_t img)
+uint32_t process_create_schedule_init(process_image_t *img)
 {
-  process_t *init = kmalloc(sizeof(process_t));
+  process_t *init = process_alloc();
   CHECK(init == NULL, "No memory.", ENOMEM);
   pids[0].process = init;
   u_memset(init, 0, sizeof(process_t));
+  init->fpu_cpu = FPU_NO_CPU;
   init->wd = kmalloc(2);
   CHECK(init->wd == NULL, "No memory.", ENOMEM);
   u_memcpy(init->wd, "/", u_strlen("/") + 1);
+  init->stack_size = PROCESS_STACK_DEFAULT_SIZE;
 
   page_directory_t kernel_pd;
   uint32_t kernel_cr3;
@@ -364,7 +844,7 @@ static uint32_t alloc_pid()
 {
   for (uint32_t i = 0; i < MAX_PROCESS_COUNT; ++i) {
     klock(&pids[i].lock);
-    if (pids[i].process || pids[i].waiters.size) {
+    if (pids[i].process || pids[i].waiters.processes.size) {
       kunlock(&pids[i].lock);
       continue;
     }
@@ -382,9 +862,34 @@ static uint32_t alloc_pid()
     return (code);                                                                                 \
   }
 
+// Reserve a stack region that ends at or below `top` in the current
+// address space and map its highest page. The region holds the stack
+// size of the process and a guard page below it. Stacks are reserved
+// downwards from the top of the address space, and mapped regions
+// upwards from the heap, so threads can have stacks until the two meet.
+static uint32_t stack_alloc(process_t *process, uint32_t top)
+{
+  uint32_t npages = (process->stack_size >> PAGE_SIZE_SHIFT) + 1;
+  uint32_t guard = paging_prev_vaddr(npages, top);
+  CHECK(guard == 0, "No space for stack.", ENOMEM);
+
+  uint32_t vaddr = guard + ((npages - 1) << PAGE_SIZE_SHIFT);
+  uint32_t err = map_stack_page(vaddr);
+  if (err) {
+    paging_release_vaddr(guard, npages);
+    return err;
+  }
+
+  process->mmap.stack_guard = guard;
+  process->mmap.stack_bottom = vaddr;
+  process->mmap.stack_top = vaddr + PAGE_SIZE - 4;
+  return 0;
+}
+
 // Fork a process.
 uint32_t process_fork(process_t *child, process_t *process, uint8_t is_thread)
 {
+  fpu_flush(process);
   u_memcpy(child, process, sizeof(process_t));
   kunlock(&child->fd_lock);
   child->in_kernel = 0;
@@ -396,11 +901,21 @@ uint32_t process_fork(process_t *child, process_t *process, uint8_t is_thread)
   CHECK(child->pid == 0, "Too many processes.", ENOMEM);
   pids[child->pid].process = child;
   pids[child->pid].parent_pid = process->pid;
-  u_memset(&pids[child->pid].waiters, 0, sizeof(list_t));
+  u_memset(&pids[child->pid].waiters, 0, sizeof(wait_queue_t));
   kunlock(&pids[child->pid].lock);
   child->gid = child->pid;
   child->list_node = NULL;
   child->has_ui = 0;
+  child->vmas = NULL;
+  child->time_slice = 0;
+  child->cpu_time = 0;
+  child->slice_count = 0;
+  child->switch_count = 0;
+  child->running = 0;
+  child->kill_pending = 0;
+  child->futex_node = NULL;
+  child->fpu_cpu = FPU_NO_CPU;
+  child->wait_queue = NULL;
 
   if (is_thread) {
     child->gid = process->gid;
@@ -408,27 +923,17 @@ uint32_t process_fork(process_t *child, process_t *process, uint8_t is_thread)
     uint32_t cr3 = paging_get_cr3();
     paging_set_cr3(process->cr3);
 
-    uint32_t stack_vaddr = paging_prev_vaddr(1, process->mmap.text);
-    CHECK_RESTORE_EFLAGS_CR3(
-      stack_vaddr == 0, "Failed to allocate thread stack virtual page.", ENOMEM);
-    uint32_t stack_paddr = pmm_alloc(1);
-    CHECK_RESTORE_EFLAGS_CR3(
-      stack_paddr == 0, "Failed to allocate thread stack physical page.", ENOMEM);
-
-    page_table_entry_t flags;
-    u_memset(&flags, 0, sizeof(flags));
-    flags.rw = 1;
-    flags.user = 1;
-    paging_result_t res = paging_map(stack_vaddr, stack_paddr, flags);
-    CHECK_RESTORE_EFLAGS_CR3(res != PAGING_OK, "Failed to map thread stack page.", res);
-
-    child->mmap.stack_top = stack_vaddr + PAGE_SIZE - 4;
-    child->mmap.stack_bottom = stack_vaddr;
+    uint32_t err = stack_alloc(child, ENV_VADDR);
+    CHECK_RESTORE_EFLAGS_CR3(err, "Failed to allocate thread stack.", err);
 
     paging_set_cr3(cr3);
     interrupt_restore(eflags);
   } else {
-    uint32_t err = paging_clone_process_directory(&(child->cr3), process->cr3);
+    // `process` is the current process, so its address space is the
+    // current one.
+    uint32_t err = vma_clone(&child->vmas, &process_group_leader(process)->vmas);
+    CHECK(err, "Failed to copy mapped regions.", err);
+    err = paging_clone_process_directory(&(child->cr3), process->cr3);
     CHECK(err, "Failed to clone page directory.", err);
   }
 
@@ -444,87 +949,103 @@ uint32_t process_fork(process_t *child, process_t *process, uint8_t is_thread)
 }
 
 // Overwrite a process image.
-uint32_t process_load(process_t *process, process_image_t img)
+uint32_t process_load(process_t *process, process_image_t *img)
 {
-  CHECK(img.text_len == 0, "No text.", 1);
+  CHECK(img->segment_count == 0, "No segments.", 1);
 
   uint32_t eflags = interrupt_save_disable();
   uint32_t cr3 = paging_get_cr3();
 
   paging_set_cr3(process->cr3);
+  vma_clear(&process_group_leader(process)->vmas);
   uint32_t err = paging_clear_user_space();
   CHECK_RESTORE_EFLAGS_CR3(err, "Failed to clear user address space.", err);
 
-  uint32_t npages =
-    (u_page_align_up(img.text_vaddr + img.text_len) - u_page_align_down(img.text_vaddr)) >>
-    PAGE_SIZE_SHIFT;
-  page_table_entry_t flags;
-  u_memset(&flags, 0, sizeof(flags));
-  flags.user = 1;
-  flags.rw = 1;
-  for (uint32_t i = 0; i < npages; ++i) {
-    uint32_t paddr = pmm_alloc(1);
-    CHECK_RESTORE_EFLAGS_CR3(paddr == 0, "No memory.", ENOMEM);
-    paging_result_t res =
-      paging_map((uint32_t)img.text_vaddr + (i << PAGE_SIZE_SHIFT), paddr, flags);
-    CHECK_RESTORE_EFLAGS_CR3(res != PAGING_OK, "Failed to map text pages.", res);
+  // Segments are not mapped here; their pages are loaded by
+  // load_image_page when they are first accessed. Until then they are
+  // reserved so that other allocations stay out of their way.
+  for (uint32_t i = 0; i < img->segment_count; ++i) {
+    process_segment_t *segment = img->segments + i;
+    uint32_t start = u_page_align_down(segment->vaddr);
+    uint32_t end = u_page_align_up(segment->vaddr + segment->mem_len);
+    paging_reserve_vaddr(start, (end - start) >> PAGE_SIZE_SHIFT);
   }
 
-  u_memcpy((uint8_t *)img.text_vaddr, img.text, img.text_len);
-
-  npages = (u_page_align_up(img.data_vaddr + img.data_len) - u_page_align_down(img.data_vaddr)) >>
-           PAGE_SIZE_SHIFT;
-  for (uint32_t i = 0; i < npages; ++i) {
-    uint32_t paddr = pmm_alloc(1);
-    CHECK_RESTORE_EFLAGS_CR3(paddr == 0, "No memory.", ENOMEM);
-    paging_result_t res =
-      paging_map((uint32_t)img.data_vaddr + (i << PAGE_SIZE_SHIFT), paddr, flags);
-    CHECK_RESTORE_EFLAGS_CR3(res != PAGING_OK, "Failed to map data pages.", res);
+  if (img != &process->image)
+    u_memcpy(&process->image, img, sizeof(process_image_t));
+  process->mmap.text = KERNEL_START_VADDR;
+  process->mmap.data = 0;
+  process->mmap.heap = 0;
+  for (uint32_t i = 0; i < img->segment_count; ++i) {
+    process_segment_t *segment = img->segments + i;
+    if (segment->vaddr < process->mmap.text)
+      process->mmap.text = segment->vaddr;
+    if (segment->writable && process->mmap.data == 0)
+      process->mmap.data = segment->vaddr;
+    uint32_t end = u_page_align_up(segment->vaddr + segment->mem_len);
+    if (end > process->mmap.heap)
+      process->mmap.heap = end;
   }
+  process->mmap.brk = process->mmap.heap;
+  paging_reserve_vaddr(process->mmap.heap, PROCESS_HEAP_MAX_SIZE >> PAGE_SIZE_SHIFT);
 
-  u_memcpy((uint8_t *)img.data_vaddr, img.data, img.data_len);
+  page_table_entry_t flags;
+  u_memset(&flags, 0, sizeof(flags));
+  flags.user = 1;
+  flags.rw = 1;
 
-  uint32_t stack_paddr = pmm_alloc(1);
-  CHECK_RESTORE_EFLAGS_CR3(stack_paddr == 0, "No memory.", ENOMEM);
   // Leave one page between the stack and the kernel for environment variables.
-  uint32_t stack_vaddr = paging_prev_vaddr(1, KERNEL_START_VADDR - PAGE_SIZE);
-  CHECK_RESTORE_EFLAGS_CR3(stack_vaddr == 0, "No memory.", ENOMEM);
-  paging_result_t res = paging_map(stack_vaddr, stack_paddr, flags);
-  CHECK_RESTORE_EFLAGS_CR3(res != PAGING_OK, "Failed to map stack pages.", res);
+  err = stack_alloc(process, ENV_VADDR);
+  CHECK_RESTORE_EFLAGS_CR3(err, "Failed to allocate stack.", err);
 
   uint32_t env_paddr = pmm_alloc(1);
   CHECK_RESTORE_EFLAGS_CR3(env_paddr == 0, "No memory.", ENOMEM);
-  flags.user = 1;
-  flags.rw = 1;
-  res = paging_map(ENV_VADDR, env_paddr, flags);
+  CHECK_RESTORE_EFLAGS_CR3(paging_zero_page(env_paddr), "Failed to zero env page.", ENOMEM);
+  paging_result_t res = paging_map(ENV_VADDR, env_paddr, flags);
   CHECK_RESTORE_EFLAGS_CR3(res != PAGING_OK, "Failed to map env page.", res);
 
   paging_set_cr3(cr3);
 
-  process->mmap.text = img.text_vaddr;
-  process->mmap.stack_bottom = stack_vaddr;
-  process->mmap.stack_top = stack_vaddr + PAGE_SIZE - 4;
-  process->mmap.data = img.data_vaddr;
-  process->mmap.heap = img.data_vaddr + u_page_align_up(img.data_len);
-  if (process->mmap.heap == 0)
-    process->mmap.heap = img.text_vaddr + u_page_align_up(img.text_len);
-  process->uregs.eip = img.entry;
+  process->uregs.eip = img->entry;
   process->uregs.esp = process->mmap.stack_top;
 
   interrupt_restore(eflags);
   return 0;
 }
 
+// A CPU is idle if it runs no process and has none to run.
+static inline uint8_t cpu_idle(uint32_t cpu)
+{
+  return runqueues[cpu].current == NULL && runqueues[cpu].running_bitmap == 0;
+}
+
+// Pick the CPU whose queue a process joins: the CPU that ran it last,
+// unless that one is busy and another is idle.
+static uint32_t select_cpu(process_t *process)
+{
+  if (process->running || cpu_idle(process->cpu))
+    return process->cpu;
+  for (uint32_t cpu = 0; cpu < smp_cpu_count(); ++cpu)
+    if (cpu_idle(cpu))
+      return cpu;
+  return process->cpu;
+}
+
 // Add a process to the scheduler queue.
 void process_schedule(process_t *process)
 {
   uint32_t eflags = interrupt_save_disable();
-  if (process->list_node) {
+  if (process->list_node || process->kill_pending) {
     interrupt_restore(eflags);
     return;
   }
-  list_push_front(&running_lists[process->priority], process);
-  process->list_node = running_lists[process->priority].head;
+  uint32_t cpu = select_cpu(process);
+  enqueue(process, cpu);
+
+  // Interrupt the CPU if it is idle or runs a process of lower priority.
+  process_t *running = runqueues[cpu].current;
+  if (running == NULL || running->priority < process->priority)
+    smp_send_reschedule(cpu);
   interrupt_restore(eflags);
 }
 
@@ -536,17 +1057,65 @@ void process_unschedule(process_t *process)
     interrupt_restore(eflags);
     return;
   }
-  list_remove(&running_lists[process->priority], process->list_node, 0);
-  kfree(process->list_node);
+  runqueue_t *rq = &runqueues[process->cpu];
+  list_remove(&rq->running_lists[process->priority], process->list_node, 0);
+  list_free_node(process->list_node);
   process->list_node = NULL;
+  if (rq->running_lists[process->priority].size == 0)
+    rq->running_bitmap &= ~(1 << process->priority);
+  interrupt_restore(eflags);
+}
+
+// Change the priority of a process. Its time slice starts over with the
+// length of the new priority.
+void process_set_priority(process_t *process, uint8_t priority)
+{
+  uint32_t eflags = interrupt_save_disable();
+  uint8_t scheduled = process->list_node != NULL;
+  process_unschedule(process);
+  process->priority = priority;
+  process->time_slice = TIME_SLICES[priority] * NS_PER_MS;
+  if (scheduled)
+    process_schedule(process);
   interrupt_restore(eflags);
 }
 
+// Get the scheduling statistics of a process.
+void process_get_sched_info(process_t *process, schedinfo_t *info)
+{
+  info->priority = process->priority;
+  info->slice_length = TIME_SLICES[process->priority];
+  info->slice_left = process->time_slice / NS_PER_MS;
+  info->cpu_time = u_div64(process->cpu_time, NS_PER_MS, NULL);
+  info->slice_count = process->slice_count;
+  info->switch_count = process->switch_count;
+}
+
 // Kill a process.
 void process_kill(process_t *process)
 {
   if (process == NULL || process == init_process)
     return;
+
+  // A process that another CPU runs is stopped there before its kernel
+  // stack and address space are freed.
+  uint32_t pid = process->pid;
+  while (process->running && process->cpu != smp_cpu_id()) {
+    process->kill_pending = 1;
+    smp_send_reschedule(process->cpu);
+    smp_yield_kernel();
+    // Another CPU may have killed it meanwhile.
+    if (pids[pid].process != process)
+      return;
+  }
+
+  // Stop waiting and release mutexes first, since cleaning up may need them.
+  futex_cancel(process);
+  wait_cancel(process);
+  kmutex_release_all(process);
+  fpu_forget(process);
+
+  process_t *current = process_current();
   if (process->has_ui)
     ui_kill(process);
 
@@ -561,24 +1130,20 @@ void process_kill(process_t *process)
     fd->refcount--;
     if (fd->refcount == 0) {
       fs_close(&(fd->node));
-      kfree(fd);
+      process_fd_free(fd);
     }
   }
 
   // Wake all processes waiting for this one to die
   pids[process->pid].process = NULL;
-  while (pids[process->pid].waiters.size) {
-    list_node_t *head = pids[process->pid].waiters.head;
-    uint32_t waiter_pid = (uint32_t)head->value;
-    if (pids[waiter_pid].process) {
-      pids[waiter_pid].process->uregs.eax = (process->exited & 1) |
-                                            ((process->exit_status & 0x7fff) << 1) |
-                                            ((process->next_signal & 0xFFFF) << 16);
-      process_schedule(pids[waiter_pid].process);
-    }
-    list_remove(&pids[process->pid].waiters, head, 0);
-    kfree(head);
+  uint32_t status = (process->exited & 1) | ((process->exit_status & 0x7fff) << 1) |
+                    ((process->next_signal & 0xFFFF) << 16);
+  list_foreach(node, &pids[process->pid].waiters.processes)
+  {
+    process_t *waiter = node->value;
+    waiter->uregs.eax = status;
   }
+  wait_wake_all(&pids[process->pid].waiters);
 
   // Re-parent child processes and kill child threads
   for (uint32_t i = 0; i < MAX_PROCESS_COUNT; ++i) {
@@ -594,6 +1159,7 @@ void process_kill(process_t *process)
   paging_set_cr3(process->cr3);
 
   if (process->is_thread == 0) {
+    vma_clear(&process->vmas);
     uint8_t res = paging_clear_user_space();
     if (res) {
       log_error("process", "Failed to clear user address space.\n");
@@ -608,6 +1174,8 @@ void process_kill(process_t *process)
         pmm_free(pa, 1);
       paging_unmap(va);
     }
+    uint32_t guard = process->mmap.stack_guard;
+    paging_release_vaddr(guard, (process->mmap.stack_bottom - guard) >> PAGE_SIZE_SHIFT);
   }
 
   paging_set_cr3(cr3);
@@ -618,21 +1186,21 @@ void process_kill(process_t *process)
   if (!process->is_thread) {
     // Switch to init process memory space if we are about
     // to free the current page directory.
-    if (process == current_process) {
-      paging_copy_kernel_space(init_process->cr3);
+    if (process == current)
       paging_set_cr3(init_process->cr3);
-    }
-    pmm_free(process->cr3, 1);
+    paging_free_process_directory(process->cr3);
   }
 
   process_unschedule(process);
   kfree(process->wd);
-  kfree(process);
+  kmem_cache_free(&process_cache, process);
 
   // If we just killed the current process, switch to the next process
-  // instead of restoring interrupt state.
-  if (process == current_process)
+  // instead of restoring interrupt state. The scheduler must not charge
+  // time to the freed process.
+  if (process == current) {
+    this_runqueue()->current = NULL;
     process_switch_next();
-  else
+  } else
     interrupt_restore(eflags);
 }
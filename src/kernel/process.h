@@ -8,16 +8,28 @@
 #ifndef _PROCESS_H_
 #define _PROCESS_H_
 
+#include "../common/proc.h"
+#include "../common/schedinfo.h"
 #include "../common/stdint.h"
 #include "ds.h"
 #include "fs.h"
 #include "interrupt.h"
+#include "vma.h"
+#include "wait.h"
 
-#define MAX_PROCESS_COUNT 64
 #define MAX_PROCESS_PRIORITY 2
 #define MAX_PROCESS_FDS 16
 #define PROCESS_ENV_VADDR (KERNEL_START_VADDR - PAGE_SIZE)
 
+// Size of the range of addresses above the process image that is kept
+// free for the heap, which grows with brk.
+#define PROCESS_HEAP_MAX_SIZE 0x20000000
+
+// Default and largest size that the stack of a process or thread can
+// grow to. Stacks start with one page and grow on demand.
+#define PROCESS_STACK_DEFAULT_SIZE 0x800000
+#define PROCESS_STACK_MAX_SIZE 0x10000000
+
 // Registers struct to save the state of a process.
 // The order of fields is important -- see process.s.
 struct process_registers_s
@@ -42,23 +54,36 @@ typedef struct process_mmap_s
 {
   uint32_t text;
   uint32_t data;
-  uint32_t heap;
+  uint32_t heap; // Start of the heap.
+  uint32_t brk;  // End of the heap.
   uint32_t stack_top;
-  uint32_t stack_bottom;
+  uint32_t stack_bottom; // Lowest mapped page of the stack.
+  uint32_t stack_guard;  // Unmapped page below the lowest the stack can grow to.
   uint32_t kernel_stack_top;
   uint32_t kernel_stack_bottom;
 } process_mmap_t;
 
+#define PROCESS_MAX_SEGMENTS 4
+
+// A loadable segment of an executable. Pages of the segment are read
+// from the executable file when they are first accessed, and the part
+// of the segment past the end of the file data is zero-filled.
+typedef struct process_segment_s
+{
+  uint32_t vaddr;
+  uint32_t mem_len;
+  uint32_t file_offset;
+  uint32_t file_len;
+  uint8_t writable;
+} process_segment_t;
+
 // Process image structs used to load binaries.
 typedef struct process_image_s
 {
   uint32_t entry;
-  uint8_t *text;
-  uint32_t text_len;
-  uint32_t text_vaddr;
-  uint8_t *data;
-  uint32_t data_len;
-  uint32_t data_vaddr;
+  fs_node_t node; // The executable file.
+  process_segment_t segments[PROCESS_MAX_SEGMENTS];
+  uint32_t segment_count;
 } process_image_t;
 
 // File descriptor.
@@ -82,14 +107,27 @@ typedef struct process_s
   volatile uint32_t fd_lock;
 
   uint8_t priority;
+  uint32_t time_slice;   // Nanoseconds left in the current time slice.
+  uint64_t cpu_time;     // Nanoseconds spent running.
+  uint64_t run_start;    // When time was last charged to the process.
+  uint32_t slice_count;  // Time slices used up.
+  uint32_t switch_count; // Times switched to.
+
+  uint8_t cpu;                   // CPU whose queue the process is in or that runs it.
+  volatile uint8_t running;      // Is `cpu` running it or still using its kernel stack?
+  volatile uint8_t kill_pending; // Waited for by another CPU that is killing it?
   uint8_t in_kernel;
   process_registers_t uregs;
   process_registers_t kregs;
   uint8_t fpregs[512];
+  uint8_t fpu_cpu; // CPU whose FPU may still hold `fpregs`. See fpu.c.
   uint32_t thread_start;
+  uint32_t stack_size; // Size limit of stacks made for new threads and images.
 
   uint32_t cr3;
   process_mmap_t mmap;
+  process_image_t image;
+  vma_t *vmas; // Mapped regions. Only used by the main thread of each address space.
 
   uint32_t next_signal;
   uint32_t current_signal;
@@ -100,6 +138,11 @@ typedef struct process_s
 
   uint8_t has_ui;
 
+  list_node_t *futex_node; // Node in the list of futex waiters, or NULL.
+  uint32_t futex_paddr;    // Physical address of the word the process waits on.
+  wait_queue_t *wait_queue; // Queue that the process waits on, or NULL.
+  list_node_t *wait_node;
+
   list_node_t *list_node;
 } process_t;
 
@@ -107,7 +150,7 @@ typedef struct process_s
 typedef struct
 {
   uint32_t parent_pid;
-  list_t waiters; // list of pids
+  wait_queue_t waiters; // Processes in waitpid.
   process_t *process;
   volatile uint32_t lock;
 } process_status_t;
@@ -115,10 +158,12 @@ typedef struct
 // Initialize the scheduler and other things.
 uint32_t process_init();
 
-// Add a process to the sleep queue.
+// Add a process to the sleep queue. Takes the time to wake it up at,
+// in nanoseconds since boot.
 uint32_t process_sleep(process_t *, uint64_t);
 
-// Wait for a process to exit.
+// Wait for a process to exit. Its status is stored in the eax register
+// of the waiting process.
 uint8_t process_wait_pid(process_t *p, uint32_t pid);
 
 // Send a signal to a process.
@@ -127,9 +172,31 @@ uint8_t process_signal_pid(uint32_t pid, uint32_t signum);
 // Get current process.
 process_t *process_current();
 
+// Get the process with a pid, or NULL.
+process_t *process_from_pid(uint32_t pid);
+
+// Get the main thread of a process, which owns its address space.
+process_t *process_group_leader(process_t *);
+
+// Check whether a process can write to an address in its address space,
+// which must be the current one, without being killed by the page fault
+// handler. The write may still fault, e.g to copy a page on write.
+uint8_t process_user_writable(process_t *, uint32_t vaddr);
+
+// Allocate a process struct.
+process_t *process_alloc();
+
+// Allocate and free file descriptors.
+process_fd_t *process_fd_alloc();
+void process_fd_free(process_fd_t *);
+
 // Switch to next scheduled process.
 uint32_t process_switch_next();
 
+// Start scheduling processes on an application processor, which holds
+// the kernel lock. Does not return.
+void process_start_cpu();
+
 // Update registers of current process.
 void update_current_process_registers(cpu_state_t, stack_state_t);
 
@@ -137,10 +204,10 @@ void update_current_process_registers(cpu_state_t, stack_state_t);
 void resume_user();
 
 // Create and schedule the `init` process.
-uint32_t process_create_schedule_init(process_image_t);
+uint32_t process_create_schedule_init(process_image_t *);
 
 // Overwrite process image.
-uint32_t process_load(process_t *, process_image_t);
+uint32_t process_load(process_t *, process_image_t *);
 
 // Fork a process.
 uint32_t process_fork(process_t *, process_t *, uint8_t);
@@ -151,6 +218,13 @@ void process_schedule(process_t *);
 // Remove a process from the scheduler queue.
 void process_unschedule(process_t *);
 
+// Change the priority of a process, which sets both its queue and the
+// length of its time slices.
+void process_set_priority(process_t *, uint8_t);
+
+// Get the scheduling statistics of a process.
+void process_get_sched_info(process_t *, schedinfo_t *);
+
 // Kill a process.
 void process_kill(process_t *);
 
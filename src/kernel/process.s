@@ -7,6 +7,7 @@
 
 global resume_user
 global resume_kernel
+global call_on_stack
 
 section .text
 resume_user:
@@ -59,3 +60,17 @@ resume_kernel:
     mov eax, [eax]
 
     iret
+
+    ; call_on_stack -- Call a function with one argument on another
+    ;                  stack. The function must not return.
+    ; stack: [esp + 12] the argument
+    ;        [esp +  8] the function
+    ;        [esp +  4] the top of the stack
+    ;        [esp     ] return address
+call_on_stack:
+    mov eax, [esp + 12]
+    mov ecx, [esp + 8]
+    mov esp, [esp + 4]
+    push eax
+    call ecx
+    jmp $
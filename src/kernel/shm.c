@@ -0,0 +1,124 @@
+// shm.c
+//
+// Named shared memory segments.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "shm.h"
+#include "../common/errno.h"
+#include "../common/stdint.h"
+#include "constants.h"
+#include "fs.h"
+#include "interrupt.h"
+#include "kheap.h"
+#include "log.h"
+#include "paging.h"
+#include "pmm.h"
+#include "util.h"
+#include <stddef.h>
+
+#define CHECK_RESTORE(err, msg, code)                                                              \
+  if ((err)) {                                                                                     \
+    log_error("shm", msg "\n");                                                                    \
+    interrupt_restore(eflags);                                                                     \
+    return (code);                                                                                 \
+  }
+
+// Segments are kept in a small table. A slot is free when its
+// refcount is 0.
+static shm_segment_t segments[MAX_SHM_SEGMENTS];
+
+static shm_segment_t *find(const char *name)
+{
+  for (uint32_t i = 0; i < MAX_SHM_SEGMENTS; ++i)
+    if (segments[i].refcount && segments[i].linked && u_strcmp(segments[i].name, name) == 0)
+      return segments + i;
+  return NULL;
+}
+
+uint32_t shm_get(shm_segment_t **out, const char *name, uint32_t npages, uint32_t flags)
+{
+  uint32_t name_len = u_strlen(name);
+  if (name_len == 0 || name_len >= SHM_NAME_LEN)
+    return EINVAL;
+
+  uint32_t eflags = interrupt_save_disable();
+  shm_segment_t *shm = find(name);
+  if (shm) {
+    CHECK_RESTORE((flags & O_CREAT) && (flags & O_EXCL), "Segment exists.", EEXIST);
+    ++shm->refcount;
+    *out = shm;
+    interrupt_restore(eflags);
+    return 0;
+  }
+  CHECK_RESTORE((flags & O_CREAT) == 0, "No such segment.", ENOENT);
+  CHECK_RESTORE(npages == 0, "Empty segment.", EINVAL);
+
+  for (uint32_t i = 0; i < MAX_SHM_SEGMENTS && shm == NULL; ++i)
+    if (segments[i].refcount == 0)
+      shm = segments + i;
+  CHECK_RESTORE(shm == NULL, "Too many segments.", ENOMEM);
+  shm->frames = kmalloc(npages * sizeof(uint32_t));
+  CHECK_RESTORE(shm->frames == NULL, "No memory.", ENOMEM);
+  u_memset(shm->frames, 0, npages * sizeof(uint32_t));
+  u_memcpy(shm->name, name, name_len + 1);
+  shm->npages = npages;
+  shm->linked = 1;
+  shm->refcount = 2; // The name and the caller.
+
+  *out = shm;
+  interrupt_restore(eflags);
+  return 0;
+}
+
+uint32_t shm_unlink(const char *name)
+{
+  uint32_t eflags = interrupt_save_disable();
+  shm_segment_t *shm = find(name);
+  CHECK_RESTORE(shm == NULL, "No such segment.", ENOENT);
+  shm->linked = 0;
+  shm_unref(shm);
+  interrupt_restore(eflags);
+  return 0;
+}
+
+void shm_ref(shm_segment_t *shm)
+{
+  uint32_t eflags = interrupt_save_disable();
+  ++shm->refcount;
+  interrupt_restore(eflags);
+}
+
+void shm_unref(shm_segment_t *shm)
+{
+  uint32_t eflags = interrupt_save_disable();
+  --shm->refcount;
+  if (shm->refcount == 0) {
+    for (uint32_t i = 0; i < shm->npages; ++i)
+      if (shm->frames[i])
+        pmm_free(shm->frames[i], 1);
+    kfree(shm->frames);
+    shm->frames = NULL;
+    shm->linked = 0;
+  }
+  interrupt_restore(eflags);
+}
+
+uint32_t shm_frame(shm_segment_t *shm, uint32_t page)
+{
+  if (page >= shm->npages)
+    return 0;
+
+  uint32_t eflags = interrupt_save_disable();
+  if (shm->frames[page] == 0) {
+    uint32_t paddr = pmm_alloc(1);
+    if (paddr && paging_zero_page(paddr) != PAGING_OK) {
+      pmm_free(paddr, 1);
+      paddr = 0;
+    }
+    shm->frames[page] = paddr;
+  }
+  uint32_t paddr = shm->frames[page];
+  interrupt_restore(eflags);
+  return paddr;
+}
@@ -0,0 +1,43 @@
+// shm.h
+//
+// Named shared memory segments.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include "../common/stdint.h"
+
+#define MAX_SHM_SEGMENTS 32
+#define SHM_NAME_LEN 64
+
+// A shared memory segment. Every process that maps the segment maps
+// the same physical pages, which are allocated when they are first used.
+typedef struct shm_segment_s
+{
+  char name[SHM_NAME_LEN];
+  uint32_t npages;
+  uint32_t *frames;  // Physical address of each page, or 0.
+  uint32_t refcount; // Number of mappings, plus one while the segment has a name.
+  uint8_t linked;    // Can the segment be found by name?
+} shm_segment_t;
+
+// Find a segment by name and add a reference to it. If there is no
+// such segment and `flags` has O_CREAT, create one with a number of pages.
+uint32_t shm_get(shm_segment_t **, const char *, uint32_t, uint32_t);
+
+// Remove the name of a segment. The segment is freed once it is no
+// longer mapped.
+uint32_t shm_unlink(const char *);
+
+// Add and drop references to a segment.
+void shm_ref(shm_segment_t *);
+void shm_unref(shm_segment_t *);
+
+// Get the physical address of a page of a segment, allocating a
+// zero-filled page if it has not been used yet. Returns 0 if there is
+// no memory.
+uint32_t shm_frame(shm_segment_t *, uint32_t);
+
+#endif /* _SHM_H_ */
@@ -0,0 +1,199 @@
+// slab.c
+//
+// Object caches for fixed-size kernel objects.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "slab.h"
+#include "../common/stdint.h"
+#include "constants.h"
+#include "interrupt.h"
+#include "kheap.h"
+#include "log.h"
+#include "util.h"
+#include <stddef.h>
+
+// Each slab is a single page: a header followed by equally sized objects.
+// Free objects in a slab form a singly linked list threaded through the
+// objects themselves. The slab that contains an object is found by
+// rounding the object's address down to a page boundary.
+
+// Number of completely free slabs each cache keeps before returning
+// pages to the kernel heap.
+static const uint32_t MAX_EMPTY_SLABS = 1;
+
+typedef struct kmem_slab_s
+{
+  kmem_cache_t *cache;
+  struct kmem_slab_s *next;
+  struct kmem_slab_s *prev;
+  void *free;
+  uint32_t inuse;
+} kmem_slab_t;
+
+static const size_t SLAB_HEADER_SIZE = (sizeof(kmem_slab_t) + 7) & ~7;
+
+static kmem_cache_t cache_cache = KMEM_CACHE_INIT("kmem_cache", sizeof(kmem_cache_t));
+static kmem_cache_t *caches = NULL;
+
+static inline kmem_slab_t *slab_of(void *object)
+{
+  return (kmem_slab_t *)u_page_align_down((uint32_t)object);
+}
+
+// push and remove are the standard operations on the slab lists.
+static void slab_push(kmem_slab_t **list, kmem_slab_t *slab)
+{
+  slab->prev = NULL;
+  slab->next = *list;
+  if (*list)
+    (*list)->prev = slab;
+  *list = slab;
+}
+static void slab_remove(kmem_slab_t **list, kmem_slab_t *slab)
+{
+  if (slab->next)
+    slab->next->prev = slab->prev;
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  slab->next = NULL;
+  slab->prev = NULL;
+}
+
+// Compute the layout of a cache and add it to the list of caches.
+static void cache_setup(kmem_cache_t *cache)
+{
+  size_t size = cache->object_size;
+  if (size < sizeof(void *))
+    size = sizeof(void *);
+  cache->object_size = (size + 7) & ~7;
+  cache->objects_per_slab = (PAGE_SIZE - SLAB_HEADER_SIZE) / cache->object_size;
+  cache->next = caches;
+  caches = cache;
+}
+
+// Allocate and initialize a new slab.
+static kmem_slab_t *slab_create(kmem_cache_t *cache)
+{
+  kmem_slab_t *slab = kheap_alloc_pages(1);
+  if (slab == NULL)
+    return NULL;
+
+  slab->cache = cache;
+  slab->next = NULL;
+  slab->prev = NULL;
+  slab->inuse = 0;
+  slab->free = NULL;
+  ++cache->slab_count;
+  uint8_t *objects = (uint8_t *)slab + SLAB_HEADER_SIZE;
+  for (uint32_t i = cache->objects_per_slab; i > 0; --i) {
+    void **object = (void **)(objects + ((i - 1) * cache->object_size));
+    *object = slab->free;
+    slab->free = object;
+  }
+
+  return slab;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size)
+{
+  if (size == 0 || size > PAGE_SIZE - SLAB_HEADER_SIZE)
+    return NULL;
+
+  kmem_cache_t *cache = kmem_cache_alloc(&cache_cache);
+  if (cache == NULL)
+    return NULL;
+  u_memset(cache, 0, sizeof(kmem_cache_t));
+  cache->name = name;
+  cache->object_size = size;
+
+  return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+  uint32_t eflags = interrupt_save_disable();
+
+  if (cache->objects_per_slab == 0)
+    cache_setup(cache);
+
+  kmem_slab_t *slab = cache->partial;
+  if (slab == NULL) {
+    slab = cache->empty;
+    if (slab) {
+      slab_remove(&cache->empty, slab);
+      --cache->empty_count;
+    } else
+      slab = slab_create(cache);
+
+    if (slab == NULL) {
+      interrupt_restore(eflags);
+      return NULL;
+    }
+    slab_push(&cache->partial, slab);
+  }
+
+  void **object = slab->free;
+  slab->free = *object;
+  ++slab->inuse;
+  ++cache->objects_inuse;
+  if (slab->free == NULL) {
+    slab_remove(&cache->partial, slab);
+    slab_push(&cache->full, slab);
+  }
+
+  interrupt_restore(eflags);
+  return object;
+}
+
+kmem_cache_t *kmem_cache_list()
+{
+  return caches;
+}
+
+kmem_cache_t *kmem_cache_of(void *ptr)
+{
+  return slab_of(ptr)->cache;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  uint32_t eflags = interrupt_save_disable();
+
+  kmem_slab_t *slab = slab_of(ptr);
+  if (slab->cache != cache) {
+    interrupt_restore(eflags);
+    log_error("slab", "Object %x does not belong to cache %s.\n", ptr, cache->name);
+    return;
+  }
+
+  if (slab->free == NULL) {
+    slab_remove(&cache->full, slab);
+    slab_push(&cache->partial, slab);
+  }
+
+  void **object = ptr;
+  *object = slab->free;
+  slab->free = object;
+  --slab->inuse;
+  --cache->objects_inuse;
+
+  if (slab->inuse == 0) {
+    slab_remove(&cache->partial, slab);
+    if (cache->empty_count < MAX_EMPTY_SLABS) {
+      slab_push(&cache->empty, slab);
+      ++cache->empty_count;
+    } else {
+      slab->cache = NULL;
+      --cache->slab_count;
+      kheap_free_pages(slab, 1);
+    }
+  }
+
+  interrupt_restore(eflags);
+}
@@ -0,0 +1,54 @@
+// slab.h
+//
+// Object caches for fixed-size kernel objects.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "../common/stdint.h"
+#include <stddef.h>
+
+struct kmem_slab_s;
+
+// An object cache. Objects are carved out of single-page slabs that
+// are obtained from the kernel heap's page allocator.
+typedef struct kmem_cache_s
+{
+  const char *name;
+  size_t object_size;
+  uint32_t objects_per_slab;
+  struct kmem_slab_s *partial; // Slabs with some free objects.
+  struct kmem_slab_s *full;    // Slabs with no free objects.
+  struct kmem_slab_s *empty;   // Slabs with no allocated objects.
+  uint32_t empty_count;
+  uint32_t slab_count;    // Slabs owned by the cache, including empty ones.
+  uint32_t objects_inuse; // Allocated objects across all slabs.
+  struct kmem_cache_s *next; // Next cache in the list of all caches.
+} kmem_cache_t;
+
+// Statically initialize an object cache.
+#define KMEM_CACHE_INIT(cache_name, size)                                                          \
+  {                                                                                                \
+    .name = (cache_name), .object_size = (size)                                                    \
+  }
+
+// Create an object cache for objects of a given size.
+kmem_cache_t *kmem_cache_create(const char *, size_t);
+
+// Allocate an object. Returns NULL if no memory is available.
+void *kmem_cache_alloc(kmem_cache_t *);
+
+// Free an object.
+void kmem_cache_free(kmem_cache_t *, void *);
+
+// Get the cache that an object was allocated from. Only valid for
+// pointers into pages that were allocated by a cache.
+kmem_cache_t *kmem_cache_of(void *);
+
+// Get the first cache in the list of all caches that have been used.
+// The rest of the list is linked through the `next` field.
+kmem_cache_t *kmem_cache_list();
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,374 @@
+// smp.c
+//
+// Symmetric multiprocessing.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "smp.h"
+#include "../common/errno.h"
+#include "../common/stdint.h"
+#include "clock.h"
+#include "constants.h"
+#include "fpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "interrupt.h"
+#include "kheap.h"
+#include "lapic.h"
+#include "log.h"
+#include "paging.h"
+#include "process.h"
+#include "spinlock.h"
+#include "util.h"
+#include <stddef.h>
+
+#define CHECK(err, msg, code)                                                                      \
+  if ((err)) {                                                                                     \
+    log_error("smp", msg "\n");                                                                    \
+    return (code);                                                                                 \
+  }
+
+// CPUs are found through the MP configuration table, which the BIOS
+// leaves in low memory. The table is located by a "floating pointer"
+// structure in one of a few places.
+typedef struct mp_pointer_s
+{
+  char signature[4]; // "_MP_"
+  uint32_t config_paddr;
+  uint8_t length; // In 16-byte units.
+  uint8_t revision;
+  uint8_t checksum;
+  uint8_t features[5];
+} __attribute__((packed)) mp_pointer_t;
+
+typedef struct mp_config_s
+{
+  char signature[4]; // "PCMP"
+  uint16_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem_id[8];
+  char product_id[12];
+  uint32_t oem_table_paddr;
+  uint16_t oem_table_size;
+  uint16_t entry_count;
+  uint32_t lapic_paddr;
+  uint16_t ext_length;
+  uint8_t ext_checksum;
+  uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+// Processor entries follow the table header. Every other kind of entry
+// is 8 bytes long.
+typedef struct mp_processor_s
+{
+  uint8_t type;
+  uint8_t apic_id;
+  uint8_t apic_version;
+  uint8_t flags;
+  uint32_t signature;
+  uint32_t features;
+  uint32_t reserved[2];
+} __attribute__((packed)) mp_processor_t;
+
+static const uint8_t MP_PROCESSOR = 0;
+static const uint8_t MP_PROCESSOR_ENABLED = 1;
+static const uint32_t MP_ENTRY_SIZE = 8;
+
+// Application processors start in real mode at a page-aligned address
+// below 1MB, to which the trampoline in smp.s is copied. Must match
+// AP_TRAMPOLINE_PADDR in smp.s.
+static const uint32_t TRAMPOLINE_PADDR = 0x8000;
+
+// Delays of the startup sequence in the MP specification.
+static const uint32_t INIT_DELAY_NS = 10000000;
+static const uint32_t STARTUP_DELAY_NS = 200000;
+static const uint32_t ONLINE_TIMEOUT_NS = 100000000;
+
+// Number of pages that a CPU can be asked to invalidate before it
+// flushes its whole TLB instead.
+#define TLB_QUEUE_SIZE 8
+
+typedef struct cpu_s
+{
+  uint8_t apic_id;
+  volatile uint8_t online;
+
+  // Pages to invalidate, added by the CPU that holds the kernel lock.
+  spinlock_t tlb_lock;
+  uint32_t tlb_queue[TLB_QUEUE_SIZE];
+  volatile uint32_t tlb_count;
+  volatile uint8_t tlb_flush_all;
+} cpu_t;
+
+static cpu_t cpus[MAX_CPU_COUNT];
+static uint32_t cpu_count = 1;
+
+// Index of the application processor that is starting.
+static volatile uint32_t starting_cpu = 0;
+
+// Only one CPU runs kernel code at a time, so kernel code that
+// disables interrupts to protect shared state on one CPU stays correct
+// on several. CPUs only wait for the lock while entering the kernel,
+// and run user processes in parallel.
+static spinlock_t kernel_lock = SPINLOCK_INIT;
+static volatile int32_t kernel_lock_owner = -1;
+
+// Implemented in smp.s.
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint32_t ap_trampoline_cr3;
+extern uint32_t ap_trampoline_cr4;
+extern uint32_t ap_trampoline_stack;
+
+static uint8_t checksum(void *p, uint32_t size)
+{
+  uint8_t sum = 0;
+  for (uint32_t i = 0; i < size; ++i)
+    sum += ((uint8_t *)p)[i];
+  return sum;
+}
+
+// Find the MP floating pointer in a range of low memory.
+static mp_pointer_t *mp_search(uint32_t paddr, uint32_t size)
+{
+  for (uint32_t p = paddr; p + sizeof(mp_pointer_t) <= paddr + size; p += 16) {
+    mp_pointer_t *mp = (mp_pointer_t *)(KERNEL_START_VADDR + p);
+    if (u_strncmp(mp->signature, "_MP_", 4) == 0 && checksum(mp, sizeof(mp_pointer_t)) == 0)
+      return mp;
+  }
+  return NULL;
+}
+
+// Find the local APIC IDs of the enabled CPUs and the address of the
+// local APICs. Returns the number of CPUs, or 0 if there is no table.
+static uint32_t mp_find_cpus(uint8_t *apic_ids, uint32_t *lapic_paddr)
+{
+  // The first KB of the extended BIOS data area, the last KB of base
+  // memory and the BIOS ROM are searched, in that order.
+  uint32_t ebda = *(uint16_t *)(KERNEL_START_VADDR + 0x40E) << 4;
+  uint32_t base_end = *(uint16_t *)(KERNEL_START_VADDR + 0x413) << 10;
+  mp_pointer_t *mp = ebda ? mp_search(ebda, 0x400) : NULL;
+  if (mp == NULL && base_end >= 0x400)
+    mp = mp_search(base_end - 0x400, 0x400);
+  if (mp == NULL)
+    mp = mp_search(0xF0000, 0x10000);
+
+  // The table has to be in the part of memory that is always mapped.
+  // "Default configurations" without a table are not supported.
+  if (mp == NULL || mp->config_paddr == 0 ||
+      mp->config_paddr + sizeof(mp_config_t) > KERNEL_DIRECT_MAP_SIZE)
+    return 0;
+  mp_config_t *config = (mp_config_t *)(KERNEL_START_VADDR + mp->config_paddr);
+  if (u_strncmp(config->signature, "PCMP", 4) || checksum(config, config->length))
+    return 0;
+
+  *lapic_paddr = config->lapic_paddr;
+  uint32_t count = 0;
+  uint8_t *entry = (uint8_t *)(config + 1);
+  for (uint32_t i = 0; i < config->entry_count; ++i) {
+    if (*entry != MP_PROCESSOR) {
+      entry += MP_ENTRY_SIZE;
+      continue;
+    }
+    mp_processor_t *processor = (mp_processor_t *)entry;
+    if ((processor->flags & MP_PROCESSOR_ENABLED) && count < MAX_CPU_COUNT)
+      apic_ids[count++] = processor->apic_id;
+    entry += sizeof(mp_processor_t);
+  }
+  return count;
+}
+
+static void delay(uint64_t ns)
+{
+  uint64_t start = clock_get_time_ns();
+  while (clock_get_time_ns() - start < ns)
+    asm volatile("pause");
+}
+
+// Get the address of a variable in the copy of the trampoline.
+static uint32_t *trampoline_var(uint32_t *var)
+{
+  uint32_t offset = (uint8_t *)var - ap_trampoline_start;
+  return (uint32_t *)(KERNEL_START_VADDR + TRAMPOLINE_PADDR + offset);
+}
+
+// Start an application processor with the INIT-SIPI-SIPI sequence.
+static uint32_t start_ap(uint8_t apic_id)
+{
+  uint32_t cpu = cpu_count;
+  uint8_t *stack = kheap_alloc_pages(1);
+  CHECK(stack == NULL, "No memory.", ENOMEM);
+  *trampoline_var(&ap_trampoline_stack) = (uint32_t)stack + PAGE_SIZE;
+  cpus[cpu].apic_id = apic_id;
+  cpus[cpu].online = 0;
+  starting_cpu = cpu;
+
+  lapic_send_ipi(apic_id, LAPIC_ICR_INIT);
+  delay(INIT_DELAY_NS);
+  for (uint32_t i = 0; i < 2 && cpus[cpu].online == 0; ++i) {
+    lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (TRAMPOLINE_PADDR >> PAGE_SIZE_SHIFT));
+    delay(STARTUP_DELAY_NS);
+  }
+
+  uint64_t start = clock_get_time_ns();
+  while (cpus[cpu].online == 0 && clock_get_time_ns() - start < ONLINE_TIMEOUT_NS)
+    asm volatile("pause");
+  if (cpus[cpu].online == 0) {
+    kheap_free_pages(stack, 1);
+    log_error("smp", "CPU with APIC ID %u did not start.\n", apic_id);
+    return EIO;
+  }
+
+  ++cpu_count;
+  return 0;
+}
+
+void smp_init()
+{
+  uint8_t apic_ids[MAX_CPU_COUNT];
+  uint32_t lapic_paddr = 0;
+  uint32_t count = mp_find_cpus(apic_ids, &lapic_paddr);
+  if (count == 0) {
+    log_info("smp", "No MP configuration table, using one CPU.\n");
+    return;
+  }
+  if (lapic_init(lapic_paddr))
+    return;
+  lapic_init_cpu(1);
+  cpus[0].apic_id = lapic_id();
+  cpus[0].online = 1;
+
+  // The trampoline runs at its physical address with paging enabled,
+  // so the first 4MB are identity-mapped while processors start.
+  page_directory_t pd;
+  uint32_t pd_paddr;
+  paging_get_kernel_pd(&pd, &pd_paddr);
+  pd[0] = pd[KERNEL_START_VADDR >> 22];
+  pd[0].global = 0;
+
+  u_memcpy((void *)(KERNEL_START_VADDR + TRAMPOLINE_PADDR),
+           ap_trampoline_start,
+           ap_trampoline_end - ap_trampoline_start);
+  *trampoline_var(&ap_trampoline_cr3) = pd_paddr;
+  *trampoline_var(&ap_trampoline_cr4) = paging_get_cr4();
+
+  for (uint32_t i = 0; i < count; ++i)
+    if (apic_ids[i] != cpus[0].apic_id)
+      start_ap(apic_ids[i]);
+
+  u_memset(&pd[0], 0, sizeof(pd[0]));
+  paging_set_cr3(paging_get_cr3());
+  log_info("smp", "%u CPUs online.\n", cpu_count);
+}
+
+// Entry point of application processors, called by the trampoline on
+// a stack of their own.
+void ap_main()
+{
+  uint32_t cpu = starting_cpu;
+  gdt_init_ap(cpu);
+  idt_init_ap();
+  fpu_init();
+  lapic_init_cpu(0);
+  cpus[cpu].online = 1;
+
+  smp_lock_kernel();
+  paging_set_cr3(paging_get_cr3());
+  log_info("smp", "CPU %u started.\n", cpu);
+  process_start_cpu();
+}
+
+// Each CPU loads its TSS from its own GDT entry, so the task register
+// identifies the CPU. See gdt_init.
+uint32_t smp_cpu_id()
+{
+  uint16_t selector;
+  asm volatile("str %0" : "=r"(selector));
+  return selector < TSS_SEGSEL ? 0 : (selector - TSS_SEGSEL) >> 3;
+}
+
+uint32_t smp_cpu_count()
+{
+  return cpu_count;
+}
+
+void smp_send_reschedule(uint32_t cpu)
+{
+  if (cpu < cpu_count && cpu != smp_cpu_id())
+    lapic_send_ipi(cpus[cpu].apic_id, SMP_RESCHEDULE_VECTOR);
+}
+
+uint8_t smp_lock_kernel()
+{
+  int32_t cpu = smp_cpu_id();
+  if (kernel_lock_owner == cpu)
+    return 0;
+  // Keep invalidating pages while waiting, since the CPU that holds the
+  // lock may be waiting for this one to do so.
+  while (spin_trylock(&kernel_lock) == 0) {
+    smp_flush_tlb();
+    asm volatile("pause");
+  }
+  kernel_lock_owner = cpu;
+  smp_flush_tlb();
+  return 1;
+}
+
+void smp_unlock_kernel()
+{
+  kernel_lock_owner = -1;
+  spin_unlock(&kernel_lock);
+}
+
+void smp_yield_kernel()
+{
+  uint32_t eflags = interrupt_save_disable();
+  smp_unlock_kernel();
+  enable_interrupts();
+  asm volatile("pause");
+  disable_interrupts();
+  smp_lock_kernel();
+  interrupt_restore(eflags);
+}
+
+void smp_tlb_shootdown(uint32_t vaddr, uint32_t cpu_mask, uint8_t wait)
+{
+  for (uint32_t i = 0; i < cpu_count; ++i) {
+    if ((cpu_mask & (1 << i)) == 0)
+      continue;
+    cpu_t *cpu = cpus + i;
+    spin_lock(&cpu->tlb_lock);
+    if (vaddr != SMP_TLB_FLUSH_ALL && cpu->tlb_count < TLB_QUEUE_SIZE)
+      cpu->tlb_queue[cpu->tlb_count++] = vaddr;
+    else
+      cpu->tlb_flush_all = 1;
+    spin_unlock(&cpu->tlb_lock);
+    if (wait)
+      lapic_send_ipi(cpu->apic_id, SMP_TLB_VECTOR);
+  }
+
+  if (wait == 0)
+    return;
+  for (uint32_t i = 0; i < cpu_count; ++i)
+    if (cpu_mask & (1 << i))
+      while (cpus[i].tlb_count || cpus[i].tlb_flush_all)
+        asm volatile("pause");
+}
+
+void smp_flush_tlb()
+{
+  cpu_t *cpu = cpus + smp_cpu_id();
+  if (cpu->tlb_count == 0 && cpu->tlb_flush_all == 0)
+    return;
+
+  spin_lock(&cpu->tlb_lock);
+  if (cpu->tlb_flush_all)
+    paging_flush_tlb();
+  else
+    for (uint32_t i = 0; i < cpu->tlb_count; ++i)
+      paging_invlpg(cpu->tlb_queue[i]);
+  cpu->tlb_count = 0;
+  cpu->tlb_flush_all = 0;
+  spin_unlock(&cpu->tlb_lock);
+}
@@ -0,0 +1,54 @@
+// smp.h
+//
+// Symmetric multiprocessing.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _SMP_H_
+#define _SMP_H_
+
+#include "../common/stdint.h"
+
+#define MAX_CPU_COUNT 8
+
+// Interprocessor interrupt vectors.
+#define SMP_RESCHEDULE_VECTOR 49
+#define SMP_TLB_VECTOR 50
+
+// Find the other CPUs and start them. They wait for the kernel lock,
+// which the boot CPU holds until it first switches to a process.
+void smp_init();
+
+// Get the index of this CPU. The boot CPU is 0.
+uint32_t smp_cpu_id();
+
+// Get the number of running CPUs.
+uint32_t smp_cpu_count();
+
+// Make a CPU run its scheduler.
+void smp_send_reschedule(uint32_t cpu);
+
+// Kernel code runs on one CPU at a time, which holds the kernel lock.
+// It is taken when a CPU enters the kernel and released when the CPU
+// leaves it for user mode or the idle loop. Both must be called with
+// interrupts disabled. smp_lock_kernel returns 1 if it took the lock
+// and 0 if this CPU already held it.
+uint8_t smp_lock_kernel();
+void smp_unlock_kernel();
+
+// Let other CPUs run kernel code for a moment, e.g while waiting for
+// one of them. Interrupts are enabled meanwhile.
+void smp_yield_kernel();
+
+// Invalidate a page in the TLBs of the CPUs in a bitmask, or flush
+// their whole TLBs if `vaddr` is SMP_TLB_FLUSH_ALL. Kernel pages are
+// invalidated when each CPU next takes the kernel lock, since CPUs only
+// use them while holding it. If `wait` is set, the CPUs are interrupted
+// and this waits until they have invalidated the page.
+#define SMP_TLB_FLUSH_ALL 0xffffffff
+void smp_tlb_shootdown(uint32_t vaddr, uint32_t cpus, uint8_t wait);
+
+// Invalidate the pages that other CPUs have asked this one to.
+void smp_flush_tlb();
+
+#endif /* _SMP_H_ */
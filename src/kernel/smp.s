@@ -0,0 +1,80 @@
+    ; smp.s
+    ;
+    ; Symmetric multiprocessing.
+    ;
+    ; Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+%include "constants.s"
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_cr3
+global ap_trampoline_cr4
+global ap_trampoline_stack
+extern ap_main
+
+    ; The trampoline is copied to AP_TRAMPOLINE_PADDR, where application
+    ; processors start in real mode. Since it is assembled elsewhere, it
+    ; refers to its own labels through TRAMPOLINE.
+    ; Must match TRAMPOLINE_PADDR in smp.c.
+    AP_TRAMPOLINE_PADDR equ 0x8000
+%define TRAMPOLINE(label) (AP_TRAMPOLINE_PADDR + ((label) - ap_trampoline_start))
+
+section .text
+
+bits 16
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    ; Enter protected mode with a flat GDT whose selectors match the kernel's.
+    lgdt [TRAMPOLINE(ap_trampoline_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword KERNEL_CS:TRAMPOLINE(ap_trampoline_protected)
+
+bits 32
+ap_trampoline_protected:
+    mov ax, KERNEL_DS
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Enable paging with the kernel's page directory and the same
+    ; features as the boot processor. The trampoline keeps running at
+    ; its physical address, which smp_init identity-maps.
+    mov eax, [TRAMPOLINE(ap_trampoline_cr4)]
+    mov cr4, eax
+    mov eax, [TRAMPOLINE(ap_trampoline_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000          ; paging and write protection
+    mov cr0, eax
+
+    mov esp, [TRAMPOLINE(ap_trampoline_stack)]
+    mov eax, ap_main
+    call eax
+    jmp $
+
+align 8
+ap_trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF       ; code, base 0, limit 4GB
+    dq 0x00CF92000000FFFF       ; data, base 0, limit 4GB
+ap_trampoline_gdt_ptr:
+    dw ap_trampoline_gdt_ptr - ap_trampoline_gdt - 1
+    dd TRAMPOLINE(ap_trampoline_gdt)
+
+    ; Filled in by smp_init and start_ap.
+ap_trampoline_cr3:
+    dd 0
+ap_trampoline_cr4:
+    dd 0
+ap_trampoline_stack:
+    dd 0
+ap_trampoline_end:
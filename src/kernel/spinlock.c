@@ -0,0 +1,27 @@
+// spinlock.c
+//
+// Spinlocks.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "spinlock.h"
+#include "../common/stdint.h"
+
+void spin_lock(spinlock_t *lock)
+{
+  // Wait with plain reads so that waiting CPUs do not keep taking the
+  // cache line away from the one that holds the lock.
+  while (__sync_lock_test_and_set(&lock->locked, 1))
+    while (lock->locked)
+      asm volatile("pause");
+}
+
+uint8_t spin_trylock(spinlock_t *lock)
+{
+  return __sync_lock_test_and_set(&lock->locked, 1) == 0;
+}
+
+void spin_unlock(spinlock_t *lock)
+{
+  __sync_lock_release(&lock->locked);
+}
@@ -0,0 +1,30 @@
+// spinlock.h
+//
+// Spinlocks.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _SPINLOCK_H_
+#define _SPINLOCK_H_
+
+#include "../common/stdint.h"
+
+// A lock that CPUs busy-wait for. Unlike klock, waiting never switches
+// processes, so spinlocks can be taken by interrupt handlers and by
+// code that runs without a current process. They do not disable
+// interrupts, and are only held for short periods.
+typedef struct spinlock_s
+{
+  volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+void spin_lock(spinlock_t *);
+
+// Take a lock if it is free. Returns 1 if the lock was taken.
+uint8_t spin_trylock(spinlock_t *);
+
+void spin_unlock(spinlock_t *);
+
+#endif /* _SPINLOCK_H_ */
@@ -0,0 +1,400 @@
+// swap.c
+//
+// Page reclaim and swap.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "swap.h"
+#include "../common/errno.h"
+#include "../common/stdint.h"
+#include "constants.h"
+#include "fs.h"
+#include "futex.h"
+#include "interrupt.h"
+#include "kheap.h"
+#include "klock.h"
+#include "log.h"
+#include "paging.h"
+#include "pmm.h"
+#include "process.h"
+#include "text.h"
+#include "util.h"
+#include "vma.h"
+#include <stddef.h>
+
+// Reclaim is a clock algorithm over the user pages of every address
+// space. The hand visits each page in turn: a page that has been
+// accessed since the last visit has its accessed bit cleared and is
+// kept, and any other page is evicted. Clean pages that the page fault
+// handler can load again from a file, or zero-fill, are simply freed.
+// Other pages are written to a free slot of the swap device, and their
+// entry is marked as swapped until swap_fault reads them back.
+//
+// Only pages that belong to a single address space are evicted. Pages
+// that are shared by fork, shared memory or shared mappings stay put,
+// and so do pages that processes wait on with futex_wait.
+//
+// swap_lock serializes reclaim and swap-in, so a page is never read
+// back while it is being written. Pages are copied through `bounce`,
+// which it also protects, since the swap device may sleep and kmap
+// slots cannot be held meanwhile.
+
+#define CHECK(err, msg, code)                                                                      \
+  if ((err)) {                                                                                     \
+    log_error("swap", msg "\n");                                                                   \
+    return (code);                                                                                 \
+  }
+
+// Reclaim starts when fewer than PMM_LOW_WATERMARK pages are free, and
+// evicts up to SWAP_BATCH pages.
+static const uint32_t SWAP_BATCH = 64;
+
+// Number of pages that the hand passes with interrupts disabled.
+static const uint32_t SCAN_CHUNK = 1024;
+
+// Slot numbers are stored in the frame address of page table entries.
+static const uint32_t MAX_SLOTS = 1 << 20;
+
+static fs_node_t swap_device;
+static uint8_t *slot_refs = NULL; // References to each slot, 0 if it is free.
+static uint32_t slot_hint = 0;    // Where to start looking for a free slot.
+static swap_stats_t stats;
+static volatile uint32_t swap_lock = 0;
+static uint8_t *bounce = NULL;
+
+// Position of the clock hand.
+static uint32_t hand_pid = 0;
+static uint32_t hand_vaddr = 0;
+
+uint32_t swap_init(fs_node_t *device)
+{
+  uint32_t slots = device->size >> PAGE_SIZE_SHIFT;
+  if (slots > MAX_SLOTS)
+    slots = MAX_SLOTS;
+  CHECK(slots == 0, "Swap device is empty.", EINVAL);
+  bounce = kheap_alloc_pages(1);
+  CHECK(bounce == NULL, "No memory.", ENOMEM);
+  slot_refs = kmalloc(slots);
+  CHECK(slot_refs == NULL, "No memory.", ENOMEM);
+  u_memset(slot_refs, 0, slots);
+  u_memcpy(&swap_device, device, sizeof(fs_node_t));
+  stats.slots = slots;
+  log_info("swap", "Using %u pages of swap.\n", slots);
+  return 0;
+}
+
+// Allocate a free slot. Must be called with interrupts disabled.
+static uint32_t slot_alloc(uint32_t *out)
+{
+  for (uint32_t i = 0; i < stats.slots; ++i) {
+    uint32_t slot = (slot_hint + i) % stats.slots;
+    if (slot_refs[slot])
+      continue;
+    slot_refs[slot] = 1;
+    slot_hint = slot + 1;
+    ++stats.slots_used;
+    *out = slot;
+    return 0;
+  }
+  return ENOSPC;
+}
+
+void swap_ref(uint32_t slot)
+{
+  uint32_t eflags = interrupt_save_disable();
+  if (slot < stats.slots && slot_refs[slot])
+    ++slot_refs[slot];
+  else
+    log_error("swap", "Attempt to reference free slot %u.\n", slot);
+  interrupt_restore(eflags);
+}
+
+void swap_free(uint32_t slot)
+{
+  uint32_t eflags = interrupt_save_disable();
+  if (slot < stats.slots && slot_refs[slot]) {
+    --slot_refs[slot];
+    if (slot_refs[slot] == 0)
+      --stats.slots_used;
+  } else
+    log_error("swap", "Attempt to free free slot %u.\n", slot);
+  interrupt_restore(eflags);
+}
+
+// Can a clean page of a process be loaded again by the page fault
+// handler? Regions take precedence over the process image.
+static uint8_t is_reloadable(process_t *p, uint32_t vaddr)
+{
+  vma_t *vma = vma_find(p->vmas, vaddr);
+  if (vma)
+    return vma->shm == NULL;
+
+  for (uint32_t i = 0; i < p->image.segment_count; ++i) {
+    process_segment_t *segment = p->image.segments + i;
+    uint32_t start = u_page_align_down(segment->vaddr);
+    uint32_t end = u_page_align_up(segment->vaddr + segment->mem_len);
+    if (vaddr >= start && vaddr < end)
+      return 1;
+  }
+  return 0;
+}
+
+// Move the hand over up to SCAN_CHUNK pages of `p`, whose address space
+// must be the current one, and free pages that do not have to be
+// written to swap. Stops at a page that has to be written to swap and
+// returns its address, or returns 0. Must be called with interrupts
+// disabled.
+static uint32_t scan(process_t *p, uint32_t *freed, uint32_t target)
+{
+  for (uint32_t n = 0; n < SCAN_CHUNK && hand_vaddr < KERNEL_START_VADDR && *freed < target; ++n) {
+    uint32_t vaddr = hand_vaddr;
+    page_table_entry_t *pte = paging_get_pte(vaddr);
+    if (pte == NULL) {
+      hand_vaddr = (vaddr & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE;
+      continue;
+    }
+    hand_vaddr += PAGE_SIZE;
+
+    if (pte->present == 0 || pte->shared)
+      continue;
+    uint32_t paddr = pte->frame_addr << PAGE_SIZE_SHIFT;
+    if (pmm_refcount(paddr) != 1 || futex_page_has_waiters(paddr))
+      continue;
+    if (pte->accessed) {
+      pte->accessed = 0;
+      paging_invalidate_pte(vaddr);
+      continue;
+    }
+
+    if (pte->text || (pte->dirty == 0 && is_reloadable(p, vaddr))) {
+      // Threads of the process may write to the page on other CPUs
+      // until their TLB entries are gone, so the page is made not
+      // present first and the dirty bit is only read once every CPU has
+      // dropped the entry. Later writes fault and wait for the kernel.
+      uint32_t old_bits = __sync_fetch_and_and((volatile uint32_t *)pte, ~1u);
+      paging_invalidate_pte(vaddr);
+      page_table_entry_t old;
+      u_memcpy(&old, &old_bits, sizeof(old));
+      uint8_t text = old.text;
+      if (text == 0 && (old.dirty || pte->dirty)) {
+        pte->present = 1;
+        if (slot_refs)
+          return vaddr;
+        continue;
+      }
+
+      // Unmapping releases the virtual page as well, but it is still
+      // part of the image or region.
+      paging_add_resident_pages(-1);
+      paging_unmap(vaddr);
+      paging_reserve_vaddr(vaddr, 1);
+      if (text)
+        text_release(paddr);
+      else
+        pmm_free(paddr, 1);
+      ++stats.dropped;
+      ++*freed;
+      continue;
+    }
+
+    if (slot_refs)
+      return vaddr;
+  }
+  return 0;
+}
+
+// Write a page that has been marked as swapped out to its slot. The
+// page is mapped again if that fails, unless it has been unmapped since.
+static uint32_t write_slot(uint32_t pid,
+                           uint32_t cr3,
+                           uint32_t vaddr,
+                           uint32_t paddr,
+                           uint32_t slot)
+{
+  uint8_t *page = paging_kmap(paddr);
+  int32_t res = -EIO;
+  if (page) {
+    u_memcpy(bounce, page, PAGE_SIZE);
+    paging_kunmap(page);
+    res = fs_write(&swap_device, slot << PAGE_SIZE_SHIFT, PAGE_SIZE, bounce);
+  }
+  if (res == (int32_t)PAGE_SIZE) {
+    pmm_free(paddr, 1);
+    ++stats.swap_outs;
+    return 0;
+  }
+
+  log_error("swap", "Failed to write slot %u.\n", slot);
+  uint32_t eflags = interrupt_save_disable();
+  process_t *p = process_from_pid(pid);
+  if (p && p->cr3 == cr3) {
+    uint32_t current_cr3 = paging_get_cr3();
+    paging_set_cr3(cr3);
+    page_table_entry_t *pte = paging_get_pte(vaddr);
+    if (pte && pte->present == 0 && pte->swapped && pte->frame_addr == slot) {
+      pte->swapped = 0;
+      pte->present = 1;
+      pte->frame_addr = paddr >> PAGE_SIZE_SHIFT;
+      paging_add_resident_pages(1);
+      swap_free(slot);
+      paddr = 0;
+    }
+    paging_set_cr3(current_cr3);
+  }
+  interrupt_restore(eflags);
+
+  if (paddr)
+    pmm_free(paddr, 1);
+  return EIO;
+}
+
+// Evict up to `target` pages. Returns the number of pages freed. Must
+// be called with swap_lock held.
+static uint32_t reclaim(uint32_t target)
+{
+  uint32_t freed = 0;
+  // Every page is passed at most twice: once to clear its accessed
+  // bit and once to evict it.
+  uint32_t rounds = 0;
+  while (freed < target && rounds < 2 * MAX_PROCESS_COUNT) {
+    uint32_t eflags = interrupt_save_disable();
+    process_t *p = process_from_pid(hand_pid);
+    if (p == NULL || p->is_thread || hand_vaddr >= KERNEL_START_VADDR) {
+      hand_pid = (hand_pid + 1) % MAX_PROCESS_COUNT;
+      hand_vaddr = PAGE_SIZE;
+      ++rounds;
+      interrupt_restore(eflags);
+      continue;
+    }
+
+    uint32_t pid = p->pid;
+    uint32_t p_cr3 = p->cr3;
+    uint32_t cr3 = paging_get_cr3();
+    paging_set_cr3(p_cr3);
+    uint32_t vaddr = scan(p, &freed, target);
+    uint32_t paddr = 0;
+    uint32_t slot = 0;
+    if (vaddr && slot_alloc(&slot) == 0) {
+      page_table_entry_t *pte = paging_get_pte(vaddr);
+      paddr = pte->frame_addr << PAGE_SIZE_SHIFT;
+      pte->present = 0;
+      pte->swapped = 1;
+      pte->frame_addr = slot;
+      paging_invalidate_pte(vaddr);
+      paging_add_resident_pages(-1);
+    }
+    paging_set_cr3(cr3);
+    interrupt_restore(eflags);
+
+    if (vaddr && paddr == 0) {
+      log_error("swap", "Out of swap space.\n");
+      break;
+    }
+    if (paddr && write_slot(pid, p_cr3, vaddr, paddr, slot) == 0)
+      ++freed;
+  }
+  return freed;
+}
+
+void swap_reclaim()
+{
+  if (pmm_free_pages() >= PMM_LOW_WATERMARK)
+    return;
+  klock(&swap_lock);
+  reclaim(SWAP_BATCH);
+  kunlock(&swap_lock);
+}
+
+uint32_t swap_fault(uint32_t vaddr)
+{
+  page_table_entry_t *pte = paging_get_pte(vaddr);
+  if (pte == NULL || pte->present || pte->swapped == 0)
+    return 1;
+
+  klock(&swap_lock);
+
+  // Another thread may have swapped the page in while we waited.
+  uint32_t eflags = interrupt_save_disable();
+  pte = paging_get_pte(vaddr);
+  uint8_t swapped = pte && pte->present == 0 && pte->swapped;
+  uint32_t slot = swapped ? pte->frame_addr : 0;
+  interrupt_restore(eflags);
+  if (swapped == 0) {
+    kunlock(&swap_lock);
+    return 0;
+  }
+
+  uint32_t paddr = pmm_alloc(1);
+  if (paddr == 0 && reclaim(1))
+    paddr = pmm_alloc(1);
+  if (paddr == 0) {
+    kunlock(&swap_lock);
+    log_error("swap", "No memory.\n");
+    return ENOMEM;
+  }
+
+  int32_t res = fs_read(&swap_device, slot << PAGE_SIZE_SHIFT, PAGE_SIZE, bounce);
+  if (res == (int32_t)PAGE_SIZE && paging_copy_to_page(paddr, bounce) != PAGING_OK)
+    res = -EIO;
+  if (res != (int32_t)PAGE_SIZE) {
+    pmm_free(paddr, 1);
+    kunlock(&swap_lock);
+    log_error("swap", "Failed to read slot %u.\n", slot);
+    return EIO;
+  }
+
+  eflags = interrupt_save_disable();
+  pte = paging_get_pte(vaddr);
+  if (pte && pte->present == 0 && pte->swapped && pte->frame_addr == slot) {
+    pte->swapped = 0;
+    pte->present = 1;
+    pte->frame_addr = paddr >> PAGE_SIZE_SHIFT;
+    // The slot is freed, so the page has to be written again if it is
+    // evicted, even if it is not modified.
+    pte->dirty = 1;
+    pte->accessed = 1;
+    paging_invalidate_pte(vaddr);
+    paging_add_resident_pages(1);
+    swap_free(slot);
+    ++stats.swap_ins;
+    paddr = 0;
+  }
+  interrupt_restore(eflags);
+
+  if (paddr)
+    pmm_free(paddr, 1);
+  kunlock(&swap_lock);
+  return 0;
+}
+
+void swap_get_stats(swap_stats_t *out)
+{
+  uint32_t eflags = interrupt_save_disable();
+  u_memcpy(out, &stats, sizeof(swap_stats_t));
+  interrupt_restore(eflags);
+}
+
+uint32_t swap_read_stats(uint32_t offset, uint32_t size, uint8_t *buf)
+{
+  swap_stats_t st;
+  swap_get_stats(&st);
+
+  char text[256];
+  uint32_t len = log_sprintf(text,
+                             sizeof(text),
+                             "slots: %u used of %u\nswap: %u in, %u out\ndropped: %u clean pages\n",
+                             st.slots_used,
+                             st.slots,
+                             st.swap_ins,
+                             st.swap_outs,
+                             st.dropped);
+  if (len >= sizeof(text))
+    len = sizeof(text) - 1;
+
+  if (offset >= len)
+    size = 0;
+  else if (size > len - offset)
+    size = len - offset;
+  u_memcpy(buf, text + offset, size);
+  return size;
+}
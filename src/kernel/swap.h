@@ -0,0 +1,48 @@
+// swap.h
+//
+// Page reclaim and swap.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include "../common/stdint.h"
+#include "fs.h"
+
+// Swap and reclaim counters.
+typedef struct swap_stats_s
+{
+  uint32_t slots;      // Pages that fit in the swap device.
+  uint32_t slots_used; // Slots that hold a page.
+  uint32_t swap_ins;   // Pages read back from swap.
+  uint32_t swap_outs;  // Pages written to swap.
+  uint32_t dropped;    // Clean pages freed without being written.
+} swap_stats_t;
+
+// Use a block device for swap. Without a swap device, reclaim only
+// frees clean pages that can be loaded again from files.
+uint32_t swap_init(fs_node_t *);
+
+// Add and drop references to a swap slot, which is freed along with
+// its last reference.
+void swap_ref(uint32_t slot);
+void swap_free(uint32_t slot);
+
+// Read the page that contains `vaddr` back into the current address
+// space if it has been swapped out. Returns 0 if the page was swapped
+// in, 1 if it has not been swapped out, or an error code.
+uint32_t swap_fault(uint32_t vaddr);
+
+// Evict user pages that have not been used recently if free memory
+// is running low. May wait for IO.
+void swap_reclaim();
+
+// Get a snapshot of the counters.
+void swap_get_stats(swap_stats_t *);
+
+// Read part of a text report of the counters. Returns the number of
+// bytes read.
+uint32_t swap_read_stats(uint32_t offset, uint32_t size, uint8_t *buf);
+
+#endif /* _SWAP_H_ */
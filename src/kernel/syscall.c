@@ -6,28 +6,43 @@
 // Author: Ajay Tatachar <ajaymt2@illinois.edu>
 
 #include "syscall.h"
+#include "../common/clock.h"
 #include "../common/errno.h"
+#include "../common/meminfo.h"
+#include "../common/mman.h"
 #include "../libc/sys/stat.h"
+#include "clock.h"
 #include "constants.h"
 #include "elf.h"
 #include "fs.h"
+#include "futex.h"
 #include "interrupt.h"
 #include "kheap.h"
 #include "klock.h"
 #include "paging.h"
 #include "pipe.h"
-#include "pit.h"
 #include "pmm.h"
 #include "process.h"
+#include "shm.h"
+#include "smp.h"
+#include "swap.h"
+#include "text.h"
 #include "ui.h"
 #include "util.h"
+#include "vma.h"
 
 typedef void (*syscall_t)();
 
+// Number of bytes read from the start of a file by execve.
+#define EXEC_HEADER_SIZE 256
+
 static void syscall_fork()
 {
+  // Make room for the page tables and other pages of the child.
+  swap_reclaim();
+
   process_t *current = process_current();
-  process_t *child = kmalloc(sizeof(process_t));
+  process_t *child = process_alloc();
   if (child == NULL) {
     current->uregs.eax = -ENOMEM;
     return;
@@ -79,6 +94,41 @@ static void execve_set_env(char *argv[], char *envp[])
   *ptr_ptr = 0;
 }
 
+// Free a null-terminated array of strings.
+static void free_strings(char **strings)
+{
+  if (strings == NULL)
+    return;
+  for (uint32_t i = 0; strings[i]; ++i)
+    kfree(strings[i]);
+  kfree(strings);
+}
+
+// Copy a null-terminated array of strings into kernel memory,
+// optionally preceded by the string `first`.
+static char **copy_strings(char *first, char *strings[])
+{
+  uint32_t count = first ? 1 : 0;
+  for (uint32_t i = 0; strings[i]; ++i)
+    ++count;
+  char **copy = kmalloc((count + 1) * sizeof(char *));
+  if (copy == NULL)
+    return NULL;
+  u_memset(copy, 0, (count + 1) * sizeof(char *));
+
+  for (uint32_t i = 0; i < count; ++i) {
+    char *str = first ? (i == 0 ? first : strings[i - 1]) : strings[i];
+    copy[i] = kmalloc(u_strlen(str) + 1);
+    if (copy[i] == NULL) {
+      free_strings(copy);
+      return NULL;
+    }
+    u_memcpy(copy[i], str, u_strlen(str) + 1);
+  }
+
+  return copy;
+}
+
 static void syscall_execve(char *path, char *argv[], char *envp[])
 {
   process_t *current = process_current();
@@ -88,85 +138,44 @@ static void syscall_execve(char *path, char *argv[], char *envp[])
     current->uregs.eax = -res;
     return;
   }
-  uint8_t *buf = kmalloc(node.size);
+
+  // Only the start of the file is needed to tell executables and
+  // scripts apart. Executables are loaded page by page as they run.
+  uint32_t header_size = node.size < EXEC_HEADER_SIZE ? node.size : EXEC_HEADER_SIZE;
+  uint8_t *buf = kmalloc(header_size + 1);
   if (buf == NULL) {
     current->uregs.eax = -ENOMEM;
     return;
   }
-  uint32_t rsize = fs_read(&node, 0, node.size, buf);
-  if (rsize != node.size) {
+  uint32_t rsize = fs_read(&node, 0, header_size, buf);
+  if (rsize != header_size) {
+    kfree(buf);
     current->uregs.eax = -EAGAIN;
     return;
   }
+  buf[rsize] = '\0';
 
   if (rsize >= 4 && elf_is_valid(buf)) {
-    uint32_t argc = 0;
-    for (; argv[argc]; ++argc)
-      ;
-    char **kargv = kmalloc((argc + 2) * sizeof(char *));
-    if (kargv == NULL) {
-      current->uregs.eax = -ENOMEM;
-      return;
-    }
-    kargv[0] = kmalloc(u_strlen(path) + 1);
-    if (kargv[0] == NULL) {
-      current->uregs.eax = -ENOMEM;
-      return;
-    }
-    u_memcpy(kargv[0], path, u_strlen(path) + 1);
-    for (uint32_t i = 0; i < argc; ++i) {
-      char *arg = kmalloc(u_strlen(argv[i]) + 1);
-      if (arg == NULL) {
-        current->uregs.eax = -ENOMEM;
-        return;
-      }
-      u_memcpy(arg, argv[i], u_strlen(argv[i]) + 1);
-      kargv[i + 1] = arg;
-    }
-    kargv[argc + 1] = NULL;
-
-    uint32_t envc = 0;
-    for (; envp[envc]; ++envc)
-      ;
-    char **kenvp = kmalloc((envc + 1) * sizeof(char *));
-    if (kenvp == NULL) {
-      current->uregs.eax = -ENOMEM;
-      return;
-    }
-    for (uint32_t i = 0; i < envc; ++i) {
-      char *env = kmalloc(u_strlen(envp[i]) + 1);
-      if (env == NULL) {
-        current->uregs.eax = -ENOMEM;
-        return;
-      }
-      u_memcpy(env, envp[i], u_strlen(envp[i]) + 1);
-      kenvp[i] = env;
-    }
-    kenvp[envc] = NULL;
+    kfree(buf);
 
-    process_image_t p;
-    u_memset(&p, 0, sizeof(process_image_t));
-    res = elf_load(&p, buf);
-    if (res) {
-      current->uregs.eax = -res;
-      return;
-    }
-    res = process_load(current, p);
-    if (res) {
+    // Arguments and environment variables must be copied out of the
+    // address space before it is replaced.
+    char **kargv = copy_strings(path, argv);
+    char **kenvp = copy_strings(NULL, envp);
+    process_image_t *img = kmalloc(sizeof(process_image_t));
+    res = ENOMEM;
+    if (kargv && kenvp && img)
+      res = elf_load(img, &node);
+    if (res == 0)
+      res = process_load(current, img);
+    if (res == 0)
+      execve_set_env(kargv, kenvp);
+    else
       current->uregs.eax = -res;
-      return;
-    }
-    execve_set_env(kargv, kenvp);
-
-    for (uint32_t i = 0; kargv[i]; ++i)
-      kfree(kargv[i]);
-    kfree(kargv);
-    for (uint32_t i = 0; kenvp[i]; ++i)
-      kfree(kenvp[i]);
-    kfree(kenvp);
-    kfree(p.text);
-    kfree(p.data);
-    kfree(buf);
+
+    free_strings(kargv);
+    free_strings(kenvp);
+    kfree(img);
     return;
   }
 
@@ -189,6 +198,7 @@ static void syscall_execve(char *path, char *argv[], char *envp[])
 
   char **new_argv = kmalloc((argc + line_len) * (sizeof(char *)));
   if (new_argv == NULL) {
+    kfree(buf);
     current->uregs.eax = -ENOMEM;
     return;
   }
@@ -211,22 +221,39 @@ static void syscall_execve(char *path, char *argv[], char *envp[])
   kfree(buf);
 }
 
-static void syscall_msleep(uint32_t duration)
+// Suspend the current process until a time in nanoseconds since boot.
+// Interrupts stay disabled until the process is unscheduled, so that a
+// short sleep cannot expire before the process stops running.
+static void sleep_until(uint64_t wake_time)
 {
   process_t *current = process_current();
   current->uregs.eax = 0;
-  uint64_t wake_time = pit_get_time() + duration;
+  disable_interrupts();
   uint32_t res = process_sleep(current, wake_time);
   if (res) {
     current->uregs.eax = -res;
+    enable_interrupts();
     return;
   }
-  disable_interrupts();
   current->in_kernel = 0;
   process_unschedule(current);
   process_switch_next();
 }
 
+static void syscall_msleep(uint32_t duration)
+{
+  sleep_until(clock_get_time_ns() + (uint64_t)duration * 1000000);
+}
+
+static void syscall_nanosleep(uint32_t sec, uint32_t nsec)
+{
+  if (nsec >= 1000000000) {
+    process_current()->uregs.eax = -EINVAL;
+    return;
+  }
+  sleep_until(clock_get_time_ns() + (uint64_t)sec * 1000000000 + nsec);
+}
+
 static void syscall_exit(uint32_t status)
 {
   process_t *current = process_current();
@@ -237,71 +264,45 @@ static void syscall_exit(uint32_t status)
   process_kill(current);
 }
 
+// Check that a range of user addresses is page aligned and below the kernel.
+static uint8_t user_range_is_valid(uint32_t vaddr, uint32_t len)
+{
+  return (vaddr & (PAGE_SIZE - 1)) == 0 && vaddr < KERNEL_START_VADDR &&
+         len <= KERNEL_START_VADDR - vaddr;
+}
+
 static void syscall_pagealloc(uint32_t npages)
 {
+  process_t *current = process_current();
+  current->uregs.eax = 0;
   if (npages == 0)
     return;
-  process_t *current = process_current();
-  uint32_t eflags = interrupt_save_disable();
+
+  // Pages are allocated when they are first accessed.
+  uint32_t len = npages << PAGE_SIZE_SHIFT;
   uint32_t vaddr = paging_next_vaddr(npages, current->mmap.heap);
-  if (vaddr == 0) {
-    current->uregs.eax = 0;
+  if (vaddr == 0)
     return;
-  }
-
-  page_table_entry_t flags;
-  u_memset(&flags, 0, sizeof(flags));
-  flags.rw = 1;
-  flags.user = 1;
-  uint32_t err = 0;
-  uint32_t i = 0;
-  for (; i < npages; ++i) {
-    uint32_t paddr = pmm_alloc(1);
-    if (paddr == 0) {
-      err = ENOMEM;
-      break;
-    }
-    paging_result_t res = paging_map(vaddr + (i * PAGE_SIZE), paddr, flags);
-    if (res != PAGING_OK) {
-      err = res;
-      break;
-    }
-  }
-
+  vma_t **vmas = &process_group_leader(current)->vmas;
+  uint32_t err =
+    vma_map(vmas, vaddr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, NULL, 0);
   if (err) {
-    for (uint32_t k = 0; k < i; ++k) {
-      uint32_t paddr = paging_get_paddr(vaddr + (k * PAGE_SIZE));
-      if (paddr)
-        pmm_free(paddr, 1);
-      paging_unmap(vaddr + (k * PAGE_SIZE));
-    }
-    current->uregs.eax = 0;
+    vma_unmap(vmas, vaddr, len);
     return;
   }
 
   current->uregs.eax = vaddr;
-  interrupt_restore(eflags);
 }
 
 static void syscall_pagefree(uint32_t vaddr, uint32_t npages)
 {
   process_t *current = process_current();
-  uint32_t eflags = interrupt_save_disable();
-
-  for (uint32_t i = 0; i < npages; ++i) {
-    uint32_t paddr = paging_get_paddr(vaddr + (i * PAGE_SIZE));
-    if (paddr) {
-      pmm_free(paddr, 1);
-    }
-    paging_result_t res = paging_unmap(vaddr + (i * PAGE_SIZE));
-    if (res != PAGING_OK) {
-      current->uregs.eax = -res;
-      return;
-    }
+  uint32_t len = npages << PAGE_SIZE_SHIFT;
+  if (!user_range_is_valid(vaddr, len)) {
+    current->uregs.eax = -EINVAL;
+    return;
   }
-
-  current->uregs.eax = 0;
-  interrupt_restore(eflags);
+  current->uregs.eax = -vma_unmap(&process_group_leader(current)->vmas, vaddr, len);
 }
 
 static void syscall_signal_register(uint32_t eip)
@@ -345,7 +346,7 @@ static void syscall_open(char *path, uint32_t flags, uint32_t mode)
     }
   }
 
-  process_fd_t *fd = kmalloc(sizeof(process_fd_t));
+  process_fd_t *fd = process_fd_alloc();
   if (fd == NULL) {
     current->uregs.eax = -ENOMEM;
     return;
@@ -353,7 +354,7 @@ static void syscall_open(char *path, uint32_t flags, uint32_t mode)
   u_memset(fd, 0, sizeof(process_fd_t));
   res = fs_open_node(&(fd->node), path, flags);
   if (res) {
-    kfree(fd);
+    process_fd_free(fd);
     current->uregs.eax = -res;
     return;
   }
@@ -370,7 +371,7 @@ static void syscall_open(char *path, uint32_t flags, uint32_t mode)
   }
   kunlock(&current->fd_lock);
   if ((int32_t)current->uregs.eax == -EMFILE)
-    kfree(fd);
+    process_fd_free(fd);
 }
 
 #define CHECK_FDNUM                                                                                \
@@ -389,7 +390,7 @@ static void syscall_close(int32_t fdnum)
   --(fd->refcount);
   if (fd->refcount == 0) {
     fs_close(&(fd->node));
-    kfree(fd);
+    process_fd_free(fd);
   }
   current->fds[fdnum] = NULL;
   kunlock(&current->fd_lock);
@@ -443,7 +444,7 @@ static void syscall_readdir(int32_t fdnum, struct dirent *ent, uint32_t index)
     return;
   }
   u_memcpy(ent, res, sizeof(struct dirent));
-  kfree(res);
+  fs_dirent_free(res);
   current->uregs.eax = 0;
 }
 
@@ -490,7 +491,7 @@ static void syscall_pipe(uint32_t *read_fdnum, uint32_t *write_fdnum)
 {
   process_t *current = process_current();
 
-  process_fd_t *read_fd = kmalloc(sizeof(process_fd_t));
+  process_fd_t *read_fd = process_fd_alloc();
   if (read_fd == NULL) {
     current->uregs.eax = -ENOMEM;
     return;
@@ -498,7 +499,7 @@ static void syscall_pipe(uint32_t *read_fdnum, uint32_t *write_fdnum)
   u_memset(read_fd, 0, sizeof(process_fd_t));
   read_fd->refcount = 1;
 
-  process_fd_t *write_fd = kmalloc(sizeof(process_fd_t));
+  process_fd_t *write_fd = process_fd_alloc();
   if (write_fd == NULL) {
     current->uregs.eax = -ENOMEM;
     return;
@@ -537,8 +538,8 @@ static void syscall_pipe(uint32_t *read_fdnum, uint32_t *write_fdnum)
   if (current->uregs.eax != 0) {
     fs_close(&(read_fd->node));
     fs_close(&(write_fd->node));
-    kfree(read_fd);
-    kfree(write_fd);
+    process_fd_free(read_fd);
+    process_fd_free(write_fd);
   }
 }
 
@@ -556,7 +557,7 @@ static void syscall_movefd(uint32_t fdn1, uint32_t fdn2)
   --(fd2->refcount);
   if (fd2->refcount == 0) {
     fs_close(&(fd2->node));
-    kfree(fd2);
+    process_fd_free(fd2);
   }
   current->fds[fdn2] = current->fds[fdn1];
   current->fds[fdn1] = NULL;
@@ -600,14 +601,8 @@ static void syscall_wait(uint32_t pid)
 {
   process_t *current = process_current();
   uint8_t err = process_wait_pid(current, pid);
-  if (err) {
+  if (err)
     current->uregs.eax = -ESRCH;
-    return;
-  }
-  disable_interrupts();
-  current->in_kernel = 0;
-  process_unschedule(current);
-  process_switch_next();
 }
 
 static void syscall_fstat(uint32_t fdnum, struct stat *st)
@@ -705,7 +700,7 @@ static void syscall_lseek(uint32_t fdnum, int32_t offset, uint32_t whence)
 static void syscall_thread(uint32_t eip, uint32_t data)
 {
   process_t *current = process_current();
-  process_t *child = kmalloc(sizeof(process_t));
+  process_t *child = process_alloc();
   if (child == NULL) {
     current->uregs.eax = -ENOMEM;
     return;
@@ -812,7 +807,7 @@ static void syscall_resolve(char *outpath, char *inpath, size_t len)
 
 static void syscall_systime()
 {
-  process_current()->uregs.eax = pit_get_time();
+  process_current()->uregs.eax = clock_get_time();
 }
 
 static void syscall_priority(int32_t prio)
@@ -824,12 +819,8 @@ static void syscall_priority(int32_t prio)
   }
   if (prio > MAX_PROCESS_PRIORITY)
     prio = MAX_PROCESS_PRIORITY;
-  uint32_t eflags = interrupt_save_disable();
-  process_unschedule(current);
-  current->priority = prio;
+  process_set_priority(current, prio);
   current->uregs.eax = prio;
-  process_schedule(current);
-  interrupt_restore(eflags);
 }
 
 static void syscall_ui_set_wallpaper(const char *path)
@@ -850,6 +841,294 @@ static void syscall_ui_enable_mouse_move_events()
   current->uregs.eax = -ui_enable_mouse_move_events(current);
 }
 
+// Flags that mmap and mprotect understand.
+#define PROT_ALL (PROT_READ | PROT_WRITE | PROT_EXEC)
+#define MAP_ALL (MAP_SHARED | MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS)
+
+static void syscall_mmap(mmap_args_t *uargs)
+{
+  process_t *current = process_current();
+  if ((uint32_t)uargs >= KERNEL_START_VADDR - sizeof(mmap_args_t)) {
+    current->uregs.eax = -EFAULT;
+    return;
+  }
+  // Other threads may change the arguments while we use them.
+  mmap_args_t copy = *uargs;
+  mmap_args_t *args = &copy;
+
+  uint32_t len = u_page_align_up(args->len);
+  uint32_t flags = args->flags;
+  uint8_t shared = (flags & MAP_SHARED) != 0;
+  uint8_t private = (flags & MAP_PRIVATE) != 0;
+  if (len == 0 || shared == private || (args->offset & (PAGE_SIZE - 1)) ||
+      (args->prot & ~PROT_ALL) || (flags & ~MAP_ALL)) {
+    current->uregs.eax = -EINVAL;
+    return;
+  }
+  if ((flags & MAP_FIXED) && (args->addr == 0 || !user_range_is_valid(args->addr, len))) {
+    current->uregs.eax = -EINVAL;
+    return;
+  }
+
+  fs_node_t *node = NULL;
+  if ((flags & MAP_ANONYMOUS) == 0) {
+    uint32_t fdnum = args->fd;
+    klock(&current->fd_lock);
+    CHECK_FDNUM;
+    node = &current->fds[fdnum]->node;
+    if (node->type != FS_FILE) {
+      kunlock(&current->fd_lock);
+      current->uregs.eax = -ENODEV;
+      return;
+    }
+  }
+
+  vma_t **vmas = &process_group_leader(current)->vmas;
+  uint32_t npages = len >> PAGE_SIZE_SHIFT;
+  uint32_t vaddr = args->addr;
+  uint32_t err = 0;
+  if (flags & MAP_FIXED) {
+    err = vma_unmap(vmas, vaddr, len);
+    if (err == 0)
+      paging_reserve_vaddr(vaddr, npages);
+  } else {
+    uint32_t base = vaddr && vaddr < KERNEL_START_VADDR ? vaddr : current->mmap.heap;
+    vaddr = paging_next_vaddr(npages, base);
+    if (vaddr == 0)
+      err = ENOMEM;
+  }
+
+  if (err == 0) {
+    err = vma_map(vmas, vaddr, len, args->prot, flags, node, args->offset);
+    if (err)
+      vma_unmap(vmas, vaddr, len);
+  }
+  if (node)
+    kunlock(&current->fd_lock);
+
+  current->uregs.eax = err ? -err : vaddr;
+}
+
+static void syscall_munmap(uint32_t vaddr, uint32_t len)
+{
+  process_t *current = process_current();
+  len = u_page_align_up(len);
+  if (len == 0 || !user_range_is_valid(vaddr, len)) {
+    current->uregs.eax = -EINVAL;
+    return;
+  }
+  current->uregs.eax = -vma_unmap(&process_group_leader(current)->vmas, vaddr, len);
+}
+
+static void syscall_mprotect(uint32_t vaddr, uint32_t len, uint32_t prot)
+{
+  process_t *current = process_current();
+  len = u_page_align_up(len);
+  if (!user_range_is_valid(vaddr, len) || (prot & ~PROT_ALL)) {
+    current->uregs.eax = -EINVAL;
+    return;
+  }
+  current->uregs.eax = -vma_protect(&process_group_leader(current)->vmas, vaddr, len, prot);
+}
+
+static void syscall_shm_map(const char *name, uint32_t size, uint32_t flags)
+{
+  process_t *current = process_current();
+  shm_segment_t *shm;
+  uint32_t err = shm_get(&shm, name, u_page_align_up(size) >> PAGE_SIZE_SHIFT, flags);
+  if (err) {
+    current->uregs.eax = -err;
+    return;
+  }
+
+  // The whole segment is mapped, whatever its size was when it was created.
+  vma_t **vmas = &process_group_leader(current)->vmas;
+  uint32_t len = shm->npages << PAGE_SIZE_SHIFT;
+  uint32_t vaddr = paging_next_vaddr(shm->npages, current->mmap.heap);
+  err = vaddr ? vma_map_shm(vmas, vaddr, len, PROT_READ | PROT_WRITE, shm) : ENOMEM;
+  if (err) {
+    if (vaddr)
+      vma_unmap(vmas, vaddr, len);
+    shm_unref(shm);
+    current->uregs.eax = -err;
+    return;
+  }
+
+  current->uregs.eax = vaddr;
+}
+
+static void syscall_shm_unlink(const char *name)
+{
+  process_current()->uregs.eax = -shm_unlink(name);
+}
+
+// The heap is a single anonymous region that starts right after the
+// process image. Its whole range is reserved when the image is loaded,
+// so moving the break only has to resize the region. Pages are
+// zero-filled when they are first accessed.
+static void syscall_sbrk(int32_t increment)
+{
+  process_t *current = process_current();
+  process_t *leader = process_group_leader(current);
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t brk = leader->mmap.brk;
+  uint32_t new_brk = brk + increment;
+  uint8_t valid = increment < 0 ? new_brk >= leader->mmap.heap && new_brk < brk : new_brk >= brk;
+  if (!valid || new_brk - leader->mmap.heap > PROCESS_HEAP_MAX_SIZE) {
+    interrupt_restore(eflags);
+    current->uregs.eax = -ENOMEM;
+    return;
+  }
+
+  uint32_t end = u_page_align_up(brk);
+  uint32_t new_end = u_page_align_up(new_brk);
+  uint32_t err = 0;
+  if (new_end > end) {
+    err = vma_map(&leader->vmas,
+                  end,
+                  new_end - end,
+                  PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS,
+                  NULL,
+                  0);
+  } else if (new_end < end) {
+    // Keep the released range reserved for the heap.
+    err = vma_unmap(&leader->vmas, new_end, end - new_end);
+    paging_reserve_vaddr(new_end, (end - new_end) >> PAGE_SIZE_SHIFT);
+  }
+  if (err == 0)
+    leader->mmap.brk = new_brk;
+  interrupt_restore(eflags);
+
+  current->uregs.eax = err ? -err : brk;
+}
+
+// System memory statistics are always filled in, and process
+// statistics only if there is a process with the given pid.
+static void syscall_meminfo(uint32_t pid, meminfo_t *info)
+{
+  process_t *current = process_current();
+  if ((uint32_t)info >= KERNEL_START_VADDR - sizeof(meminfo_t)) {
+    current->uregs.eax = -EFAULT;
+    return;
+  }
+  u_memset(info, 0, sizeof(meminfo_t));
+
+  pmm_stats_t pmm;
+  pmm_get_stats(&pmm);
+  kheap_stats_t kheap;
+  kheap_get_stats(&kheap);
+  swap_stats_t swap;
+  swap_get_stats(&swap);
+  info->total = pmm.total_pages;
+  info->free = pmm.free_pages;
+  info->min_free = pmm.min_free_pages;
+  info->low_watermark = PMM_LOW_WATERMARK;
+  info->low_watermark_hits = pmm.low_watermark_hits;
+  info->kernel_heap = kheap.pages_mapped;
+  info->page_cache = text_page_count();
+  info->swap_total = swap.slots;
+  info->swap_used = swap.slots_used;
+
+  uint32_t eflags = interrupt_save_disable();
+  process_t *p = process_from_pid(pid);
+  if (p == NULL) {
+    interrupt_restore(eflags);
+    current->uregs.eax = -ESRCH;
+    return;
+  }
+  process_t *leader = process_group_leader(p);
+  paging_usage_t usage;
+  paging_get_usage(p->cr3, &usage);
+  info->resident = usage.resident_pages;
+  info->page_tables = usage.table_pages;
+  info->heap = (u_page_align_up(leader->mmap.brk) - leader->mmap.heap) >> PAGE_SIZE_SHIFT;
+  info->stack = (u_page_align_up(p->mmap.stack_top) - p->mmap.stack_bottom) >> PAGE_SIZE_SHIFT;
+  interrupt_restore(eflags);
+
+  current->uregs.eax = 0;
+}
+
+// Set the size limit of stacks that are made for new threads and for
+// images loaded by execve. A negative size leaves it unchanged.
+static void syscall_stacksize(int32_t size)
+{
+  process_t *current = process_current();
+  if (size >= 0) {
+    uint32_t limit = u_page_align_up(size);
+    if (limit < PAGE_SIZE)
+      limit = PAGE_SIZE;
+    if (limit > PROCESS_STACK_MAX_SIZE)
+      limit = PROCESS_STACK_MAX_SIZE;
+    current->stack_size = limit;
+  }
+  current->uregs.eax = current->stack_size;
+}
+
+static void syscall_schedinfo(uint32_t pid, schedinfo_t *info)
+{
+  process_t *current = process_current();
+  if ((uint32_t)info >= KERNEL_START_VADDR - sizeof(schedinfo_t)) {
+    current->uregs.eax = -EFAULT;
+    return;
+  }
+
+  uint32_t eflags = interrupt_save_disable();
+  process_t *p = process_from_pid(pid);
+  if (p == NULL) {
+    interrupt_restore(eflags);
+    current->uregs.eax = -ESRCH;
+    return;
+  }
+  schedinfo_t copy;
+  process_get_sched_info(p, &copy);
+  interrupt_restore(eflags);
+
+  // The buffer may fault, so it is written with interrupts enabled.
+  u_memcpy(info, &copy, sizeof(schedinfo_t));
+  current->uregs.eax = 0;
+}
+
+// Store the time of a clock in nanoseconds.
+static void syscall_clock_gettime(uint32_t clock, uint64_t *ns)
+{
+  process_t *current = process_current();
+  if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) {
+    current->uregs.eax = -EINVAL;
+    return;
+  }
+  if ((uint32_t)ns >= KERNEL_START_VADDR - sizeof(uint64_t)) {
+    current->uregs.eax = -EFAULT;
+    return;
+  }
+  *ns = clock_get_time_ns();
+  current->uregs.eax = 0;
+}
+
+// Wait until another thread wakes the futex at an address, unless the
+// word there is no longer `val`.
+static void syscall_futex_wait(uint32_t uaddr, uint32_t val)
+{
+  process_t *current = process_current();
+  current->uregs.eax = 0;
+  uint32_t res = futex_wait(current, uaddr, val);
+  if (res) {
+    current->uregs.eax = -res;
+    enable_interrupts();
+    return;
+  }
+  current->in_kernel = 0;
+  process_unschedule(current);
+  process_switch_next();
+}
+
+static void syscall_futex_wake(uint32_t uaddr, uint32_t count)
+{
+  uint32_t woken;
+  uint32_t res = futex_wake(uaddr, count, &woken);
+  process_current()->uregs.eax = res ? -res : woken;
+}
+
 static syscall_t syscall_table[] = {
   syscall_exit,
   syscall_fork,
@@ -895,10 +1174,24 @@ static syscall_t syscall_table[] = {
   syscall_ui_set_wallpaper,
   syscall_ui_resize_window,
   syscall_ui_enable_mouse_move_events,
+  syscall_mmap,
+  syscall_munmap,
+  syscall_mprotect,
+  syscall_shm_map,
+  syscall_shm_unlink,
+  syscall_sbrk,
+  syscall_meminfo,
+  syscall_stacksize,
+  syscall_schedinfo,
+  syscall_nanosleep,
+  syscall_clock_gettime,
+  syscall_futex_wait,
+  syscall_futex_wake,
 };
 
 process_registers_t *syscall_handler(cpu_state_t cs, stack_state_t ss)
 {
+  smp_lock_kernel();
   update_current_process_registers(cs, ss);
 
   process_t *current = process_current();
@@ -923,5 +1216,7 @@ process_registers_t *syscall_handler(cpu_state_t cs, stack_state_t ss)
     current->uregs.edx = current->current_signal;
   }
 
+  // This may be another CPU than the one that entered the system call.
+  smp_unlock_kernel();
   return &(current->uregs);
 }
@@ -0,0 +1,169 @@
+// text.c
+//
+// Read-only executable pages shared between processes.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "text.h"
+#include "../common/errno.h"
+#include "../common/stdint.h"
+#include "constants.h"
+#include "fs.h"
+#include "interrupt.h"
+#include "log.h"
+#include "pmm.h"
+#include "slab.h"
+#include <stddef.h>
+
+// Pages are identified by the file they were read from and the
+// virtual address that they are loaded at, since the contents of a page
+// depend on how the executable's segments are laid out. Every page is in
+// two hash tables: one keyed by its identity to find it when loading,
+// and one keyed by its physical address to forget it when it is freed.
+// The table itself holds no reference to the page.
+
+#define TEXT_BUCKETS 256
+
+typedef struct text_page_s
+{
+  void *device;
+  uint32_t inode;
+  uint32_t size;
+  uint32_t vaddr;
+  uint32_t paddr;
+  uint32_t key;  // Bucket in the identity table.
+  uint8_t stale; // Removed from the identity table?
+  struct text_page_s *next_by_key;
+  struct text_page_s *next_by_paddr;
+} text_page_t;
+
+static text_page_t *by_key[TEXT_BUCKETS];
+static text_page_t *by_paddr[TEXT_BUCKETS];
+static uint32_t page_count = 0;
+static kmem_cache_t text_page_cache = KMEM_CACHE_INIT("text_page", sizeof(text_page_t));
+
+static inline uint32_t key_hash(fs_node_t *node, uint32_t vaddr)
+{
+  return ((uint32_t)node->device ^ node->inode ^ (vaddr >> PAGE_SIZE_SHIFT)) % TEXT_BUCKETS;
+}
+static inline uint32_t paddr_hash(uint32_t paddr)
+{
+  return (paddr >> PAGE_SIZE_SHIFT) % TEXT_BUCKETS;
+}
+
+static inline uint8_t matches(text_page_t *page, fs_node_t *node, uint32_t vaddr)
+{
+  return page->device == node->device && page->inode == node->inode &&
+         page->size == node->size && page->vaddr == vaddr;
+}
+
+// Remove a page from the identity table.
+static void unlink_by_key(text_page_t *page)
+{
+  text_page_t **link = &by_key[page->key];
+  for (; *link; link = &(*link)->next_by_key) {
+    if (*link == page) {
+      *link = page->next_by_key;
+      return;
+    }
+  }
+}
+
+uint32_t text_find(fs_node_t *node, uint32_t vaddr)
+{
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t paddr = 0;
+  for (text_page_t *page = by_key[key_hash(node, vaddr)]; page; page = page->next_by_key) {
+    if (matches(page, node, vaddr)) {
+      paddr = page->paddr;
+      pmm_ref(paddr);
+      break;
+    }
+  }
+  interrupt_restore(eflags);
+  return paddr;
+}
+
+uint32_t text_insert(fs_node_t *node, uint32_t vaddr, uint32_t paddr)
+{
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t key = key_hash(node, vaddr);
+  for (text_page_t *page = by_key[key]; page; page = page->next_by_key) {
+    if (matches(page, node, vaddr)) {
+      interrupt_restore(eflags);
+      return EEXIST;
+    }
+  }
+
+  text_page_t *page = kmem_cache_alloc(&text_page_cache);
+  if (page == NULL) {
+    interrupt_restore(eflags);
+    log_error("text", "No memory.\n");
+    return ENOMEM;
+  }
+  page->device = node->device;
+  page->inode = node->inode;
+  page->size = node->size;
+  page->vaddr = vaddr;
+  page->paddr = paddr;
+  page->key = key;
+  page->stale = 0;
+  page->next_by_key = by_key[key];
+  by_key[key] = page;
+  page->next_by_paddr = by_paddr[paddr_hash(paddr)];
+  by_paddr[paddr_hash(paddr)] = page;
+  ++page_count;
+
+  interrupt_restore(eflags);
+  return 0;
+}
+
+void text_release(uint32_t paddr)
+{
+  // The page is only forgotten when the last reference is dropped, and
+  // before it is freed, since a free page may be allocated again.
+  uint32_t eflags = interrupt_save_disable();
+  if (pmm_refcount(paddr) != 1) {
+    pmm_free(paddr, 1);
+    interrupt_restore(eflags);
+    return;
+  }
+
+  text_page_t **link = &by_paddr[paddr_hash(paddr)];
+  for (; *link; link = &(*link)->next_by_paddr) {
+    text_page_t *page = *link;
+    if (page->paddr != paddr)
+      continue;
+    *link = page->next_by_paddr;
+    if (page->stale == 0)
+      unlink_by_key(page);
+    kmem_cache_free(&text_page_cache, page);
+    --page_count;
+    break;
+  }
+  pmm_free(paddr, 1);
+  interrupt_restore(eflags);
+}
+
+void text_invalidate(fs_node_t *node)
+{
+  uint32_t eflags = interrupt_save_disable();
+  for (uint32_t i = 0; i < TEXT_BUCKETS; ++i) {
+    text_page_t **link = &by_key[i];
+    while (*link) {
+      text_page_t *page = *link;
+      if (page->device != node->device || page->inode != node->inode) {
+        link = &page->next_by_key;
+        continue;
+      }
+      *link = page->next_by_key;
+      page->stale = 1;
+    }
+  }
+  interrupt_restore(eflags);
+}
+
+uint32_t text_page_count()
+{
+  return page_count;
+}
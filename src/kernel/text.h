@@ -0,0 +1,32 @@
+// text.h
+//
+// Read-only executable pages shared between processes.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _TEXT_H_
+#define _TEXT_H_
+
+#include "../common/stdint.h"
+#include "fs.h"
+
+// Find the shared page of an executable that is loaded at a virtual
+// address, and add a reference to it. Returns 0 if there is no such page.
+uint32_t text_find(fs_node_t *, uint32_t);
+
+// Share a newly loaded page of an executable. The caller's reference
+// becomes the first reference to the shared page. Returns 0 on success.
+uint32_t text_insert(fs_node_t *, uint32_t, uint32_t);
+
+// Drop a reference to a shared page. The page is freed and forgotten
+// once it is no longer mapped anywhere.
+void text_release(uint32_t);
+
+// Stop sharing the pages of a file, e.g because it was written to.
+// Pages that are already mapped stay mapped.
+void text_invalidate(fs_node_t *);
+
+// Get the number of shared pages.
+uint32_t text_page_count();
+
+#endif /* _TEXT_H_ */
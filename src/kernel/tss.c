@@ -7,32 +7,37 @@
 
 #include "tss.h"
 #include "../common/stdint.h"
+#include "smp.h"
 #include "util.h"
 
-// Global TSS struct.
-static tss_t tss;
+// TSS structs, one per CPU, since each CPU enters the kernel on the
+// kernel stack of the process that it runs.
+static tss_t tss[MAX_CPU_COUNT];
 
 // Initialize TSS.
 void tss_init()
 {
-  u_memset(&tss, 0, sizeof(tss_t));
-  tss.iopb_offset = sizeof(tss_t);
-  tss.cs = 0xB;
-  tss.ss = 0x13;
-  tss.ds = 0x13;
-  tss.es = 0x13;
-  tss.fs = 0x13;
-  tss.gs = 0x13;
+  for (uint32_t cpu = 0; cpu < MAX_CPU_COUNT; ++cpu) {
+    u_memset(&tss[cpu], 0, sizeof(tss_t));
+    tss[cpu].iopb_offset = sizeof(tss_t);
+    tss[cpu].cs = 0xB;
+    tss[cpu].ss = 0x13;
+    tss[cpu].ds = 0x13;
+    tss[cpu].es = 0x13;
+    tss[cpu].fs = 0x13;
+    tss[cpu].gs = 0x13;
+  }
 }
 
-// Get the address of the TSS struct.
-uint32_t tss_get_vaddr()
+// Get the address of the TSS struct of a CPU.
+uint32_t tss_get_vaddr(uint32_t cpu)
 {
-  return (uint32_t)&tss;
+  return (uint32_t)&tss[cpu];
 }
 
 void tss_set_kernel_stack(uint16_t ss0, uint32_t esp0)
 {
-  tss.ss0 = ss0;
-  tss.esp0 = esp0;
+  uint32_t cpu = smp_cpu_id();
+  tss[cpu].ss0 = ss0;
+  tss[cpu].esp0 = esp0;
 }
@@ -59,15 +59,16 @@ struct tss_s
 } __attribute__((packed));
 typedef struct tss_s tss_t;
 
-// Initialize TSS.
+// Initialize the TSS of every CPU.
 void tss_init();
 
 // Implemented in tss.s.
 void tss_load_set(uint16_t);
 
-// Get the address of the TSS struct.
-uint32_t tss_get_vaddr();
+// Get the address of the TSS struct of a CPU.
+uint32_t tss_get_vaddr(uint32_t);
 
+// Set the kernel stack of this CPU.
 void tss_set_kernel_stack(uint16_t, uint32_t);
 
 #endif /* _TSS_H_ */
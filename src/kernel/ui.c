@@ -7,11 +7,12 @@
 
 #include "ui.h"
 #include "../common/scancode.h"
+#include "constants.h"
 #include "ds.h"
 #include "fs.h"
 #include "interrupt.h"
 #include "kheap.h"
-#include "klock.h"
+#include "kmutex.h"
 #include "log.h"
 #include "paging.h"
 #include "pipe.h"
@@ -32,7 +33,7 @@
 #define CHECK_UNLOCK_R(err, msg, code)                                                             \
   if ((err)) {                                                                                     \
     log_error("ui", msg "\n");                                                                     \
-    kunlock(&responders_lock);                                                                     \
+    kmutex_unlock(&responders_lock);                                                               \
     return (code);                                                                                 \
   }
 #define CHECK_RESTORE_EFLAGS(err, msg, code)                                                       \
@@ -99,7 +100,7 @@ static bool key_lshift_pressed = false;
 static bool key_rshift_pressed = false;
 
 static list_t responders;
-static volatile uint32_t responders_lock = 0;
+static kmutex_t responders_lock;
 
 static struct responder *responders_by_gid[MAX_PROCESS_COUNT];
 
@@ -655,10 +656,17 @@ uint32_t ui_init(uint32_t video_vaddr)
 {
   u_memset(responders_by_gid, 0, sizeof(responders_by_gid));
   u_memset(&responders, 0, sizeof(list_t));
+  // Processes that wait for the UI are often interactive.
+  kmutex_init(&responders_lock, "ui responders", 1);
   frame_buffer.buf = (uint32_t *)video_vaddr;
   frame_buffer.stride = SCREENWIDTH;
 
-  back_buffer.buf = kmalloc(frame_size * sizeof(uint32_t));
+  // The back buffer is copied to the frame buffer on every redraw, so
+  // it is mapped with large pages if possible to reduce TLB misses.
+  back_buffer.buf = paging_alloc_kernel_region(u_page_align_up(frame_size * sizeof(uint32_t))
+                                               >> PAGE_SIZE_SHIFT);
+  if (back_buffer.buf == NULL)
+    back_buffer.buf = kmalloc(frame_size * sizeof(uint32_t));
   CHECK(back_buffer.buf == NULL, "Failed to allocate back_buffer", ENOMEM);
   back_buffer.stride = SCREENWIDTH;
 
@@ -687,7 +695,7 @@ uint32_t ui_init(uint32_t video_vaddr)
   u_memcpy(name_buf + path_strlen, wallpaper_dirent->d_name, dirent_strlen + 1);
   err = ui_set_wallpaper(name_buf);
   CHECK(err, "Failed to set wallpaper", err);
-  kfree(wallpaper_dirent);
+  fs_dirent_free(wallpaper_dirent);
 
   return 0;
 }
@@ -800,7 +808,7 @@ static void handle_mouse_click()
                       r->window_pos.y - TITLE_BAR_HEIGHT,
                       TITLE_BAR_BUTTON_WIDTH,
                       TITLE_BAR_HEIGHT)) {
-      if (!responders_lock)
+      if (!responders_lock.locked)
         process_kill(r->process);
       return;
     }
@@ -1102,7 +1110,7 @@ uint32_t ui_handle_mouse_event(int32_t dx,
 
 uint32_t ui_make_responder(process_t *p, uint32_t buf, const char *title, uint32_t w, uint32_t h)
 {
-  klock(&responders_lock);
+  kmutex_lock(&responders_lock);
   CHECK_UNLOCK_R(responders_by_gid[p->gid] != NULL, "Process already has window.", 1);
 
   struct responder *r = kmalloc(sizeof(struct responder));
@@ -1153,16 +1161,16 @@ uint32_t ui_make_responder(process_t *p, uint32_t buf, const char *title, uint32
     err = dispatch_window_event(responders.head->next->value, UI_EVENT_SLEEP);
     CHECK_UNLOCK_R(err, "Failed to dispatch sleep event.", err);
   }
-  kunlock(&responders_lock);
+  kmutex_unlock(&responders_lock);
   return 0;
 }
 
 uint32_t ui_kill(process_t *p)
 {
-  klock(&responders_lock);
+  kmutex_lock(&responders_lock);
   struct responder *r = responders_by_gid[p->gid];
   if (r == NULL) {
-    kunlock(&responders_lock);
+    kmutex_unlock(&responders_lock);
     return 0;
   }
 
@@ -1197,7 +1205,7 @@ uint32_t ui_kill(process_t *p)
     CHECK_UNLOCK_R(err, "Failed to dispatch wake event.", err);
   }
 
-  kunlock(&responders_lock);
+  kmutex_unlock(&responders_lock);
 
   if (!is_head)
     redraw_all();
@@ -1240,15 +1248,15 @@ uint32_t ui_redraw_rect(process_t *p, uint32_t x, uint32_t y, uint32_t w, uint32
 
 uint32_t ui_yield(process_t *p)
 {
-  klock(&responders_lock);
+  kmutex_lock(&responders_lock);
   struct responder *r = responders_by_gid[p->gid];
   if (r == NULL) {
-    kunlock(&responders_lock);
+    kmutex_unlock(&responders_lock);
     return 1;
   }
 
   if (responders.head->value != r || responders.size <= 1) {
-    kunlock(&responders_lock);
+    kmutex_unlock(&responders_lock);
     return 0;
   }
 
@@ -1265,7 +1273,7 @@ uint32_t ui_yield(process_t *p)
   err = dispatch_window_event(responders.head->value, UI_EVENT_WAKE);
   CHECK_UNLOCK_R(err, "Failed to dispatch wake event.", err);
 
-  kunlock(&responders_lock);
+  kmutex_unlock(&responders_lock);
 
   redraw_all();
   return 0;
@@ -1273,14 +1281,14 @@ uint32_t ui_yield(process_t *p)
 
 uint32_t ui_next_event(process_t *p, uint32_t buf)
 {
-  klock(&responders_lock);
+  kmutex_lock(&responders_lock);
   struct responder *r = responders_by_gid[p->gid];
   if (r == NULL) {
-    kunlock(&responders_lock);
+    kmutex_unlock(&responders_lock);
     return 1;
   }
   // Do not hold responders lock while blocking on event_pipe_read
-  kunlock(&responders_lock);
+  kmutex_unlock(&responders_lock);
 
   uint8_t ev_buf[sizeof(ui_event_t)];
   uint32_t read_size = fs_read(&r->event_pipe_read, 0, sizeof(ui_event_t), ev_buf);
@@ -1299,12 +1307,12 @@ uint32_t ui_next_event(process_t *p, uint32_t buf)
 
 uint32_t ui_poll_events(process_t *p)
 {
-  klock(&responders_lock);
+  kmutex_lock(&responders_lock);
   struct responder *r = responders_by_gid[p->gid];
   uint32_t count = 0;
   if (r != NULL)
     count = r->event_pipe_read.size / sizeof(ui_event_t);
-  kunlock(&responders_lock);
+  kmutex_unlock(&responders_lock);
   return count;
 }
 
@@ -1325,12 +1333,12 @@ uint32_t ui_set_wallpaper(const char *path)
 
 uint32_t ui_resize_window(process_t *p, uint32_t buf, uint32_t w, uint32_t h)
 {
-  klock(&responders_lock);
+  kmutex_lock(&responders_lock);
   struct responder *r = responders_by_gid[p->gid];
   CHECK_UNLOCK_R(r == NULL, "Process does not have window.", 1);
 
   uint32_t eflags = interrupt_save_disable();
-  kunlock(&responders_lock);
+  kmutex_unlock(&responders_lock);
 
   struct dim old_dim = window_chrome_dim(r->window_dim);
   if (r == responders.head->value) {
@@ -1389,10 +1397,10 @@ uint32_t ui_resize_window(process_t *p, uint32_t buf, uint32_t w, uint32_t h)
 
 uint32_t ui_enable_mouse_move_events(process_t *p)
 {
-  klock(&responders_lock);
+  kmutex_lock(&responders_lock);
   struct responder *r = responders_by_gid[p->gid];
   CHECK_UNLOCK_R(r == NULL, "Process does not have window.", 1);
   r->mouse_move_events_enabled = true;
-  kunlock(&responders_lock);
+  kmutex_unlock(&responders_lock);
   return 0;
 }
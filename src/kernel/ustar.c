@@ -10,7 +10,7 @@
 #include "../common/stdint.h"
 #include "fs.h"
 #include "kheap.h"
-#include "klock.h"
+#include "kmutex.h"
 #include "log.h"
 #include "util.h"
 
@@ -22,14 +22,14 @@
 #define CHECK_UNLOCK(err, msg, code)                                                               \
   if ((err)) {                                                                                     \
     log_error("ustar", msg "\n");                                                                  \
-    kunlock(&(self->lock));                                                                        \
+    kmutex_unlock(&(self->lock));                                                                  \
     return (code);                                                                                 \
   }
 
 typedef struct
 {
   fs_node_t *block_device;
-  volatile uint32_t lock;
+  kmutex_t lock;
 } ustar_fs_t;
 
 struct ustar_metadata_s
@@ -174,14 +174,14 @@ void ustar_open(fs_node_t *node, uint32_t flags)
   if (size == 0)
     return;
 
-  klock(&(self->lock));
+  kmutex_lock(&(self->lock));
 
   uint32_t new_size = block_align_up(size) - BLOCK_SIZE;
   write_oct(data.size, 0, sizeof(data.size));
   uint32_t write_size = fs_write(self->block_device, disk_offset, BLOCK_SIZE, (uint8_t *)&data);
   if (write_size != BLOCK_SIZE) {
     log_error("ustar", "Failed to update metadata.\n");
-    kunlock(&(self->lock));
+    kmutex_unlock(&(self->lock));
     return;
   }
   ustar_metadata_t new_data = data;
@@ -190,7 +190,7 @@ void ustar_open(fs_node_t *node, uint32_t flags)
   write_size =
     fs_write(self->block_device, disk_offset + BLOCK_SIZE, BLOCK_SIZE, (uint8_t *)&new_data);
 
-  kunlock(&(self->lock));
+  kmutex_unlock(&(self->lock));
 
   if (write_size != BLOCK_SIZE) {
     log_error("ustar", "Failed to update metadata.\n");
@@ -225,7 +225,7 @@ uint32_t ustar_read(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *bu
 uint32_t ustar_write(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buf)
 {
   ustar_fs_t *self = node->device;
-  klock(&(self->lock));
+  kmutex_lock(&(self->lock));
 
   uint32_t disk_offset = node->inode;
   ustar_metadata_t data;
@@ -274,7 +274,7 @@ uint32_t ustar_write(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *b
     write_size = fs_write(self->block_device, disk_offset + BLOCK_SIZE + offset, size, buf);
 
     if (block_align_up(new_end) == block_align_up(current_end)) {
-      kunlock(&(self->lock));
+      kmutex_unlock(&(self->lock));
       return write_size;
     }
 
@@ -294,7 +294,7 @@ uint32_t ustar_write(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *b
       CHECK_UNLOCK(ws != BLOCK_SIZE, "Failed to create free block", write_size);
     }
 
-    kunlock(&(self->lock));
+    kmutex_unlock(&(self->lock));
     return write_size;
   }
 
@@ -317,14 +317,14 @@ uint32_t ustar_write(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *b
   uint32_t ws = fs_write(self->block_device, disk_offset, BLOCK_SIZE, (uint8_t *)&data);
   CHECK_UNLOCK(ws != BLOCK_SIZE, "Failed to update metadata.", write_size);
 
-  kunlock(&(self->lock));
+  kmutex_unlock(&(self->lock));
   return size - (new_end - write_size);
 }
 
 struct dirent *ustar_readdir(fs_node_t *node, uint32_t idx)
 {
   ustar_fs_t *self = node->device;
-  struct dirent *ent = kmalloc(sizeof(struct dirent));
+  struct dirent *ent = fs_dirent_alloc();
   CHECK(ent == NULL, "No memory.", NULL);
   u_memset(ent, 0, sizeof(struct dirent));
 
@@ -381,7 +381,7 @@ struct dirent *ustar_readdir(fs_node_t *node, uint32_t idx)
     return ent;
   }
 
-  kfree(ent);
+  fs_dirent_free(ent);
   return NULL;
 }
 
@@ -408,7 +408,7 @@ fs_node_t *ustar_finddir(fs_node_t *node, char *name)
   uint32_t read_size = fs_read(self->block_device, disk_offset, BLOCK_SIZE, (uint8_t *)&data);
   CHECK(read_size != BLOCK_SIZE, "Failed to read metadata.", NULL);
 
-  fs_node_t *out = kmalloc(sizeof(fs_node_t));
+  fs_node_t *out = fs_node_alloc();
   CHECK(out == NULL, "No memory.", NULL);
   make_ustar_node(self, disk_offset, data, out);
 
@@ -420,7 +420,7 @@ int32_t ustar_create_entry(fs_node_t *node, char *name, uint16_t mask, char type
   ustar_fs_t *self = node->device;
   fs_node_t *existing = ustar_finddir(node, name);
   if (existing) {
-    kfree(existing);
+    fs_node_free(existing);
     return -EEXIST;
   }
 
@@ -446,14 +446,14 @@ int32_t ustar_create_entry(fs_node_t *node, char *name, uint16_t mask, char type
   write_oct(data.size, 0, sizeof(data.size));
   data.type = type;
 
-  klock(&(self->lock));
+  kmutex_lock(&(self->lock));
   uint32_t disk_offset = ustar_alloc(self, 0);
   CHECK_UNLOCK(disk_offset == 0, "No space.", -ENOSPC);
 
   uint32_t write_size = fs_write(self->block_device, disk_offset, BLOCK_SIZE, (uint8_t *)&data);
   CHECK_UNLOCK(write_size != BLOCK_SIZE, "Failed to write metadata.", -ENOSPC);
 
-  kunlock(&(self->lock));
+  kmutex_unlock(&(self->lock));
   return 0;
 }
 
@@ -477,11 +477,11 @@ int32_t ustar_unlink(fs_node_t *node, char *name)
   if (child == NULL)
     return -ENOENT;
   uint32_t disk_offset = child->inode;
-  kfree(child);
+  fs_node_free(child);
 
   // TODO coalesce free blocks
 
-  klock(&(self->lock));
+  kmutex_lock(&(self->lock));
   ustar_metadata_t data;
   uint32_t r = fs_read(self->block_device, disk_offset, BLOCK_SIZE, (uint8_t *)&data);
   CHECK_UNLOCK(r != BLOCK_SIZE, "Failed to read metadata.", -ENOENT);
@@ -489,7 +489,7 @@ int32_t ustar_unlink(fs_node_t *node, char *name)
   r = fs_write(self->block_device, disk_offset, BLOCK_SIZE, (uint8_t *)&data);
   CHECK_UNLOCK(r != BLOCK_SIZE, "Failed to write metadata.", -ENOENT);
 
-  kunlock(&(self->lock));
+  kmutex_unlock(&(self->lock));
   return 0;
 }
 
@@ -537,9 +537,9 @@ int32_t ustar_rename(fs_node_t *node, char *from, char *to)
   u_memcpy(path + len, to, u_strlen(to));
 
   uint32_t disk_offset = child->inode;
-  kfree(child);
+  fs_node_free(child);
 
-  klock(&(self->lock));
+  kmutex_lock(&(self->lock));
   ustar_metadata_t data;
   uint32_t r = fs_read(self->block_device, disk_offset, BLOCK_SIZE, (uint8_t *)&data);
   CHECK_UNLOCK(r != BLOCK_SIZE, "Failed to read metadata.", -ENOENT);
@@ -547,7 +547,7 @@ int32_t ustar_rename(fs_node_t *node, char *from, char *to)
   r = fs_write(self->block_device, disk_offset, BLOCK_SIZE, (uint8_t *)&data);
   CHECK_UNLOCK(r != BLOCK_SIZE, "Failed to write metadata.", -ENOENT);
 
-  kunlock(&(self->lock));
+  kmutex_unlock(&(self->lock));
   return 0;
 }
 
@@ -588,12 +588,13 @@ uint32_t ustar_init(fs_node_t *block_device)
   CHECK(fs == NULL, "No memory", ENOMEM);
   u_memset(fs, 0, sizeof(ustar_fs_t));
   fs->block_device = block_device;
+  kmutex_init(&fs->lock, "ustar", 0);
 
   ustar_metadata_t data;
   uint32_t read_size = fs_read(fs->block_device, 0, BLOCK_SIZE, (uint8_t *)&data);
   CHECK(read_size != BLOCK_SIZE, "Failed to read root metadata.", -1);
 
-  fs_node_t *node = kmalloc(sizeof(fs_node_t));
+  fs_node_t *node = fs_node_alloc();
   CHECK(node == NULL, "No memory.", ENOMEM);
   make_ustar_node(fs, 0, data, node);
 
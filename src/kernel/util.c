@@ -74,3 +74,16 @@ size_t u_page_align_down(uint32_t a)
 {
   return a & 0xFFFFF000;
 }
+
+uint64_t u_div64(uint64_t n, uint32_t d, uint32_t *rem)
+{
+  // Divide the high half first so that the second divl cannot overflow.
+  uint32_t hi = n >> 32;
+  uint32_t q_hi = hi / d;
+  uint32_t r = hi % d;
+  uint32_t q_lo;
+  asm("divl %4" : "=a"(q_lo), "=d"(r) : "a"((uint32_t)n), "d"(r), "rm"(d) : "flags");
+  if (rem)
+    *rem = r;
+  return ((uint64_t)q_hi << 32) | q_lo;
+}
@@ -21,4 +21,8 @@ int32_t u_strncmp(const char *, const char *, size_t);
 size_t u_page_align_up(size_t a);
 size_t u_page_align_down(uint32_t a);
 
+// Divide a 64-bit number by a 32-bit one without libgcc. Stores the
+// remainder in `rem` if it is not NULL.
+uint64_t u_div64(uint64_t n, uint32_t d, uint32_t *rem);
+
 #endif /* _UTIL_H_ */
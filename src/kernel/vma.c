@@ -0,0 +1,446 @@
+// vma.c
+//
+// Memory mapped regions of user address spaces.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "vma.h"
+#include "../common/errno.h"
+#include "../common/mman.h"
+#include "../common/stdint.h"
+#include "constants.h"
+#include "fs.h"
+#include "interrupt.h"
+#include "kheap.h"
+#include "log.h"
+#include "paging.h"
+#include "pmm.h"
+#include "slab.h"
+#include "text.h"
+#include "util.h"
+#include <stddef.h>
+
+#define CHECK(err, msg, code)                                                                      \
+  if ((err)) {                                                                                     \
+    log_error("vma", msg "\n");                                                                    \
+    return (code);                                                                                 \
+  }
+
+#define CHECK_RESTORE(err, msg, code)                                                              \
+  if ((err)) {                                                                                     \
+    log_error("vma", msg "\n");                                                                    \
+    interrupt_restore(eflags);                                                                     \
+    return (code);                                                                                 \
+  }
+
+static kmem_cache_t vma_cache = KMEM_CACHE_INIT("vma", sizeof(vma_t));
+static kmem_cache_t vma_file_cache = KMEM_CACHE_INIT("vma_file", sizeof(vma_file_t));
+
+static void file_unref(vma_file_t *file)
+{
+  if (file == NULL)
+    return;
+  --file->refcount;
+  if (file->refcount == 0)
+    kmem_cache_free(&vma_file_cache, file);
+}
+
+// Add references to the file and segment of a copied region.
+static void vma_ref(vma_t *vma)
+{
+  if (vma->file)
+    ++vma->file->refcount;
+  if (vma->shm)
+    shm_ref(vma->shm);
+}
+
+static void vma_free(vma_t *vma)
+{
+  file_unref(vma->file);
+  if (vma->shm)
+    shm_unref(vma->shm);
+  kmem_cache_free(&vma_cache, vma);
+}
+
+vma_t *vma_find(vma_t *vma, uint32_t vaddr)
+{
+  for (; vma && vma->start <= vaddr; vma = vma->next)
+    if (vaddr < vma->end)
+      return vma;
+  return NULL;
+}
+
+// Split a region in two at an address inside it.
+static uint32_t vma_split(vma_t *vma, uint32_t vaddr)
+{
+  vma_t *after = kmem_cache_alloc(&vma_cache);
+  CHECK(after == NULL, "No memory.", ENOMEM);
+  u_memcpy(after, vma, sizeof(vma_t));
+  after->start = vaddr;
+  after->offset += vaddr - vma->start;
+  vma_ref(after);
+  vma->end = vaddr;
+  vma->next = after;
+  return 0;
+}
+
+// Split the regions that straddle the ends of a range, so that every
+// region is either inside or outside of the range.
+static uint32_t vma_split_range(vma_t **list, uint32_t vaddr, uint32_t end)
+{
+  vma_t *vma = vma_find(*list, vaddr);
+  if (vma && vma->start < vaddr && vma_split(vma, vaddr))
+    return ENOMEM;
+  vma = vma_find(*list, end - 1);
+  if (vma && vma->end > end && vma_split(vma, end))
+    return ENOMEM;
+  return 0;
+}
+
+// Write a copy of a page of a shared file region back to the file.
+static void write_back(vma_file_t *file, uint32_t offset, uint8_t *page)
+{
+  fs_node_t *node = &file->node;
+  if (offset >= node->size)
+    return;
+  uint32_t size = node->size - offset < PAGE_SIZE ? node->size - offset : PAGE_SIZE;
+
+  // Writing to the file may let other processes run, which changes cr3.
+  uint32_t cr3 = paging_get_cr3();
+  int32_t res = fs_write(node, offset, size, page);
+  paging_set_cr3(cr3);
+  if (res != (int32_t)size)
+    log_error("vma", "Failed to write back offset %x.\n", offset);
+}
+
+// Write the dirty pages of shared file regions in a range back to their
+// files. Writing may sleep and let other threads change the regions, so
+// each page is copied into a buffer and its file is referenced while it
+// is written, and nothing is unmapped until this is done.
+static void write_back_range(vma_t **list, uint32_t vaddr, uint32_t end)
+{
+  uint8_t *buffer = NULL;
+  for (uint32_t page = vaddr; page < end; page += PAGE_SIZE) {
+    uint32_t eflags = interrupt_save_disable();
+    vma_t *vma = vma_find(*list, page);
+    page_table_entry_t *pte = paging_get_pte(page);
+    if (vma == NULL || vma->file == NULL || (vma->flags & MAP_SHARED) == 0 || pte == NULL ||
+        pte->present == 0 || pte->dirty == 0) {
+      interrupt_restore(eflags);
+      continue;
+    }
+    if (buffer == NULL)
+      buffer = kheap_alloc_pages(1);
+    if (buffer == NULL) {
+      interrupt_restore(eflags);
+      log_error("vma", "No memory to write back pages.\n");
+      return;
+    }
+    u_memcpy(buffer, (void *)page, PAGE_SIZE);
+    vma_file_t *file = vma->file;
+    uint32_t offset = vma->offset + (page - vma->start);
+    ++file->refcount;
+    interrupt_restore(eflags);
+
+    write_back(file, offset, buffer);
+
+    eflags = interrupt_save_disable();
+    file_unref(file);
+    interrupt_restore(eflags);
+  }
+  if (buffer)
+    kheap_free_pages(buffer, 1);
+}
+
+// Unmap and free a page, which may or may not be part of a region.
+static void unmap_page(uint32_t vaddr)
+{
+  page_table_entry_t *pte = paging_get_pte(vaddr);
+  if (pte && pte->present) {
+    if (pte->text)
+      text_release(pte->frame_addr << PAGE_SIZE_SHIFT);
+    else
+      pmm_free(pte->frame_addr << PAGE_SIZE_SHIFT, 1);
+  }
+
+  // This also releases the virtual page if it was only reserved.
+  paging_unmap(vaddr);
+}
+
+// Allocate a region.
+static vma_t *vma_alloc(uint32_t vaddr, uint32_t len, uint32_t prot, uint32_t flags)
+{
+  vma_t *vma = kmem_cache_alloc(&vma_cache);
+  CHECK(vma == NULL, "No memory.", NULL);
+  u_memset(vma, 0, sizeof(vma_t));
+  vma->start = vaddr;
+  vma->end = vaddr + len;
+  vma->prot = prot;
+  vma->flags = flags;
+  return vma;
+}
+
+// Can two regions be merged into one?
+static inline uint8_t vma_mergeable(vma_t *a, vma_t *b)
+{
+  return a->end == b->start && a->file == NULL && b->file == NULL && a->shm == NULL &&
+         b->shm == NULL && a->prot == b->prot && a->flags == b->flags;
+}
+
+// Insert a region into the list in order of address. An anonymous
+// region is merged into the one before it if they are alike, so that
+// a heap that grows one piece at a time stays a single region.
+// Fails if the region overlaps another one, in which case the caller
+// still owns it.
+static uint32_t vma_insert(vma_t **list, vma_t *vma)
+{
+  uint32_t eflags = interrupt_save_disable();
+  vma_t *prev = NULL;
+  vma_t **link = list;
+  while (*link && (*link)->start < vma->start) {
+    prev = *link;
+    link = &(*link)->next;
+  }
+  uint8_t overlaps = (prev && prev->end > vma->start) || (*link && (*link)->start < vma->end);
+  CHECK_RESTORE(overlaps, "Region overlaps another region.", EEXIST);
+
+  if (prev && vma_mergeable(prev, vma)) {
+    prev->end = vma->end;
+    vma_free(vma);
+  } else {
+    vma->next = *link;
+    *link = vma;
+  }
+  interrupt_restore(eflags);
+  return 0;
+}
+
+uint32_t vma_map(vma_t **list,
+                 uint32_t vaddr,
+                 uint32_t len,
+                 uint32_t prot,
+                 uint32_t flags,
+                 fs_node_t *node,
+                 uint32_t offset)
+{
+  vma_t *vma = vma_alloc(vaddr, len, prot, flags);
+  if (vma == NULL)
+    return ENOMEM;
+  vma->offset = offset;
+
+  if (node) {
+    vma->file = kmem_cache_alloc(&vma_file_cache);
+    if (vma->file == NULL)
+      kmem_cache_free(&vma_cache, vma);
+    CHECK(vma->file == NULL, "No memory.", ENOMEM);
+    u_memcpy(&vma->file->node, node, sizeof(fs_node_t));
+    vma->file->refcount = 1;
+  }
+
+  uint32_t err = vma_insert(list, vma);
+  if (err)
+    vma_free(vma);
+  return err;
+}
+
+uint32_t vma_map_shm(vma_t **list, uint32_t vaddr, uint32_t len, uint32_t prot, shm_segment_t *shm)
+{
+  vma_t *vma = vma_alloc(vaddr, len, prot, MAP_SHARED);
+  if (vma == NULL)
+    return ENOMEM;
+  vma->shm = shm;
+  uint32_t err = vma_insert(list, vma);
+  if (err) {
+    // The caller keeps its reference to the segment.
+    vma->shm = NULL;
+    vma_free(vma);
+  }
+  return err;
+}
+
+uint32_t vma_unmap(vma_t **list, uint32_t vaddr, uint32_t len)
+{
+  uint32_t end = vaddr + len;
+  write_back_range(list, vaddr, end);
+
+  uint32_t eflags = interrupt_save_disable();
+  CHECK_RESTORE(vma_split_range(list, vaddr, end), "Failed to split region.", ENOMEM);
+
+  for (uint32_t page = vaddr; page < end; page += PAGE_SIZE)
+    unmap_page(page);
+
+  vma_t **link = list;
+  while (*link && (*link)->start < end) {
+    vma_t *vma = *link;
+    if (vma->start < vaddr) {
+      link = &vma->next;
+      continue;
+    }
+    *link = vma->next;
+    vma_free(vma);
+  }
+
+  interrupt_restore(eflags);
+  return 0;
+}
+
+uint32_t vma_protect(vma_t **list, uint32_t vaddr, uint32_t len, uint32_t prot)
+{
+  uint32_t end = vaddr + len;
+  uint32_t eflags = interrupt_save_disable();
+  for (uint32_t page = vaddr; page < end;) {
+    vma_t *vma = vma_find(*list, page);
+    CHECK_RESTORE(vma == NULL, "Range is not mapped.", ENOMEM);
+    page = vma->end;
+  }
+  CHECK_RESTORE(vma_split_range(list, vaddr, end), "Failed to split region.", ENOMEM);
+
+  // Pages that have already been loaded are updated in place, as are
+  // pages that have been swapped out. Private pages that are shared with
+  // another address space, e.g after a fork, stay read-only and are
+  // copied when they are first written.
+  for (vma_t *vma = vma_find(*list, vaddr); vma && vma->start < end; vma = vma->next) {
+    vma->prot = prot;
+    for (uint32_t page = vma->start; page < vma->end; page += PAGE_SIZE) {
+      page_table_entry_t *pte = paging_get_pte(page);
+      if (pte == NULL || (pte->present == 0 && pte->swapped == 0))
+        continue;
+      uint32_t paddr = pte->frame_addr << PAGE_SIZE_SHIFT;
+      if ((prot & PROT_WRITE) && pte->present && pte->shared == 0 && pmm_refcount(paddr) > 1)
+        pte->cow = 1;
+      pte->user = prot != PROT_NONE;
+      pte->rw = (prot & PROT_WRITE) && pte->cow == 0;
+      paging_invalidate_pte(page);
+    }
+  }
+
+  interrupt_restore(eflags);
+  return 0;
+}
+
+uint32_t vma_fault(vma_t **list, uint32_t vaddr, uint8_t write)
+{
+  uint32_t page_vaddr = u_page_align_down(vaddr);
+  uint32_t eflags = interrupt_save_disable();
+  vma_t *vma = vma_find(*list, vaddr);
+  if (vma == NULL) {
+    interrupt_restore(eflags);
+    return 1;
+  }
+  if (vma->prot == PROT_NONE || (write && (vma->prot & PROT_WRITE) == 0)) {
+    interrupt_restore(eflags);
+    return EACCES;
+  }
+  // Writes to present pages are copy-on-write faults.
+  if (paging_get_paddr(page_vaddr)) {
+    interrupt_restore(eflags);
+    return 1;
+  }
+
+  page_table_entry_t flags;
+  u_memset(&flags, 0, sizeof(flags));
+  flags.user = 1;
+  flags.rw = (vma->prot & PROT_WRITE) != 0;
+  flags.shared = (vma->flags & MAP_SHARED) != 0;
+  uint32_t offset = vma->offset + (page_vaddr - vma->start);
+
+  // Segment pages are shared by every mapping, and each mapping holds a
+  // reference to the page.
+  if (vma->shm) {
+    uint32_t paddr = shm_frame(vma->shm, offset >> PAGE_SIZE_SHIFT);
+    CHECK_RESTORE(paddr == 0, "No memory.", ENOMEM);
+    paging_result_t res = paging_map(page_vaddr, paddr, flags);
+    if (res == PAGING_OK)
+      pmm_ref(paddr);
+    interrupt_restore(eflags);
+    return res;
+  }
+
+  vma_file_t *file = vma->file;
+  if (file)
+    ++file->refcount;
+  interrupt_restore(eflags);
+
+  // File pages are read into a buffer and only mapped once they are
+  // complete, since reading the file may sleep and let other threads run.
+  uint32_t err = 0;
+  uint32_t paddr = pmm_alloc(1);
+  if (paddr == 0)
+    err = ENOMEM;
+  else if (file == NULL || offset >= file->node.size) {
+    if (paging_zero_page(paddr) != PAGING_OK)
+      err = ENOMEM;
+  } else {
+    uint8_t *page = kheap_alloc_pages(1);
+    if (page) {
+      u_memset(page, 0, PAGE_SIZE);
+      uint32_t size = file->node.size - offset;
+      size = size < PAGE_SIZE ? size : PAGE_SIZE;
+      if (fs_read(&file->node, offset, size, page) != (int32_t)size)
+        err = EIO;
+      if (err == 0 && paging_copy_to_page(paddr, page) != PAGING_OK)
+        err = ENOMEM;
+      kheap_free_pages(page, 1);
+    } else
+      err = ENOMEM;
+  }
+
+  eflags = interrupt_save_disable();
+  // The region may have been unmapped, or the page loaded by another
+  // thread, in the meantime.
+  if (err == 0 && vma_find(*list, vaddr) && paging_get_paddr(page_vaddr) == 0) {
+    paging_result_t res = paging_map(page_vaddr, paddr, flags);
+    if (res == PAGING_OK)
+      paddr = 0;
+    else
+      err = res;
+  }
+  file_unref(file);
+  interrupt_restore(eflags);
+
+  if (paddr)
+    pmm_free(paddr, 1);
+  CHECK(err, "Failed to load page.", err);
+  return 0;
+}
+
+uint32_t vma_clone(vma_t **dst, vma_t **src)
+{
+  for (vma_t *vma = *src; vma; vma = vma->next) {
+    if ((vma->flags & MAP_SHARED) == 0)
+      continue;
+    for (uint32_t page = vma->start; page < vma->end; page += PAGE_SIZE) {
+      uint32_t err = vma_fault(src, page, 0);
+      CHECK(err != 0 && err != 1, "Failed to load shared page.", err);
+    }
+  }
+
+  uint32_t eflags = interrupt_save_disable();
+  vma_t **link = dst;
+  for (vma_t *vma = *src; vma; vma = vma->next) {
+    vma_t *copy = kmem_cache_alloc(&vma_cache);
+    if (copy == NULL) {
+      while (*dst) {
+        vma_t *next = (*dst)->next;
+        vma_free(*dst);
+        *dst = next;
+      }
+    }
+    CHECK_RESTORE(copy == NULL, "No memory.", ENOMEM);
+    u_memcpy(copy, vma, sizeof(vma_t));
+    vma_ref(copy);
+    copy->next = NULL;
+    *link = copy;
+    link = &copy->next;
+  }
+  interrupt_restore(eflags);
+
+  return 0;
+}
+
+void vma_clear(vma_t **list)
+{
+  // Unmapping a whole region never splits it, so this cannot fail.
+  while (*list)
+    vma_unmap(list, (*list)->start, (*list)->end - (*list)->start);
+}
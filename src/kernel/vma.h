@@ -0,0 +1,81 @@
+// vma.h
+//
+// Memory mapped regions of user address spaces.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _VMA_H_
+#define _VMA_H_
+
+#include "../common/stdint.h"
+#include "fs.h"
+#include "shm.h"
+
+// A file that backs one or more regions.
+typedef struct vma_file_s
+{
+  fs_node_t node;
+  uint32_t refcount;
+} vma_file_t;
+
+// A mapped region of a user address space, [start, end). Pages are
+// only allocated when they are first accessed, and are zero-filled or
+// read from the backing file.
+typedef struct vma_s
+{
+  uint32_t start;
+  uint32_t end;
+  uint32_t prot;      // PROT_* flags.
+  uint32_t flags;     // MAP_* flags.
+  vma_file_t *file;   // NULL for anonymous regions.
+  shm_segment_t *shm; // Shared memory segment, if any.
+  uint32_t offset;    // File or segment offset of `start`.
+  struct vma_s *next; // Regions are kept in order of address.
+} vma_t;
+
+// These functions operate on the current address space, and take
+// the list of regions of that address space. Addresses and lengths
+// must be page aligned.
+
+// Add a region over a range of reserved but unmapped virtual pages.
+// `node` is copied if the region is not anonymous. Fails with EEXIST
+// if the range overlaps another region.
+uint32_t vma_map(vma_t **,
+                 uint32_t vaddr,
+                 uint32_t len,
+                 uint32_t prot,
+                 uint32_t flags,
+                 fs_node_t *,
+                 uint32_t offset);
+
+// Add a shared region over a range of reserved but unmapped virtual
+// pages that maps a shared memory segment. Takes over a reference to
+// the segment if it succeeds.
+uint32_t vma_map_shm(vma_t **, uint32_t vaddr, uint32_t len, uint32_t prot, shm_segment_t *);
+
+// Unmap a range of pages and remove it from any regions. Pages of
+// shared file regions are written back to the file if they are dirty.
+// Pages that are not part of a region are unmapped and freed as well.
+uint32_t vma_unmap(vma_t **, uint32_t vaddr, uint32_t len);
+
+// Change the protection of a range of pages, which must all be part
+// of regions.
+uint32_t vma_protect(vma_t **, uint32_t vaddr, uint32_t len, uint32_t prot);
+
+// Find the region that contains an address, or NULL.
+vma_t *vma_find(vma_t *, uint32_t vaddr);
+
+// Handle a page fault. Returns 0 if a page was loaded, 1 if the fault
+// has to be handled elsewhere, EACCES if the region does not allow the
+// access, or another error code.
+uint32_t vma_fault(vma_t **, uint32_t vaddr, uint8_t write);
+
+// Copy the regions of the current address space into an empty list,
+// for a child process whose page directory is cloned afterwards. Pages
+// of shared regions are loaded first so that both processes use them.
+uint32_t vma_clone(vma_t **dst, vma_t **src);
+
+// Unmap every region.
+void vma_clear(vma_t **);
+
+#endif /* _VMA_H_ */
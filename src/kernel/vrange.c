@@ -0,0 +1,404 @@
+// vrange.c
+//
+// Virtual address range allocator.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "vrange.h"
+#include "../common/errno.h"
+#include "../common/stdint.h"
+#include "constants.h"
+#include "interrupt.h"
+#include "kheap.h"
+#include "log.h"
+#include "util.h"
+#include <stddef.h>
+
+// Free ranges are kept in AVL trees ordered by start address. Every
+// node also records the length of the largest range in its subtree,
+// which lets allocations skip subtrees that cannot satisfy them, so
+// that finding, reserving and releasing a range takes logarithmic time.
+//
+// Nodes come from a private pool rather than from the kernel heap
+// because growing the kernel heap allocates virtual addresses itself.
+// The pool is refilled before every operation, so an operation on the
+// kernel's set that is nested inside a refill always finds nodes.
+
+// Minimum number of free nodes kept in the pool. Each operation
+// needs at most two.
+static const uint32_t NODE_RESERVE = 8;
+#define BOOT_NODES 32
+
+static vrange_node_t boot_nodes[BOOT_NODES];
+static vrange_node_t *free_nodes = NULL; // Linked through `left`.
+static uint32_t free_node_count = 0;
+static uint8_t pool_initialized = 0;
+static uint8_t refilling = 0;
+
+static void node_free(vrange_node_t *node)
+{
+  node->left = free_nodes;
+  free_nodes = node;
+  ++free_node_count;
+}
+
+static vrange_node_t *node_alloc(uint32_t start, uint32_t end)
+{
+  vrange_node_t *node = free_nodes;
+  if (node == NULL) {
+    log_error("vrange", "Out of nodes.\n");
+    return NULL;
+  }
+  free_nodes = node->left;
+  --free_node_count;
+
+  node->start = start;
+  node->end = end;
+  node->max_len = end - start;
+  node->height = 1;
+  node->left = NULL;
+  node->right = NULL;
+  return node;
+}
+
+// Make sure that the pool holds at least NODE_RESERVE nodes.
+static void pool_refill()
+{
+  if (pool_initialized == 0) {
+    pool_initialized = 1;
+    for (uint32_t i = 0; i < BOOT_NODES; ++i)
+      node_free(boot_nodes + i);
+  }
+  if (refilling || free_node_count >= NODE_RESERVE)
+    return;
+
+  refilling = 1;
+  vrange_node_t *page = kheap_alloc_pages(1);
+  refilling = 0;
+  if (page == NULL)
+    return;
+  for (uint32_t i = 0; i < PAGE_SIZE / sizeof(vrange_node_t); ++i)
+    node_free(page + i);
+}
+
+static inline int32_t height(vrange_node_t *node)
+{
+  return node ? node->height : 0;
+}
+static inline uint32_t max_len(vrange_node_t *node)
+{
+  return node ? node->max_len : 0;
+}
+
+// Recompute the height and max_len of a node from its children.
+static void update(vrange_node_t *node)
+{
+  int32_t lh = height(node->left), rh = height(node->right);
+  node->height = (lh > rh ? lh : rh) + 1;
+  node->max_len = node->end - node->start;
+  if (max_len(node->left) > node->max_len)
+    node->max_len = max_len(node->left);
+  if (max_len(node->right) > node->max_len)
+    node->max_len = max_len(node->right);
+}
+
+static vrange_node_t *rotate_right(vrange_node_t *node)
+{
+  vrange_node_t *left = node->left;
+  node->left = left->right;
+  left->right = node;
+  update(node);
+  update(left);
+  return left;
+}
+
+static vrange_node_t *rotate_left(vrange_node_t *node)
+{
+  vrange_node_t *right = node->right;
+  node->right = right->left;
+  right->left = node;
+  update(node);
+  update(right);
+  return right;
+}
+
+// Restore the AVL invariant at a node whose subtrees are balanced.
+static vrange_node_t *balance(vrange_node_t *node)
+{
+  update(node);
+  int32_t diff = height(node->left) - height(node->right);
+  if (diff > 1) {
+    if (height(node->left->left) < height(node->left->right))
+      node->left = rotate_left(node->left);
+    return rotate_right(node);
+  }
+  if (diff < -1) {
+    if (height(node->right->right) < height(node->right->left))
+      node->right = rotate_right(node->right);
+    return rotate_left(node);
+  }
+  return node;
+}
+
+static vrange_node_t *insert(vrange_node_t *root, vrange_node_t *node)
+{
+  if (root == NULL)
+    return node;
+  if (node->start < root->start)
+    root->left = insert(root->left, node);
+  else
+    root->right = insert(root->right, node);
+  return balance(root);
+}
+
+// Detach the leftmost node of a subtree and store it in `min`.
+static vrange_node_t *remove_min(vrange_node_t *root, vrange_node_t **min)
+{
+  if (root->left == NULL) {
+    *min = root;
+    return root->right;
+  }
+  root->left = remove_min(root->left, min);
+  return balance(root);
+}
+
+// Detach the node that starts at `start`.
+static vrange_node_t *remove(vrange_node_t *root, uint32_t start)
+{
+  if (root == NULL)
+    return NULL;
+  if (start < root->start) {
+    root->left = remove(root->left, start);
+    return balance(root);
+  }
+  if (start > root->start) {
+    root->right = remove(root->right, start);
+    return balance(root);
+  }
+
+  if (root->right == NULL)
+    return root->left;
+  vrange_node_t *min;
+  vrange_node_t *right = remove_min(root->right, &min);
+  min->left = root->left;
+  min->right = right;
+  return balance(min);
+}
+
+// Find a range that overlaps or touches [start, end].
+static vrange_node_t *find_adjacent(vrange_node_t *node, uint32_t start, uint32_t end)
+{
+  while (node) {
+    if (node->end < start)
+      node = node->right;
+    else if (node->start > end)
+      node = node->left;
+    else
+      return node;
+  }
+  return NULL;
+}
+
+// Find a range that overlaps [start, end).
+static vrange_node_t *find_overlapping(vrange_node_t *node, uint32_t start, uint32_t end)
+{
+  while (node) {
+    if (node->end <= start)
+      node = node->right;
+    else if (node->start >= end)
+      node = node->left;
+    else
+      return node;
+  }
+  return NULL;
+}
+
+// Find the lowest range with `size` free bytes at or above `base`.
+static vrange_node_t *find_first(vrange_node_t *node, uint32_t size, uint32_t base)
+{
+  if (node == NULL || node->max_len < size)
+    return NULL;
+  if (node->end > base) {
+    vrange_node_t *found = find_first(node->left, size, base);
+    if (found)
+      return found;
+    uint32_t start = node->start > base ? node->start : base;
+    if (node->end - start >= size)
+      return node;
+  }
+  return find_first(node->right, size, base);
+}
+
+// Find the highest range with `size` free bytes at or below `top`.
+static vrange_node_t *find_last(vrange_node_t *node, uint32_t size, uint32_t top)
+{
+  if (node == NULL || node->max_len < size)
+    return NULL;
+  if (node->start < top) {
+    vrange_node_t *found = find_last(node->right, size, top);
+    if (found)
+      return found;
+    uint32_t end = node->end < top ? node->end : top;
+    if (end - node->start >= size)
+      return node;
+  }
+  return find_last(node->left, size, top);
+}
+
+static void destroy(vrange_node_t *node)
+{
+  if (node == NULL)
+    return;
+  destroy(node->left);
+  destroy(node->right);
+  node_free(node);
+}
+
+static vrange_node_t *clone(vrange_node_t *node, uint32_t *err)
+{
+  if (node == NULL || *err)
+    return NULL;
+
+  // This refills the pool in the middle of building a tree, which is
+  // fine because only per-process sets are ever cloned.
+  pool_refill();
+  vrange_node_t *copy = node_alloc(node->start, node->end);
+  if (copy == NULL) {
+    *err = ENOMEM;
+    return NULL;
+  }
+  copy->left = clone(node->left, err);
+  copy->right = clone(node->right, err);
+  copy->height = node->height;
+  copy->max_len = node->max_len;
+  return copy;
+}
+
+// Remove [start, end) from the set. Must be called with interrupts
+// disabled and a refilled pool.
+static void reserve(vrange_t *vr, uint32_t start, uint32_t end)
+{
+  vrange_node_t *node;
+  while ((node = find_overlapping(vr->root, start, end))) {
+    uint32_t node_start = node->start, node_end = node->end;
+    vr->root = remove(vr->root, node_start);
+    node_free(node);
+    if (node_start < start) {
+      vrange_node_t *before = node_alloc(node_start, start);
+      if (before)
+        vr->root = insert(vr->root, before);
+    }
+    if (node_end > end) {
+      vrange_node_t *after = node_alloc(end, node_end);
+      if (after)
+        vr->root = insert(vr->root, after);
+    }
+  }
+}
+
+uint32_t vrange_init(vrange_t *vr, uint32_t start, uint32_t end)
+{
+  uint32_t eflags = interrupt_save_disable();
+  pool_refill();
+  vr->start = start;
+  vr->end = end;
+  vr->root = node_alloc(start, end);
+  interrupt_restore(eflags);
+  return vr->root ? 0 : ENOMEM;
+}
+
+void vrange_destroy(vrange_t *vr)
+{
+  uint32_t eflags = interrupt_save_disable();
+  destroy(vr->root);
+  vr->root = NULL;
+  interrupt_restore(eflags);
+}
+
+uint32_t vrange_clone(vrange_t *dst, vrange_t *src)
+{
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t err = 0;
+  dst->start = src->start;
+  dst->end = src->end;
+  dst->root = clone(src->root, &err);
+  if (err) {
+    destroy(dst->root);
+    dst->root = NULL;
+  }
+  interrupt_restore(eflags);
+  return err;
+}
+
+uint32_t vrange_alloc(vrange_t *vr, uint32_t size, uint32_t base)
+{
+  uint32_t eflags = interrupt_save_disable();
+  pool_refill();
+
+  uint32_t vaddr = 0;
+  vrange_node_t *node = find_first(vr->root, size, base);
+  if (node) {
+    vaddr = node->start > base ? node->start : base;
+    reserve(vr, vaddr, vaddr + size);
+  }
+
+  interrupt_restore(eflags);
+  return vaddr;
+}
+
+uint32_t vrange_alloc_top(vrange_t *vr, uint32_t size, uint32_t top)
+{
+  uint32_t eflags = interrupt_save_disable();
+  pool_refill();
+
+  uint32_t vaddr = 0;
+  vrange_node_t *node = find_last(vr->root, size, top);
+  if (node) {
+    vaddr = (node->end < top ? node->end : top) - size;
+    reserve(vr, vaddr, vaddr + size);
+  }
+
+  interrupt_restore(eflags);
+  return vaddr;
+}
+
+void vrange_reserve(vrange_t *vr, uint32_t vaddr, uint32_t size)
+{
+  uint32_t start = vaddr > vr->start ? vaddr : vr->start;
+  uint32_t end = vaddr + size < vr->end ? vaddr + size : vr->end;
+  if (start >= end)
+    return;
+
+  uint32_t eflags = interrupt_save_disable();
+  pool_refill();
+  reserve(vr, start, end);
+  interrupt_restore(eflags);
+}
+
+void vrange_release(vrange_t *vr, uint32_t vaddr, uint32_t size)
+{
+  uint32_t start = vaddr > vr->start ? vaddr : vr->start;
+  uint32_t end = vaddr + size < vr->end ? vaddr + size : vr->end;
+  if (start >= end)
+    return;
+
+  uint32_t eflags = interrupt_save_disable();
+  pool_refill();
+
+  // Merge with any ranges that overlap or touch the released one.
+  vrange_node_t *node;
+  while ((node = find_adjacent(vr->root, start, end))) {
+    if (node->start < start)
+      start = node->start;
+    if (node->end > end)
+      end = node->end;
+    vr->root = remove(vr->root, node->start);
+    node_free(node);
+  }
+
+  node = node_alloc(start, end);
+  if (node)
+    vr->root = insert(vr->root, node);
+
+  interrupt_restore(eflags);
+}
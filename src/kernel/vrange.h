@@ -0,0 +1,56 @@
+// vrange.h
+//
+// Virtual address range allocator.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _VRANGE_H_
+#define _VRANGE_H_
+
+#include "../common/stdint.h"
+
+// A free range of virtual addresses, [start, end).
+typedef struct vrange_node_s
+{
+  uint32_t start;
+  uint32_t end;
+  uint32_t max_len; // Length of the largest free range in this subtree.
+  int32_t height;
+  struct vrange_node_s *left;
+  struct vrange_node_s *right;
+} vrange_node_t;
+
+// The set of free ranges in part of an address space, kept in an AVL
+// tree ordered by address. Addresses outside [start, end) are ignored.
+typedef struct vrange_s
+{
+  vrange_node_t *root;
+  uint32_t start;
+  uint32_t end;
+} vrange_t;
+
+// Initialize a set in which all of [start, end) is free.
+uint32_t vrange_init(vrange_t *, uint32_t start, uint32_t end);
+
+// Free all of the nodes of a set.
+void vrange_destroy(vrange_t *);
+
+// Copy a set into an uninitialized one.
+uint32_t vrange_clone(vrange_t *dst, vrange_t *src);
+
+// Allocate the lowest range of `size` bytes at or above `base`.
+// Returns 0 if there is no such range.
+uint32_t vrange_alloc(vrange_t *, uint32_t size, uint32_t base);
+
+// Allocate the highest range of `size` bytes that ends at or below
+// `top`. Returns 0 if there is no such range.
+uint32_t vrange_alloc_top(vrange_t *, uint32_t size, uint32_t top);
+
+// Mark [vaddr, vaddr + size) as used. Parts of the range that are
+// already in use are left alone.
+void vrange_reserve(vrange_t *, uint32_t vaddr, uint32_t size);
+
+// Mark [vaddr, vaddr + size) as free.
+void vrange_release(vrange_t *, uint32_t vaddr, uint32_t size);
+
+#endif /* _VRANGE_H_ */
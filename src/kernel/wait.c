@@ -0,0 +1,84 @@
+// wait.c
+//
+// Wait queues.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "wait.h"
+#include "../common/stdint.h"
+#include "ds.h"
+#include "interrupt.h"
+#include "process.h"
+#include <stddef.h>
+
+// A waiting process is unscheduled and its kernel registers are saved
+// so that it resumes by returning from wait_suspend. Each process waits
+// on at most one queue, which it points to while it is in it.
+
+// Implemented in wait.s.
+void wait_suspend(process_registers_t *);
+
+void wait_prepare(wait_queue_t *queue, process_t *process)
+{
+  uint32_t eflags = interrupt_save_disable();
+  wait_cancel(process);
+  list_push_back(&queue->processes, process);
+  process->wait_queue = queue;
+  process->wait_node = queue->processes.tail;
+  interrupt_restore(eflags);
+}
+
+void wait_sleep(process_t *process)
+{
+  uint32_t eflags = interrupt_save_disable();
+  if (process->wait_queue) {
+    // The process may be waiting in an interrupt handler that
+    // interrupted it in user mode.
+    uint8_t in_kernel = process->in_kernel;
+    process->in_kernel = 1;
+    process_unschedule(process);
+    wait_suspend(&(process->kregs));
+    process->in_kernel = in_kernel;
+  }
+  interrupt_restore(eflags);
+}
+
+void wait_cancel(process_t *process)
+{
+  uint32_t eflags = interrupt_save_disable();
+  if (process->wait_queue) {
+    list_remove(&process->wait_queue->processes, process->wait_node, 0);
+    list_free_node(process->wait_node);
+    process->wait_queue = NULL;
+    process->wait_node = NULL;
+  }
+  interrupt_restore(eflags);
+}
+
+uint32_t wait_wake_one(wait_queue_t *queue)
+{
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t woken = 0;
+  if (queue->processes.head) {
+    process_t *process = queue->processes.head->value;
+    wait_cancel(process);
+    process_schedule(process);
+    woken = 1;
+  }
+  interrupt_restore(eflags);
+  return woken;
+}
+
+uint32_t wait_wake_all(wait_queue_t *queue)
+{
+  uint32_t eflags = interrupt_save_disable();
+  uint32_t woken = 0;
+  while (queue->processes.head) {
+    process_t *process = queue->processes.head->value;
+    wait_cancel(process);
+    process_schedule(process);
+    ++woken;
+  }
+  interrupt_restore(eflags);
+  return woken;
+}
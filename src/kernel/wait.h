@@ -0,0 +1,41 @@
+// wait.h
+//
+// Wait queues.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _WAIT_H_
+#define _WAIT_H_
+
+#include "../common/stdint.h"
+#include "ds.h"
+
+struct process_s;
+
+// A queue of processes that wait for a condition, in the order in
+// which they started waiting. An empty queue is all zeroes.
+typedef struct wait_queue_s
+{
+  list_t processes;
+} wait_queue_t;
+
+// Add a process to a wait queue. The caller then checks the condition
+// that it waits for again and calls wait_sleep, or wait_cancel if the
+// condition holds. A wake-up that comes between the check and the
+// sleep is not lost.
+void wait_prepare(wait_queue_t *, struct process_s *);
+
+// Suspend the current process until it is woken, unless it already
+// has been since wait_prepare. The process resumes in the kernel with
+// the interrupt flag it had before.
+void wait_sleep(struct process_s *);
+
+// Remove a process from the queue that it waits on, if any.
+void wait_cancel(struct process_s *);
+
+// Wake the process that has waited longest, or every process in a
+// queue. Returns the number of processes woken.
+uint32_t wait_wake_one(wait_queue_t *);
+uint32_t wait_wake_all(wait_queue_t *);
+
+#endif /* _WAIT_H_ */
@@ -0,0 +1,37 @@
+    ; wait.s
+    ;
+    ; Wait queues.
+    ;
+    ; Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+%include "constants.s"
+
+global wait_suspend
+extern process_switch_next
+
+section .text
+    ; wait_suspend -- Save the registers of the current process so that
+    ;                 it resumes by returning from here, and switch to
+    ;                 the next process. Called with interrupts disabled.
+    ; stack: [esp + 4] the kernel registers struct of the process
+    ;        [esp    ] return address
+wait_suspend:
+    mov eax, [esp + 4]
+    mov [eax], dword 0
+    mov [eax + 4], ebx
+    mov [eax + 8], ecx
+    mov [eax + 12], edx
+    mov [eax + 16], ebp
+    mov [eax + 20], esi
+    mov [eax + 24], edi
+    mov [eax + 28], dword KERNEL_DS
+    mov [eax + 32], esp
+    pushfd
+    pop ecx
+    mov [eax + 36], ecx
+    mov [eax + 40], dword KERNEL_CS
+    mov [eax + 44], dword .resume
+    call process_switch_next
+
+.resume:
+    ret
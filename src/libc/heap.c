@@ -9,9 +9,14 @@
 #include "stdint.h"
 #include "stdlib.h"
 #include "string.h"
+#include "sys/mman.h"
+#include "unistd.h"
 #include <stddef.h>
 
 // This is a simple first-fit allocator with block splitting / coalescing.
+// The heap grows and shrinks with sbrk, so new pages are adjacent to
+// the block at the top of the heap and can be merged into it. The heap
+// only shrinks from the top, and stays contiguous.
 
 static const size_t MIN_BLOCK_SIZE = 8;
 static const uint32_t PAGE_SIZE_SHIFT = 12;
@@ -30,6 +35,7 @@ struct block_s
 typedef struct block_s block_t;
 
 static block_t *head = NULL;
+static block_t *tail = NULL; // The block at the top of the heap.
 static volatile uint32_t heap_lock = 0;
 
 // Simple block properties.
@@ -90,6 +96,8 @@ static void split(block_t *block, size_t split_offset)
   if (block->size_next & 1)
     next(block)->prev = new_block;
   block->size_next = split_offset | 1;
+  if (block == tail)
+    tail = new_block;
 }
 
 // Merge a block with the next block.
@@ -103,57 +111,68 @@ static block_t *merge(block_t *block)
     next(next_block)->prev = block;
   block->size_next =
     (size(block) + size(next_block) + sizeof(block_t)) | (next_block->size_next & 1);
+  if (next_block == tail)
+    tail = block;
   return block;
 }
 
-// Allocate enough pages to make a block with the given size.
-// The `size` parameter does not include the size of the block header.
-// The new block is pushed onto the front of the free list.
-static void alloc_pages(size_t size)
+// Grow the heap to make a free block with the given size and return it.
+// The `sz` parameter does not include the size of the block header.
+// If the block at the top of the heap is free, the new pages are merged
+// into it and only the missing part is allocated.
+static block_t *alloc_pages(size_t sz)
 {
-  size = page_align_up(size + sizeof(block_t));
-  uint32_t vaddr = pagealloc(size >> PAGE_SIZE_SHIFT);
-  if (vaddr == 0)
-    return;
+  uint8_t extend = tail && is_free(tail) && (void *)next(tail) == sbrk(0);
+  size_t len = page_align_up(extend ? sz - size(tail) : sz + sizeof(block_t));
+  block_t *new_block = sbrk(len);
+  if (new_block == (void *)-1)
+    return NULL;
 
-  block_t *new_block = (block_t *)vaddr;
-  new_block->size_next = size - sizeof(block_t);
+  new_block->size_next = len - sizeof(block_t);
   new_block->prev = NULL;
   push_front(new_block);
+  if (tail && next(tail) == new_block) {
+    new_block->prev = tail;
+    tail->size_next |= 1;
+  }
+  tail = new_block;
+
+  if (new_block->prev && is_free(new_block->prev))
+    return merge(new_block->prev);
+  return new_block;
 }
 
-// Unmap and free any pages that are within `block`.
-static void free_pages(block_t *block)
+// Move the break down to return the pages at the end of the free
+// block at the top of the heap.
+static void trim(block_t *block)
 {
-  uint32_t block_start = (uint32_t)block;
+  uint32_t keep_end = page_align_up((uint32_t)(block + 1) + MIN_BLOCK_SIZE);
   uint32_t block_end = (uint32_t)next(block);
-  uint32_t page_start = page_align_up(block_start);
-  uint32_t page_end = page_align_down(block_end);
-
-  if (page_start > block_start && page_start - block_start < sizeof(block_t) + MIN_BLOCK_SIZE)
-    page_start += PAGE_SIZE;
-  if (block_end > page_end && block_end - page_end < sizeof(block_t) + MIN_BLOCK_SIZE)
-    page_end -= PAGE_SIZE;
+  if (block_end <= keep_end || block_end - keep_end < PAGE_FREE_THRESHOLD)
+    return;
+  if ((void *)block_end != sbrk(0) || sbrk(-(intptr_t)(block_end - keep_end)) == (void *)-1)
+    return;
+  block->size_next = keep_end - (uint32_t)(block + 1);
+}
 
+// Release the memory of any whole pages within the free block `block`,
+// which is not at the top of the heap. The pages are replaced with new
+// zero-filled pages, which are only allocated again when they are
+// touched, so the block stays in the heap and can be merged with its
+// neighbours as before. Unmapping them would let other mappings take
+// their place in the middle of the heap.
+static void free_pages(block_t *block)
+{
+  uint32_t page_start = page_align_up((uint32_t)(block + 1));
+  uint32_t page_end = page_align_down((uint32_t)next(block));
   if (page_start >= page_end || page_end - page_start < PAGE_FREE_THRESHOLD)
     return;
-
-  block_t *removed_block = block;
-  if (page_start > block_start) {
-    split(removed_block, page_start - (uint32_t)(removed_block + 1));
-    removed_block = head;
-  }
-  if (block_end > page_end)
-    split(removed_block, page_end - (uint32_t)(removed_block + 1));
-
-  if (removed_block->size_next & 1)
-    next(removed_block)->prev = NULL;
-  if (removed_block->prev)
-    removed_block->prev->size_next &= ~1;
-  remove(removed_block);
-
-  uint32_t npages = (page_end - page_start) >> PAGE_SIZE_SHIFT;
-  pagefree(page_start, npages);
+  mmap((void *)page_start,
+       page_end - page_start,
+       PROT_READ | PROT_WRITE,
+       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+       -1,
+       0);
 }
 
 void *malloc(size_t sz)
@@ -171,10 +190,8 @@ void *malloc(size_t sz)
   while (current && size(current) < sz)
     current = current->next_free;
 
-  if (current == NULL) {
-    alloc_pages(sz);
-    current = head;
-  }
+  if (current == NULL)
+    current = alloc_pages(sz);
   if (current == NULL || size(current) < sz) {
     thread_unlock(&heap_lock);
     return NULL;
@@ -212,7 +229,9 @@ void free(void *ptr)
   if ((block->size_next & 1) && is_free(next(block)))
     merge(block);
 
-  if (size(block) + sizeof(block_t) >= PAGE_FREE_THRESHOLD)
+  if (block == tail)
+    trim(block);
+  else if (size(block) + sizeof(block_t) >= PAGE_FREE_THRESHOLD)
     free_pages(block);
 
   thread_unlock(&heap_lock);
@@ -56,6 +56,25 @@ int32_t pagefree(uint32_t vaddr, uint32_t npages)
   return res;
 }
 
+void *shmmap(const char *name, size_t size, uint32_t flags)
+{
+  int32_t res = _syscall3(SYSCALL_SHM_MAP, (uint32_t)name, size, flags);
+  if (res < 0 && res > -4096) {
+    errno = -res;
+    return NULL;
+  }
+  return (void *)res;
+}
+int32_t shmunlink(const char *name)
+{
+  int32_t res = _syscall1(SYSCALL_SHM_UNLINK, (uint32_t)name);
+  if (res < 0) {
+    errno = -res;
+    res = -1;
+  }
+  return res;
+}
+
 static void thread_start()
 {
   uint32_t edx, ecx;
@@ -96,15 +115,48 @@ void yield()
   _syscall0(SYSCALL_YIELD);
 }
 
+int32_t futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+  int32_t res = _syscall2(SYSCALL_FUTEX_WAIT, (uint32_t)addr, val);
+  if (res < 0) {
+    errno = -res;
+    res = -1;
+  }
+  return res;
+}
+
+int32_t futex_wake(volatile uint32_t *addr, uint32_t count)
+{
+  int32_t res = _syscall2(SYSCALL_FUTEX_WAKE, (uint32_t)addr, count);
+  if (res < 0) {
+    errno = -res;
+    res = -1;
+  }
+  return res;
+}
+
+// A lock holds 0 when it is unlocked, 1 when it is locked and 2 when
+// threads may be waiting for it, so that neither locking nor unlocking
+// makes a syscall unless there is contention.
 void thread_lock(thread_lock_t l)
 {
-  while (__sync_lock_test_and_set(l, 1))
-    yield();
+  uint32_t c = __sync_val_compare_and_swap(l, 0, 1);
+  if (c == 0)
+    return;
+  if (c != 2)
+    c = __sync_lock_test_and_set(l, 2);
+  while (c != 0) {
+    futex_wait(l, 2);
+    c = __sync_lock_test_and_set(l, 2);
+  }
 }
 
 void thread_unlock(thread_lock_t l)
 {
-  __sync_lock_release(l);
+  if (__sync_fetch_and_sub(l, 1) != 1) {
+    *l = 0;
+    futex_wake(l, 1);
+  }
 }
 
 uint32_t systime()
@@ -116,3 +168,28 @@ uint32_t priority(int32_t p)
 {
   return _syscall1(SYSCALL_PRIORITY, p);
 }
+
+int32_t meminfo(pid_t pid, meminfo_t *info)
+{
+  int32_t res = _syscall2(SYSCALL_MEMINFO, pid, (uint32_t)info);
+  if (res < 0) {
+    errno = -res;
+    res = -1;
+  }
+  return res;
+}
+
+uint32_t stacksize(int32_t size)
+{
+  return _syscall1(SYSCALL_STACKSIZE, size);
+}
+
+int32_t schedinfo(pid_t pid, schedinfo_t *info)
+{
+  int32_t res = _syscall2(SYSCALL_SCHEDINFO, pid, (uint32_t)info);
+  if (res < 0) {
+    errno = -res;
+    res = -1;
+  }
+  return res;
+}
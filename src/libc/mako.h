@@ -8,6 +8,9 @@
 #ifndef _MAKO_H_
 #define _MAKO_H_
 
+#include "../common/meminfo.h"
+#include "../common/proc.h"
+#include "../common/schedinfo.h"
 #include "stdint.h"
 #include "sys/types.h"
 #include <stddef.h>
@@ -20,13 +23,20 @@ int32_t movefd(uint32_t from, uint32_t to);
 int32_t resolve(char *out, const char *in, size_t l);
 uint32_t pagealloc(uint32_t npages);
 int32_t pagefree(uint32_t vaddr, uint32_t npages);
+void *shmmap(const char *name, size_t size, uint32_t flags);
+int32_t shmunlink(const char *name);
 pid_t thread(thread_t t, void *data);
 int32_t msleep(uint32_t duration);
 void yield();
+int32_t futex_wait(volatile uint32_t *addr, uint32_t val);
+int32_t futex_wake(volatile uint32_t *addr, uint32_t count);
 void thread_lock(thread_lock_t);
 void thread_unlock(thread_lock_t);
 uint32_t systime();
 uint32_t priority(int32_t);
+int32_t meminfo(pid_t pid, meminfo_t *info);
+uint32_t stacksize(int32_t size);
+int32_t schedinfo(pid_t pid, schedinfo_t *info);
 
 void _init_thread();
 
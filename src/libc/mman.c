@@ -1,15 +1,49 @@
-
 // mman.c
 //
-// mmap stub
+// Memory mapping.
 //
 // Author: Ajay Tatachar <ajaymt2@illinois.edu>
 
 #include "sys/mman.h"
+#include "_syscall.h"
+#include "errno.h"
+#include "stdint.h"
 #include "sys/types.h"
 #include <stddef.h>
 
 void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
 {
-  return NULL;
+  if (offset < 0 || offset > UINT32_MAX) {
+    errno = EINVAL;
+    return MAP_FAILED;
+  }
+
+  mmap_args_t args = { (uint32_t)addr, len, prot, flags, fd, offset };
+  int32_t res = _syscall1(SYSCALL_MMAP, (uint32_t)&args);
+  // Mappings can be above 2GB, so only small negative results are errors.
+  if (res < 0 && res > -4096) {
+    errno = -res;
+    return MAP_FAILED;
+  }
+  return (void *)res;
+}
+
+int munmap(void *addr, size_t len)
+{
+  int32_t res = _syscall2(SYSCALL_MUNMAP, (uint32_t)addr, len);
+  if (res < 0) {
+    errno = -res;
+    res = -1;
+  }
+  return res;
+}
+
+int mprotect(void *addr, size_t len, int prot)
+{
+  int32_t res = _syscall3(SYSCALL_MPROTECT, (uint32_t)addr, len, prot);
+  if (res < 0) {
+    errno = -res;
+    res = -1;
+  }
+  return res;
 }
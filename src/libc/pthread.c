@@ -0,0 +1,148 @@
+// pthread.c
+//
+// POSIX threads.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#include "pthread.h"
+#include "errno.h"
+#include "mako.h"
+#include "stdint.h"
+#include "stdlib.h"
+#include <stddef.h>
+
+// Threads are started with `thread`. Their state is allocated by
+// pthread_create and freed by pthread_join, which waits on `done`. A
+// thread sets `done` to EXITING before it wakes the joiner and to EXITED
+// once it has finished with its state, which may then be freed.
+#define RUNNING 0
+#define EXITING 1
+#define EXITED 2
+
+struct pthread_s
+{
+  void *(*start)(void *);
+  void *arg;
+  void *retval;
+  volatile uint32_t done;
+};
+
+static void pthread_start(void *data)
+{
+  pthread_t t = data;
+  t->retval = t->start(t->arg);
+  __sync_lock_test_and_set(&t->done, EXITING);
+  futex_wake(&t->done, 1);
+  __sync_lock_test_and_set(&t->done, EXITED);
+}
+
+int32_t pthread_create(pthread_t *thread_out,
+                       const pthread_attr_t *attr,
+                       void *(*start)(void *),
+                       void *arg)
+{
+  (void)attr;
+  pthread_t t = malloc(sizeof(struct pthread_s));
+  if (t == NULL)
+    return ENOMEM;
+  t->start = start;
+  t->arg = arg;
+  t->retval = NULL;
+  t->done = RUNNING;
+
+  if ((int32_t)thread(pthread_start, t) == -1) {
+    int32_t err = errno;
+    free(t);
+    return err;
+  }
+  *thread_out = t;
+  return 0;
+}
+
+int32_t pthread_join(pthread_t t, void **retval)
+{
+  // A thread is only EXITING briefly, and may already have woken us, so
+  // we yield instead of sleeping until it has EXITED.
+  uint32_t done;
+  while ((done = t->done) != EXITED) {
+    if (done == RUNNING)
+      futex_wait(&t->done, RUNNING);
+    else
+      yield();
+  }
+  if (retval)
+    *retval = t->retval;
+  free(t);
+  return 0;
+}
+
+int32_t pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
+{
+  (void)attr;
+  mutex->state = 0;
+  return 0;
+}
+
+int32_t pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+  return mutex->state ? EBUSY : 0;
+}
+
+int32_t pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+  thread_lock(&mutex->state);
+  return 0;
+}
+
+int32_t pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+  return __sync_bool_compare_and_swap(&mutex->state, 0, 1) ? 0 : EBUSY;
+}
+
+int32_t pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+  thread_unlock(&mutex->state);
+  return 0;
+}
+
+int32_t pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+  (void)attr;
+  cond->seq = 0;
+  return 0;
+}
+
+int32_t pthread_cond_destroy(pthread_cond_t *cond)
+{
+  (void)cond;
+  return 0;
+}
+
+// A signal that comes between unlocking the mutex and waiting changes
+// `seq`, so the wait returns immediately instead of missing it.
+int32_t pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+  uint32_t seq = cond->seq;
+  pthread_mutex_unlock(mutex);
+  futex_wait(&cond->seq, seq);
+
+  // Other woken threads may be waiting for the mutex, so it is taken
+  // in the contended state to make sure that they are woken in turn.
+  while (__sync_lock_test_and_set(&mutex->state, 2))
+    futex_wait(&mutex->state, 2);
+  return 0;
+}
+
+int32_t pthread_cond_signal(pthread_cond_t *cond)
+{
+  __sync_fetch_and_add(&cond->seq, 1);
+  futex_wake(&cond->seq, 1);
+  return 0;
+}
+
+int32_t pthread_cond_broadcast(pthread_cond_t *cond)
+{
+  __sync_fetch_and_add(&cond->seq, 1);
+  futex_wake(&cond->seq, UINT32_MAX);
+  return 0;
+}
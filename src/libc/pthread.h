@@ -0,0 +1,63 @@
+// pthread.h
+//
+// POSIX threads.
+//
+// Author: Ajay Tatachar <ajaymt2@illinois.edu>
+
+#ifndef _PTHREAD_H_
+#define _PTHREAD_H_
+
+#include "stdint.h"
+
+typedef struct pthread_s *pthread_t;
+
+typedef struct pthread_attr_s
+{
+  uint32_t unused;
+} pthread_attr_t;
+
+// Same as thread_lock_t: 0 when unlocked, 1 when locked and 2 when
+// threads may be waiting.
+typedef struct pthread_mutex_s
+{
+  volatile uint32_t state;
+} pthread_mutex_t;
+
+typedef struct pthread_mutexattr_s
+{
+  uint32_t unused;
+} pthread_mutexattr_t;
+
+// Waiters sleep until `seq` changes, which it does on every signal.
+typedef struct pthread_cond_s
+{
+  volatile uint32_t seq;
+} pthread_cond_t;
+
+typedef struct pthread_condattr_s
+{
+  uint32_t unused;
+} pthread_condattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+#define PTHREAD_COND_INITIALIZER { 0 }
+
+int32_t pthread_create(pthread_t *thread,
+                       const pthread_attr_t *attr,
+                       void *(*start)(void *),
+                       void *arg);
+int32_t pthread_join(pthread_t thread, void **retval);
+
+int32_t pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr);
+int32_t pthread_mutex_destroy(pthread_mutex_t *mutex);
+int32_t pthread_mutex_lock(pthread_mutex_t *mutex);
+int32_t pthread_mutex_trylock(pthread_mutex_t *mutex);
+int32_t pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+int32_t pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
+int32_t pthread_cond_destroy(pthread_cond_t *cond);
+int32_t pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int32_t pthread_cond_signal(pthread_cond_t *cond);
+int32_t pthread_cond_broadcast(pthread_cond_t *cond);
+
+#endif /* _PTHREAD_H_ */
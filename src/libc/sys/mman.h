@@ -1,16 +1,20 @@
-
 // mman.h
 //
-// mmap stub
+// Memory mapping.
 //
 // Author: Ajay Tatachar <ajaymt2@illinois.edu>
 
 #ifndef _MMAN_H_
 #define _MMAN_H_
 
+#include "../../common/mman.h"
 #include "types.h"
 #include <stddef.h>
 
+#define MAP_FAILED ((void *)-1)
+
 void *mmap(void *, size_t, int, int, int, off_t);
+int munmap(void *, size_t);
+int mprotect(void *, size_t, int);
 
 #endif /* _MMAN_H_ */
@@ -5,8 +5,8 @@
 //
 // Author: Ajay Tatachar <ajaymt2@illinois.edu>
 
-#ifndef _TIME_H_
-#define _TIME_H_
+#ifndef _SYS_TIME_H_
+#define _SYS_TIME_H_
 
 #include "../stdint.h"
 #include "types.h"
@@ -19,4 +19,4 @@ struct timeval
 
 int32_t gettimeofday(struct timeval *, void *);
 
-#endif /* _TIME_H_ */
+#endif /* _SYS_TIME_H_ */
@@ -5,17 +5,18 @@
 //
 // Author: Ajay Tatachar <ajaymt2@illinois.edu>
 
-#include "mako.h"
 #include "stdint.h"
 #include "sys/time.h"
+#include "time.h"
 #include "sys/types.h"
 
 int32_t gettimeofday(struct timeval *tv, void *tz)
 {
-  uint32_t t = systime();
   if (tv == NULL)
     return 0;
-  tv->tv_sec = t / 1000;
-  tv->tv_usec = t * 1000;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  tv->tv_sec = ts.tv_sec;
+  tv->tv_usec = ts.tv_nsec / 1000;
   return 0;
 }
@@ -6,6 +6,8 @@
 // Author: Ajay Tatachar <ajaymt2@illinois.edu>
 
 #include "time.h"
+#include "_syscall.h"
+#include "errno.h"
 #include "stdint.h"
 #include "string.h"
 #include "sys/types.h"
@@ -73,6 +75,37 @@ char *ctime(const time_t *timep)
   return asctime(NULL);
 }
 
+int32_t clock_gettime(clockid_t clock, struct timespec *tp)
+{
+  uint64_t ns;
+  int32_t res = _syscall2(SYSCALL_CLOCK_GETTIME, clock, (uint32_t)&ns);
+  if (res < 0) {
+    errno = -res;
+    return -1;
+  }
+  tp->tv_sec = ns / 1000000000;
+  tp->tv_nsec = ns % 1000000000;
+  return 0;
+}
+
+int32_t nanosleep(const struct timespec *req, struct timespec *rem)
+{
+  if (req->tv_sec < 0 || req->tv_sec > 0xffffffff || req->tv_nsec < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  int32_t res = _syscall2(SYSCALL_NANOSLEEP, (uint32_t)req->tv_sec, req->tv_nsec);
+  if (res < 0) {
+    errno = -res;
+    return -1;
+  }
+  if (rem) {
+    rem->tv_sec = 0;
+    rem->tv_nsec = 0;
+  }
+  return 0;
+}
+
 clock_t clock()
 {
   return 0x420;
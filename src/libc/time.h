@@ -8,6 +8,7 @@
 #ifndef _TIME_H_
 #define _TIME_H_
 
+#include "../common/clock.h"
 #include "stdint.h"
 #include "sys/types.h"
 #include <stddef.h>
@@ -38,6 +39,22 @@ time_t mktime(struct tm *tm);
 char *asctime(const struct tm *tm);
 char *ctime(const time_t *timep);
 
+struct timespec
+{
+  time_t tv_sec;
+  int32_t tv_nsec;
+};
+
+typedef uint32_t clockid_t;
+
+// Get the time of a clock with nanosecond resolution. Both clocks
+// count from boot.
+int32_t clock_gettime(clockid_t clock, struct timespec *tp);
+
+// Sleep for a duration with nanosecond resolution. `rem` is cleared
+// since sleeps are not interrupted early.
+int32_t nanosleep(const struct timespec *req, struct timespec *rem);
+
 typedef uint32_t clock_t;
 
 clock_t clock();
@@ -168,3 +168,23 @@ int32_t dup(uint32_t fd)
   }
   return res;
 }
+
+void *sbrk(intptr_t increment)
+{
+  int32_t res = _syscall1(SYSCALL_SBRK, (uint32_t)increment);
+  if (res < 0 && res > -4096) {
+    errno = -res;
+    return (void *)-1;
+  }
+  return (void *)res;
+}
+
+int32_t brk(void *addr)
+{
+  void *current = sbrk(0);
+  if (current == (void *)-1)
+    return -1;
+  if (sbrk((intptr_t)addr - (intptr_t)current) == (void *)-1)
+    return -1;
+  return 0;
+}
@@ -29,5 +29,7 @@ off_t lseek(uint32_t fd, off_t offset, int32_t whence);
 int32_t unlink(const char *path);
 int32_t rmdir(const char *path);
 int32_t dup(uint32_t fd);
+int32_t brk(void *addr);
+void *sbrk(intptr_t increment);
 
 #endif /* _UNISTD_H_ */